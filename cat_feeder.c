@@ -10,3 +10,85 @@ void cat_feeder_set_feed_time_today(struct tm *feed_time,
   feed_time->tm_mon = now->tm_mon;
   // year day and daylight savings time not important
 }
+
+// Days before the first of each month in a non leap year
+static const uint16_t days_before_month[12] =
+  {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+static const uint16_t year_2000_offset = 100;
+#define SECONDS_PER_DAY 86400UL
+// 01/01/2000 was a Saturday
+#define JAN_1_2000_WDAY 6
+
+uint32_t cat_feeder_to_seconds(const struct tm *time)
+{
+  uint16_t year = time->tm_year - year_2000_offset;
+  // Whole years, 2000 was a leap year so count it in the leap days
+  uint32_t days = (uint32_t)year * 365 + (year + 3) / 4;
+  days += days_before_month[time->tm_mon];
+  if (time->tm_mon > 1 && (year % 4) == 0)
+  {
+    ++days;
+  }
+  days += time->tm_mday - 1;
+  return days * SECONDS_PER_DAY + (uint32_t)time->tm_hour * 3600
+    + (uint16_t)time->tm_min * 60 + time->tm_sec;
+}
+
+void cat_feeder_from_seconds(uint32_t seconds, struct tm *time)
+{
+  uint32_t days = seconds / SECONDS_PER_DAY;
+  uint32_t day_seconds = seconds % SECONDS_PER_DAY;
+  time->tm_hour = day_seconds / 3600;
+  time->tm_min = (day_seconds % 3600) / 60;
+  time->tm_sec = day_seconds % 60;
+  time->tm_wday = (days + JAN_1_2000_WDAY) % 7;
+
+  uint16_t year = 0;
+  while (1)
+  {
+    uint16_t year_days = (year % 4) == 0 ? 366 : 365;
+    if (days < year_days)
+      break;
+    days -= year_days;
+    ++year;
+  }
+  time->tm_year = year + year_2000_offset;
+  time->tm_yday = days;
+
+  uint8_t leap = (year % 4) == 0;
+  uint8_t month = 11;
+  while (month > 0 &&
+      days < days_before_month[month] + (leap && month > 1))
+  {
+    --month;
+  }
+  time->tm_mon = month;
+  time->tm_mday = days - days_before_month[month] - (leap && month > 1) + 1;
+}
+
+uint16_t cat_feeder_feeds_due(uint32_t last_feed, uint32_t now)
+{
+  if (now <= last_feed)
+  {
+    return 0;
+  }
+  return (now - last_feed) / CAT_FEEDER_FEED_INTERVAL;
+}
+
+uint8_t cat_feeder_catch_up_feeds(uint16_t missed)
+{
+  if (missed == 0)
+  {
+    return 0;
+  }
+  switch (CAT_FEEDER_CATCH_UP_POLICY)
+  {
+    case CatchUpOnce:
+      return 1;
+    case CatchUpAll:
+      return missed < CAT_FEEDER_CATCH_UP_MAX ? missed : CAT_FEEDER_CATCH_UP_MAX;
+    case CatchUpSkip:
+    default:
+      return 0;
+  }
+}
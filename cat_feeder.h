@@ -2,8 +2,31 @@
 #ifndef _CAT_FEEDER_H_
 #define _CAT_FEEDER_H_
 
+#include <stdint.h>
 #include <time.h>
 
+// Time between scheduled feeds in seconds
+#ifndef CAT_FEEDER_FEED_INTERVAL
+#define CAT_FEEDER_FEED_INTERVAL (12UL * 60UL * 60UL)
+#endif
+
+/// @brief CatchUpPolicy is an enumeration of what to do about feeds that
+/// were missed while the feeder had no power
+enum CatchUpPolicy
+{
+  CatchUpSkip = 0,
+  CatchUpOnce = 1,
+  CatchUpAll = 2
+};
+
+#ifndef CAT_FEEDER_CATCH_UP_POLICY
+#define CAT_FEEDER_CATCH_UP_POLICY CatchUpOnce
+#endif
+// Most feeds dispensed at once by CatchUpAll
+#ifndef CAT_FEEDER_CATCH_UP_MAX
+#define CAT_FEEDER_CATCH_UP_MAX 2
+#endif
+
 /// @brief Set a generic daily feed time to the current date
 ///
 /// Set a daily time like 7 a.m. (07:00:00) with arbitrary (default to 
@@ -14,4 +37,31 @@
 void cat_feeder_set_feed_time_today(struct tm *feed_time, 
     struct tm *now);
 
+/// @brief Convert an RTC time to seconds since 00:00:00 01/01/2000
+///
+/// Valid for the years 2000 to 2099 the RTC can hold
+/// @param time is a pointer to the time to convert
+/// @returns seconds - the number of seconds since 00:00:00 01/01/2000
+uint32_t cat_feeder_to_seconds(const struct tm *time);
+
+/// @brief Convert seconds since 00:00:00 01/01/2000 to a time
+/// @param seconds is the number of seconds since 00:00:00 01/01/2000
+/// @param time is a pointer to the time to be updated
+void cat_feeder_from_seconds(uint32_t seconds, struct tm *time);
+
+/// @brief Count the scheduled feeds that are due
+///
+/// Feeds are scheduled every CAT_FEEDER_FEED_INTERVAL after the last feed
+/// @param last_feed is the time of the last feed in seconds since 2000
+/// @param now is the current time in seconds since 2000
+/// @returns the number of scheduled feeds in (last_feed, now]
+uint16_t cat_feeder_feeds_due(uint32_t last_feed, uint32_t now);
+
+/// @brief Decide how many feeds to dispense for missed feeds
+///
+/// Applies CAT_FEEDER_CATCH_UP_POLICY
+/// @param missed is the number of scheduled feeds that were missed
+/// @returns the number of feeds to dispense now
+uint8_t cat_feeder_catch_up_feeds(uint16_t missed);
+
 #endif
@@ -0,0 +1,57 @@
+
+#include "clock.h"
+#include "timebase.h"
+#include "usart.h"
+#include "twi.h"
+#include "profile.h"
+#include "status_led.h"
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/* PRIVATE GLOBALS */
+static enum ClockSpeed current_speed;
+
+// Change the prescaler, the new setting has to be written within four
+// cycles of the change enable
+static void clock_write_prescaler(enum ClockSpeed speed)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    CLKPR = (1 << CLKPCE);
+    CLKPR = speed;
+    current_speed = speed;
+    // Keep the time base, the profiler and the status LED at the same
+    // rates
+    timebase_set_clock();
+    profile_set_clock();
+    status_led_set_clock();
+  }
+}
+
+void clock_open(void)
+{
+  clock_write_prescaler(ClockFull);
+}
+
+void clock_set(enum ClockSpeed speed)
+{
+  if (speed == current_speed)
+  {
+    return;
+  }
+  // A character being shifted out would be garbled by the new baud rate
+  usart_flush();
+  clock_write_prescaler(speed);
+  usart_set_clock();
+  twi_set_clock();
+}
+
+enum ClockSpeed clock_speed(void)
+{
+  return current_speed;
+}
+
+uint32_t clock_hz(void)
+{
+  return F_CPU >> current_speed;
+}
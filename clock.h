@@ -0,0 +1,52 @@
+/*
+ * @file clock.h
+ * @brief System clock prescaler control.
+ *
+ * F_CPU is the oscillator frequency. The CPU and peripheral clock can be
+ * divided down from it at runtime with CLKPR to save power while idle, and
+ * every peripheral with a clock derived setting is retimed on each change:
+ * the USART baud rate, the TWI bit rate, the Timer1 prescaler of the
+ * time base, the Timer0 period of the profiler and the Timer2 period of
+ * the status LED.
+ */
+#ifndef _CAT_FEEDER_CLOCK_H_
+#define _CAT_FEEDER_CLOCK_H_
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#error "F_CPU must be set to the oscillator frequency"
+#endif
+
+/// @brief ClockSpeed is an enumeration of the system clock settings, the
+/// value is the CLKPR prescaler select (the clock is F_CPU >> value)
+///
+/// The low clock divides by the time base prescaler so Timer1 can keep
+/// counting at TIMEBASE_HZ by running undivided.
+enum ClockSpeed
+{
+  ClockFull = 0,
+  ClockLow = 3
+};
+
+/// @brief Run at full speed, call before any peripheral is opened
+///
+/// Overrides the CKDIV8 fuse setting.
+void clock_open(void);
+
+/// @brief Change the system clock and retime the peripherals
+///
+/// Waits for a character being sent on the serial port to finish first.
+/// Must not be called from an interrupt or during a TWI transfer.
+/// @param speed is the new clock setting
+void clock_set(enum ClockSpeed speed);
+
+/// @brief Get the current clock setting
+/// @returns speed - the current clock setting
+enum ClockSpeed clock_speed(void);
+
+/// @brief Get the current CPU and peripheral clock frequency
+/// @returns hz - the clock frequency in Hz
+uint32_t clock_hz(void);
+
+#endif
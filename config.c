@@ -0,0 +1,283 @@
+
+#include "config.h"
+#include "counters.h"
+#include "dose.h"
+#include "feed_switch.h"
+#include "hub.h"
+#include "rtc.h"
+#include "supply.h"
+#include "timebase.h"
+#include "twi.h"
+#include "usart.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+/* DEFINES */
+// Programming time of an EEPROM byte, rounded up
+#define CONFIG_BYTE_US 3600
+// Limits of a setting, a write outside them is refused
+#define CONFIG_ADC_MAX 1023
+// The longest serial dump, the 's' counters at about 800 characters, has
+// to go out well within the 2 s watchdog period
+#define CONFIG_BAUD_MIN 9600
+#define CONFIG_BAUD_MAX 115200
+#define CONFIG_SCL_MIN 10000
+#define CONFIG_SCL_MAX 400000
+#define CONFIG_ADDRESS_MIN 0x08
+#define CONFIG_ADDRESS_MAX 0x77
+#define CONFIG_SUPPLY_MIN_MV 1800
+#define CONFIG_SUPPLY_MAX_MV 5500
+// 100 g a portion
+#define CONFIG_DOSE_MAX_DG 1000
+
+#define CONFIG_SLOTS 2
+
+/// @brief The settings as stored in one EEPROM slot
+struct config_record_t
+{
+  uint16_t sequence;
+  struct config_t config;
+  uint8_t version;
+  // CRC of the fields above
+  uint16_t crc;
+};
+
+/* PRIVATE GLOBALS */
+static struct config_record_t EEMEM slots_eeprom[CONFIG_SLOTS];
+// The newest record, or the one being written back
+static struct config_record_t record;
+// Slot of the newest valid record, the write back goes to the other one
+static uint8_t newest_slot;
+// Bit per byte of the record that differs from the slot written back to,
+// the record has to stay under 32 bytes
+static uint32_t dirty;
+// Set by a change, the dirty bytes are written back from the deadline on
+static uint8_t write_back;
+static uint32_t deadline;
+
+static const struct config_t ConfigDefaults PROGMEM = {
+  .feed_low_to_med = FEED_MODE_LOW_TO_MED,
+  .feed_med_to_high = FEED_MODE_MED_TO_HIGH,
+  .usart_baud = USART_BAUD,
+  .twi_scl_freq = TWI_SCL_FREQ,
+  .rtc_address = RTC_ADDRESS,
+  .hub_address = HUB_ADDRESS,
+  .supply_low_mv = SUPPLY_LOW_MV,
+  .supply_critical_mv = SUPPLY_CRITICAL_MV,
+  .dose_dg = {DOSE_LOW_DG, DOSE_MED_DG, DOSE_HIGH_DG}
+};
+
+/* PUBLIC GLOBAL DEFINITIONS */
+struct config_t config;
+
+/// @brief Calculate the CRC of a record
+static uint16_t config_crc(const struct config_record_t *stored)
+{
+  const uint8_t *data = (const uint8_t *)stored;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i=0; i < offsetof(struct config_record_t, crc); ++i)
+  {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+static uint8_t config_address_valid(uint8_t address)
+{
+  return address >= CONFIG_ADDRESS_MIN && address <= CONFIG_ADDRESS_MAX;
+}
+
+/// @brief Check that settings are in range and consistent
+/// @returns 0 if they are, otherwise 1
+static uint8_t config_check(const struct config_t *settings)
+{
+  if (settings->feed_low_to_med == 0 ||
+      settings->feed_low_to_med >= settings->feed_med_to_high ||
+      settings->feed_med_to_high > CONFIG_ADC_MAX)
+  {
+    return 1;
+  }
+  if (settings->usart_baud < CONFIG_BAUD_MIN ||
+      settings->usart_baud > CONFIG_BAUD_MAX ||
+      settings->twi_scl_freq < CONFIG_SCL_MIN ||
+      settings->twi_scl_freq > CONFIG_SCL_MAX)
+  {
+    return 1;
+  }
+  // The feeder can't answer the hub at the address of its own RTC
+  if (!config_address_valid(settings->rtc_address) ||
+      !config_address_valid(settings->hub_address) ||
+      settings->rtc_address == settings->hub_address)
+  {
+    return 1;
+  }
+  if (settings->supply_critical_mv < CONFIG_SUPPLY_MIN_MV ||
+      settings->supply_critical_mv >= settings->supply_low_mv ||
+      settings->supply_low_mv > CONFIG_SUPPLY_MAX_MV)
+  {
+    return 1;
+  }
+  for (uint8_t i=0; i < 3; ++i)
+  {
+    if (settings->dose_dg[i] == 0 ||
+        settings->dose_dg[i] > CONFIG_DOSE_MAX_DG)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// @brief Get the slot the write back goes to
+static uint8_t *config_target(void)
+{
+  return (uint8_t *)&slots_eeprom[(newest_slot + 1) % CONFIG_SLOTS];
+}
+
+/// @brief Mark the bytes of the record from offset on that differ from the
+/// slot written back to, and clear the marks of those that don't
+static void config_mark(uint8_t offset, uint8_t len)
+{
+  const uint8_t *stored = config_target();
+  const uint8_t *bytes = (const uint8_t *)&record;
+  for (uint8_t i=offset; i < offset + len; ++i)
+  {
+    // Compared with the EEPROM rather than the last value, a byte that is
+    // changed back before the write back costs nothing
+    if (eeprom_read_byte(stored + i) != bytes[i])
+      dirty |= 1UL << i;
+    else
+      dirty &= ~(1UL << i);
+  }
+}
+
+/// @brief Finish a write back, the slot written to holds the newest record
+static void config_written(void)
+{
+  newest_slot = (newest_slot + 1) % CONFIG_SLOTS;
+  write_back = 0;
+}
+
+uint8_t config_open(void)
+{
+  dirty = 0;
+  write_back = 0;
+  int8_t newest = -1;
+  for (uint8_t i=0; i < CONFIG_SLOTS; ++i)
+  {
+    struct config_record_t stored;
+    eeprom_read_block(&stored, &slots_eeprom[i], sizeof(stored));
+    if (stored.crc != config_crc(&stored) || stored.version != CONFIG_VERSION
+        || config_check(&stored.config))
+    {
+      continue;
+    }
+    // Sequence numbers wrap around, compare the difference
+    if (newest < 0 || (int16_t)(stored.sequence - record.sequence) > 0)
+    {
+      newest = i;
+      record = stored;
+    }
+  }
+  if (newest >= 0)
+  {
+    newest_slot = newest;
+    config = record.config;
+    return 0;
+  }
+  // A slot is written with the first change
+  memset(&record, 0, sizeof(record));
+  memcpy_P(&record.config, &ConfigDefaults, sizeof(record.config));
+  record.version = CONFIG_VERSION;
+  newest_slot = CONFIG_SLOTS - 1;
+  config = record.config;
+  return 1;
+}
+
+uint8_t config_write(uint8_t offset, const void *data, uint8_t len)
+{
+  if (len == 0 || offset >= sizeof(struct config_t) ||
+      len > sizeof(struct config_t) - offset)
+  {
+    return 1;
+  }
+  struct config_t settings = config;
+  memcpy((uint8_t *)&settings + offset, data, len);
+  if (config_check(&settings))
+  {
+    return 1;
+  }
+  // The feed switch reads the settings from its interrupt
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    config = settings;
+  }
+  record.config = settings;
+  if (write_back && dirty == 0)
+  {
+    // Every byte went out but config_service() hasn't seen it yet. The
+    // slot written back to holds a complete newer record, patching it in
+    // place would put that record at risk, start on the other slot.
+    config_written();
+  }
+  if (!write_back)
+  {
+    // A new write back, the whole record goes to the older slot under the
+    // next sequence number. The newest slot is left as it is until the
+    // CRC of the other one is written, so a power loss in between falls
+    // back on the previous settings.
+    ++record.sequence;
+    record.crc = config_crc(&record);
+    config_mark(0, sizeof(record));
+  }
+  else
+  {
+    record.crc = config_crc(&record);
+    config_mark(offsetof(struct config_record_t, config) + offset, len);
+    config_mark(offsetof(struct config_record_t, crc), sizeof(record.crc));
+  }
+  write_back = 1;
+  deadline = timebase_ticks() + timebase_us_to_ticks(CONFIG_WRITE_DELAY_MS
+      * 1000UL);
+  return 0;
+}
+
+void config_service(void)
+{
+  if (!write_back)
+  {
+    return;
+  }
+  if (dirty == 0)
+  {
+    config_written();
+    return;
+  }
+  if (!timebase_reached(deadline))
+  {
+    // An earlier wake up may have replaced this one
+    timebase_wake_at(deadline);
+    return;
+  }
+  if (eeprom_is_ready())
+  {
+    // Lowest byte first, the CRC is at the end of the record
+    uint8_t offset = 0;
+    while (!(dirty & (1UL << offset)))
+    {
+      ++offset;
+    }
+    COUNTER_BEGIN();
+    eeprom_update_byte(config_target() + offset,
+        ((const uint8_t *)&record)[offset]);
+    COUNTER_END(CounterEeprom);
+    dirty &= ~(1UL << offset);
+  }
+  // Come back once the byte is programmed
+  deadline = timebase_ticks() + timebase_us_to_ticks(CONFIG_BYTE_US);
+  timebase_wake_at(deadline);
+}
@@ -0,0 +1,80 @@
+/*
+ * @file config.h
+ * @brief Settings kept in EEPROM and cached in RAM.
+ *
+ * The settings that used to take a rebuild to change are loaded from the
+ * EEPROM into config once at boot. A record with a bad CRC or of another
+ * CONFIG_VERSION is replaced by the build time defaults. The drivers only
+ * ever read the RAM copy, the EEPROM is not touched on their paths.
+ *
+ * The record is double buffered like the feed record: each write back
+ * goes to the slot that doesn't hold the newest record, under the next
+ * sequence number. config_write() changes the RAM copy at once and marks
+ * the bytes that differ from that slot. config_service() writes them
+ * back CONFIG_WRITE_DELAY_MS after the last change, one byte per pass
+ * while the EEPROM is ready, so a burst of changes costs one write per
+ * byte that changed and the main loop never waits on the EEPROM. The CRC
+ * goes last, a power loss during the write back leaves the previous
+ * settings to load at the next boot.
+ */
+#ifndef _CAT_FEEDER_CONFIG_H_
+#define _CAT_FEEDER_CONFIG_H_
+
+#include <stdint.h>
+
+// Bump when the layout of config_t changes, older records are discarded
+#define CONFIG_VERSION 1
+// Time from the last change to the write back
+#ifndef CONFIG_WRITE_DELAY_MS
+#define CONFIG_WRITE_DELAY_MS 2000
+#endif
+
+/// @brief The settings, little endian and naturally aligned so the hub sees
+/// the same layout
+struct config_t
+{
+  // Feed switch ADC readings from which the medium and high modes start
+  uint16_t feed_low_to_med;
+  uint16_t feed_med_to_high;
+  // Serial port baud rate
+  uint32_t usart_baud;
+  // TWI master SCL frequency in Hz
+  uint32_t twi_scl_freq;
+  // 7 bit bus addresses of the RTC and of the feeder as a hub slave
+  uint8_t rtc_address;
+  uint8_t hub_address;
+  // Supply thresholds in mV
+  uint16_t supply_low_mv;
+  uint16_t supply_critical_mv;
+  // Dose of a portion by weight in each FeedMode, in tenths of a gram
+  uint16_t dose_dg[3];
+};
+
+/// @brief The settings in use, read only, change them with config_write()
+extern struct config_t config;
+
+/// @brief Load the settings from the EEPROM, call before opening the
+/// drivers
+/// @returns 0 if the stored settings were loaded, 1 if the defaults were
+uint8_t config_open(void);
+
+/// @brief Change part of the settings
+///
+/// The write is taken as a whole or not at all, the settings have to stay
+/// consistent with it, e.g. the feed switch thresholds in order. Drivers
+/// that take a setting when they open have to be reopened or retimed.
+/// @param offset is the offset in config_t of the first byte to change
+/// @param data is the new value of the bytes
+/// @param len is the number of bytes
+/// @returns 0 if the settings were changed, 1 if the write was out of range
+/// or left the settings inconsistent
+uint8_t config_write(uint8_t offset, const void *data, uint8_t len);
+
+/// @brief Write changed bytes back to the EEPROM, call from the main loop
+///
+/// Never waits on the EEPROM, sets up a time base wake up for the next
+/// byte. Safe to keep calling on a critical supply, a write back cut short
+/// leaves the previous settings.
+void config_service(void);
+
+#endif
@@ -0,0 +1,87 @@
+
+#include "counters.h"
+#include "usart.h"
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+/* PRIVATE GLOBALS */
+static struct counter_t counters[CounterCount];
+static uint32_t window_start;
+
+/* FLASH STORED COUNTER NAMES */
+static const char SleepName[] PROGMEM = "sleep";
+static const char StepperIsrName[] PROGMEM = "stepper isr";
+static const char AdcIsrName[] PROGMEM = "adc isr";
+static const char ButtonIsrName[] PROGMEM = "button isr";
+static const char RtcIsrName[] PROGMEM = "rtc isr";
+static const char SerialRxIsrName[] PROGMEM = "serial rx isr";
+static const char TwiName[] PROGMEM = "twi";
+static const char SerialTxName[] PROGMEM = "serial tx";
+static const char AdcReadName[] PROGMEM = "adc read";
+static const char EepromName[] PROGMEM = "eeprom";
+static const char *CounterNames[CounterCount] = {SleepName, StepperIsrName,
+  AdcIsrName, ButtonIsrName, RtcIsrName, SerialRxIsrName, TwiName,
+  SerialTxName, AdcReadName, EepromName};
+
+/// @brief Share of the elapsed time in tenths of a percent
+static uint16_t counters_permille(uint32_t ticks, uint32_t elapsed)
+{
+  if (elapsed < 1000)
+  {
+    return 0;
+  }
+  uint32_t permille = ticks / (elapsed / 1000);
+  return permille > 1000 ? 1000 : permille;
+}
+
+void counters_add(enum CounterId id, uint32_t ticks)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    counters[id].busy_ticks += ticks;
+    ++counters[id].events;
+  }
+}
+
+void counters_reset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset(counters, 0, sizeof(counters));
+    window_start = timebase_ticks();
+  }
+}
+
+void counters_snapshot(struct counters_snapshot_t *snapshot)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    snapshot->elapsed_ticks = timebase_ticks() - window_start;
+    memcpy(snapshot->counters, counters, sizeof(counters));
+  }
+}
+
+void counters_print(const struct counters_snapshot_t *snapshot)
+{
+  char print_buffer[48];
+  int print_size;
+  for (uint8_t i=0; i < CounterCount; ++i)
+  {
+    const struct counter_t *counter = &snapshot->counters[i];
+    uint16_t share = counters_permille(counter->busy_ticks,
+        snapshot->elapsed_ticks);
+    print_size = sprintf(print_buffer, "%S: %lu us %u ev %u.%u%%\n",
+        CounterNames[i],
+        (unsigned long)timebase_ticks_to_us(counter->busy_ticks),
+        counter->events, share / 10, share % 10);
+    usart_print_strn(print_buffer, print_size);
+  }
+  uint16_t duty = 1000 - counters_permille(
+      snapshot->counters[CounterSleep].busy_ticks, snapshot->elapsed_ticks);
+  print_size = sprintf(print_buffer, "elapsed: %lu us duty %u.%u%%\n",
+      (unsigned long)timebase_ticks_to_us(snapshot->elapsed_ticks),
+      duty / 10, duty % 10);
+  usart_print_strn(print_buffer, print_size);
+}
@@ -0,0 +1,82 @@
+/*
+ * @file counters.h
+ * @brief Busy time and event counters for each subsystem and interrupt.
+ *
+ * Busy time is measured on the Timer1 time base. Counters are 32 bit tick
+ * counts, so a measurement window has to be reset or snapshotted within
+ * 2^32 ticks (71 minutes at the 1 MHz TIMEBASE_HZ). Build with
+ * -DCOUNTERS_ENABLE=0 to compile the instrumentation out.
+ */
+#ifndef _CAT_FEEDER_COUNTERS_H_
+#define _CAT_FEEDER_COUNTERS_H_
+
+#include <stdint.h>
+#include "timebase.h"
+
+#ifndef COUNTERS_ENABLE
+#define COUNTERS_ENABLE 1
+#endif
+
+/// @brief CounterId is an enumeration of the instrumented subsystems
+enum CounterId
+{
+  CounterSleep = 0,
+  CounterStepperIsr,
+  CounterAdcIsr,
+  CounterButtonIsr,
+  CounterRtcIsr,
+  CounterSerialRxIsr,
+  CounterTwi,
+  CounterSerialTx,
+  CounterAdcRead,
+  CounterEeprom,
+  CounterCount
+};
+
+/// @brief Accumulated busy time and number of events of a subsystem
+struct counter_t
+{
+  uint32_t busy_ticks;
+  uint16_t events;
+};
+
+/// @brief A consistent copy of all counters
+struct counters_snapshot_t
+{
+  // Time base ticks since the counters were last reset
+  uint32_t elapsed_ticks;
+  struct counter_t counters[CounterCount];
+};
+
+#if COUNTERS_ENABLE
+/// @brief Start timing a section, one per scope
+#define COUNTER_BEGIN() uint32_t counter_start = timebase_ticks()
+/// @brief Stop timing a section started by COUNTER_BEGIN() and count it
+#define COUNTER_END(id) counters_add((id), timebase_ticks() - counter_start)
+#else
+#define COUNTER_BEGIN()
+#define COUNTER_END(id)
+#endif
+
+/// @brief Add an event and its busy time to a counter
+///
+/// Safe to call from interrupts
+/// @param id is the counter to add to
+/// @param ticks is the busy time of the event in time base ticks
+void counters_add(enum CounterId id, uint32_t ticks);
+
+/// @brief Clear all counters and start a new measurement window
+void counters_reset(void);
+
+/// @brief Take a consistent copy of all counters
+/// @param snapshot is updated with the current counters
+void counters_snapshot(struct counters_snapshot_t *snapshot);
+
+/// @brief Print a snapshot over the serial port
+///
+/// One line per counter with its busy time, event count and share of the
+/// elapsed time, followed by the CPU duty cycle (time not asleep).
+/// @param snapshot is the snapshot to print
+void counters_print(const struct counters_snapshot_t *snapshot);
+
+#endif
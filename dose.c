@@ -0,0 +1,421 @@
+
+#include "dose.h"
+#include "config.h"
+#include "counters.h"
+#include "hx711.h"
+#include "motion.h"
+#include "motor_driver.h"
+#include "timebase.h"
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+/* DEFINES */
+// Fewer counts per gram than this is no calibration weight at all
+#define DOSE_MIN_COUNTS_PER_G 10
+// Smallest flow learned, keeps the coarse move of a large dose in reach
+#define DOSE_MIN_FLOW_MG 50
+// Smallest fine move, in sixteenth steps
+#define DOSE_MIN_FINE_DISTANCE 4
+// Largest dose, keeps the weights in an int16_t
+#define DOSE_MAX_DG 10000
+// Longest a weighing may take before the load cell is given up on
+#define DOSE_WEIGH_TIMEOUT_US \
+  ((uint32_t)DOSE_SAMPLES * 2000000UL / HX711_RATE_HZ + 100000UL)
+
+/// @brief DoseState is an enumeration of the steps of an operation
+enum DoseState
+{
+  DoseIdle = 0,
+  DosePowerUp,
+  DoseWeighing,
+  DoseMoving,
+  DoseSettling
+};
+
+/// @brief The scale calibration as stored in EEPROM
+struct dose_calibration_t
+{
+  // Reading of the empty bowl
+  int32_t tare;
+  // Counts per gram, 0 until calibrated
+  int32_t counts_per_g;
+  // Kibble dispensed per full step, in milligrams
+  uint16_t flow_mg;
+  // CRC of the fields above
+  uint16_t crc;
+};
+
+/* PRIVATE GLOBALS */
+static struct dose_calibration_t EEMEM calibration_eeprom;
+static struct dose_calibration_t calibration;
+
+static enum DoseState state;
+static enum DoseOp op;
+static uint32_t deadline;
+static uint32_t start_ticks;
+// Weighing in progress
+static int32_t sample_sum;
+static uint8_t samples;
+// Feed in progress
+static uint8_t channel;
+static enum FeedMode feed_mode;
+static uint8_t feed_portions;
+static int16_t dose_dg;
+static uint8_t weighed_start;
+static int16_t start_dg;
+static int16_t target_dg;
+static uint16_t coarse_distance;
+static uint8_t fine_moves;
+
+/// @brief Calculate the CRC of a calibration record
+static uint16_t dose_crc(const struct dose_calibration_t *record)
+{
+  const uint8_t *data = (const uint8_t *)record;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i=0; i < offsetof(struct dose_calibration_t, crc); ++i)
+  {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+static void dose_save(void)
+{
+  calibration.crc = dose_crc(&calibration);
+  COUNTER_BEGIN();
+  eeprom_update_block(&calibration, &calibration_eeprom, sizeof(calibration));
+  COUNTER_END(CounterEeprom);
+}
+
+/// @brief Convert a reading to tenths of a gram over the tare
+static int16_t dose_weight(int32_t raw)
+{
+  int32_t weight = (raw - calibration.tare) * 10 / calibration.counts_per_g;
+  if (weight > INT16_MAX)
+    return INT16_MAX;
+  if (weight < INT16_MIN)
+    return INT16_MIN;
+  return weight;
+}
+
+/// @brief Wait until a deadline in a state
+static void dose_wait(enum DoseState next, uint32_t us)
+{
+  state = next;
+  deadline = timebase_ticks() + timebase_us_to_ticks(us);
+  timebase_wake_at(deadline);
+}
+
+/// @brief Power the load cell up and weigh once it has settled
+static void dose_begin(enum DoseOp next_op)
+{
+  op = next_op;
+  start_ticks = timebase_ticks();
+  hx711_power(1);
+  dose_wait(DosePowerUp, HX711_SETTLE_MS * 1000UL);
+}
+
+static void dose_start_weighing(void)
+{
+  sample_sum = 0;
+  samples = 0;
+  dose_wait(DoseWeighing, DOSE_WEIGH_TIMEOUT_US);
+}
+
+/// @brief Move the auger forward, the part of a coarse move that isn't a
+/// whole coarse step is done in sixteenth steps
+/// @returns 0 if the move started, 1 if the motor driver refused it
+static uint8_t dose_move(uint16_t distance, enum MicrostepMode mode,
+    uint16_t rate)
+{
+  struct motor_move_t move = {
+    .distance = distance,
+    .fine_distance = 0,
+    .coarse_mode = mode,
+    .fine_mode = MicrostepSixteenth,
+    .coarse_rate = rate,
+    .fine_rate = DOSE_FINE_RATE,
+    .direction = StepperForward
+  };
+  if (motor_driver_move(channel, &move))
+  {
+    return 1;
+  }
+  state = DoseMoving;
+  return 0;
+}
+
+static uint8_t dose_finish(enum DoseStatus status, int16_t weight,
+    struct dose_result_t *result)
+{
+  hx711_power(0);
+  state = DoseIdle;
+  result->op = op;
+  result->status = status;
+  result->weight_dg = weight;
+  result->target_dg = (op == DoseFeed) ? dose_dg : 0;
+  result->dosed_dg = (op == DoseFeed && weighed_start) ? weight - start_dg : 0;
+  result->fine_moves = fine_moves;
+  result->ms = timebase_ticks_to_us(timebase_ticks() - start_ticks) / 1000;
+  return 1;
+}
+
+/// @brief Take the next step of a feed after a weighing
+static uint8_t dose_feed_weighed(int16_t weight, struct dose_result_t *result)
+{
+  if (!weighed_start)
+  {
+    weighed_start = 1;
+    start_dg = weight;
+    target_dg = weight + dose_dg;
+    // Run fast to DOSE_FINE_DG short of the target on the flow learned
+    if (dose_dg > DOSE_FINE_DG)
+    {
+      uint32_t distance = (uint32_t)(dose_dg - DOSE_FINE_DG) * 100 * 16
+        / calibration.flow_mg;
+      coarse_distance = (distance > UINT16_MAX) ? UINT16_MAX : distance;
+    }
+    if (coarse_distance > 0)
+    {
+      if (dose_move(coarse_distance, MicrostepHalf, DOSE_COARSE_RATE))
+      {
+        return dose_finish(DoseMotorBusy, weight, result);
+      }
+      return 0;
+    }
+  }
+  else if (fine_moves == 0 && coarse_distance > 0 && weight > start_dg)
+  {
+    // Learn the flow from the coarse move, slowly to ride out a bad one
+    uint32_t flow = (uint32_t)(weight - start_dg) * 100 * 16
+      / coarse_distance;
+    if (flow > calibration.flow_mg / 4 && flow < calibration.flow_mg * 4UL)
+    {
+      calibration.flow_mg = (3UL * calibration.flow_mg + flow) / 4;
+      if (calibration.flow_mg < DOSE_MIN_FLOW_MG)
+        calibration.flow_mg = DOSE_MIN_FLOW_MG;
+      dose_save();
+    }
+  }
+
+  int16_t short_dg = target_dg - weight;
+  if (short_dg <= DOSE_TOLERANCE_DG)
+  {
+    return dose_finish(DoseOk, weight, result);
+  }
+  if (fine_moves == DOSE_MAX_FINE_MOVES)
+  {
+    return dose_finish(DoseShort, weight, result);
+  }
+  // Three quarters of the shortfall, so the target is closed in on from
+  // below
+  uint32_t distance = (uint32_t)short_dg * 100 * 16 * 3
+    / (4UL * calibration.flow_mg);
+  if (distance < DOSE_MIN_FINE_DISTANCE)
+    distance = DOSE_MIN_FINE_DISTANCE;
+  if (distance > UINT16_MAX)
+    distance = UINT16_MAX;
+  if (dose_move(distance, MicrostepSixteenth, DOSE_FINE_RATE))
+  {
+    return dose_finish(DoseMotorBusy, weight, result);
+  }
+  ++fine_moves;
+  return 0;
+}
+
+/// @brief Act on a finished weighing
+static uint8_t dose_weighed(int32_t raw, struct dose_result_t *result)
+{
+  switch (op)
+  {
+    case DoseTare:
+    {
+      calibration.tare = raw;
+      dose_save();
+      return dose_finish(DoseOk, 0, result);
+    }
+    case DoseCalibrate:
+    {
+      int32_t counts = (raw - calibration.tare) / DOSE_CALIBRATION_G;
+      if (counts < DOSE_MIN_COUNTS_PER_G && counts > -DOSE_MIN_COUNTS_PER_G)
+      {
+        return dose_finish(DoseBadWeight, 0, result);
+      }
+      calibration.counts_per_g = counts;
+      dose_save();
+      return dose_finish(DoseOk, dose_weight(raw), result);
+    }
+    case DoseWeigh:
+    {
+      return dose_finish(DoseOk, dose_weight(raw), result);
+    }
+    case DoseFeed:
+    default:
+    {
+      return dose_feed_weighed(dose_weight(raw), result);
+    }
+  }
+}
+
+void dose_open(void)
+{
+  eeprom_read_block(&calibration, &calibration_eeprom, sizeof(calibration));
+  if (calibration.crc != dose_crc(&calibration) ||
+      calibration.flow_mg < DOSE_MIN_FLOW_MG)
+  {
+    calibration.tare = 0;
+    calibration.counts_per_g = 0;
+    calibration.flow_mg = DOSE_FLOW_MG;
+  }
+  hx711_open();
+  state = DoseIdle;
+}
+
+uint16_t dose_feed_size(enum FeedMode mode)
+{
+  return config.dose_dg[mode];
+}
+
+uint8_t dose_feed(uint8_t bowl, enum FeedMode mode, uint8_t portions)
+{
+  if (state != DoseIdle || (motion_busy() & (1 << bowl)) ||
+      (motor_driver_busy() & (1 << bowl)))
+  {
+    return 2;
+  }
+  if (calibration.counts_per_g == 0)
+  {
+    return motion_run(bowl, motion_feed_program(mode), portions) ? 2 : 1;
+  }
+  uint32_t dose = (uint32_t)dose_feed_size(mode) * portions;
+  channel = bowl;
+  feed_mode = mode;
+  feed_portions = portions;
+  dose_dg = dose > DOSE_MAX_DG ? DOSE_MAX_DG : dose;
+  weighed_start = 0;
+  coarse_distance = 0;
+  fine_moves = 0;
+  dose_begin(DoseFeed);
+  return 0;
+}
+
+uint8_t dose_tare(void)
+{
+  if (state != DoseIdle)
+  {
+    return 1;
+  }
+  dose_begin(DoseTare);
+  return 0;
+}
+
+uint8_t dose_calibrate(void)
+{
+  if (state != DoseIdle)
+  {
+    return 1;
+  }
+  dose_begin(DoseCalibrate);
+  return 0;
+}
+
+uint8_t dose_weigh(void)
+{
+  if (state != DoseIdle || calibration.counts_per_g == 0)
+  {
+    return 1;
+  }
+  dose_begin(DoseWeigh);
+  return 0;
+}
+
+void dose_stop(void)
+{
+  if (state == DoseIdle)
+  {
+    return;
+  }
+  if (op == DoseFeed)
+  {
+    motor_driver_stop(channel);
+  }
+  hx711_power(0);
+  state = DoseIdle;
+}
+
+uint8_t dose_service(struct dose_result_t *result)
+{
+  int32_t raw;
+  switch (state)
+  {
+    case DosePowerUp:
+    {
+      // Samples before the settling time are off
+      while (hx711_read(&raw) == 0)
+        ;
+      if (timebase_reached(deadline))
+      {
+        dose_start_weighing();
+      }
+      else
+      {
+        timebase_wake_at(deadline);
+      }
+      break;
+    }
+    case DoseWeighing:
+    {
+      while (hx711_read(&raw) == 0)
+      {
+        sample_sum += raw;
+        if (++samples == DOSE_SAMPLES)
+        {
+          return dose_weighed(sample_sum / DOSE_SAMPLES, result);
+        }
+      }
+      if (!timebase_reached(deadline))
+      {
+        // An earlier wake up may have replaced this one
+        timebase_wake_at(deadline);
+        break;
+      }
+      // The load cell isn't answering. A feed that hasn't started yet is
+      // run open loop instead.
+      if (op == DoseFeed && !weighed_start)
+      {
+        motion_run(channel, motion_feed_program(feed_mode), feed_portions);
+      }
+      return dose_finish(DoseNoScale, 0, result);
+    }
+    case DoseMoving:
+    {
+      if (!(motor_driver_busy() & (1 << channel)))
+      {
+        dose_wait(DoseSettling, DOSE_SETTLE_MS * 1000UL);
+      }
+      break;
+    }
+    case DoseSettling:
+    {
+      if (timebase_reached(deadline))
+      {
+        dose_start_weighing();
+      }
+      else
+      {
+        timebase_wake_at(deadline);
+      }
+      break;
+    }
+    case DoseIdle:
+    default:
+      break;
+  }
+  return 0;
+}
+
+uint8_t dose_busy(void)
+{
+  return state != DoseIdle;
+}
@@ -0,0 +1,159 @@
+/*
+ * @file dose.h
+ * @brief Closed loop dosing by weight on a load cell under the bowl.
+ *
+ * A dose is weighed out in two parts. A single coarse move, sized from the
+ * learned flow of the kibble, runs the motor fast up to DOSE_FINE_DG short
+ * of the target. Then the bowl is left to settle, weighed and topped up
+ * with fine moves of three quarters of the estimated shortfall each until
+ * it is within DOSE_TOLERANCE_DG of the target. The coarse move updates
+ * the flow estimate, so the next dose starts closer.
+ *
+ * The scale is zeroed with the empty bowl in place (dose_tare()) and
+ * calibrated with a known weight (dose_calibrate()). Both factors and the
+ * flow are kept in EEPROM. Until the scale is calibrated, or if the load
+ * cell doesn't answer, feeds fall back on the open loop motion programs.
+ *
+ * Everything runs from dose_service() in the main loop, nothing blocks.
+ * Weights are in tenths of a gram.
+ */
+#ifndef _CAT_FEEDER_DOSE_H_
+#define _CAT_FEEDER_DOSE_H_
+
+#include <stdint.h>
+#include "feed_switch.h"
+
+// Default dose of one portion in each feed mode, the doses in use are in
+// config
+#ifndef DOSE_LOW_DG
+#define DOSE_LOW_DG 100
+#endif
+#ifndef DOSE_MED_DG
+#define DOSE_MED_DG 150
+#endif
+#ifndef DOSE_HIGH_DG
+#define DOSE_HIGH_DG 230
+#endif
+// The coarse move stops this far short of the target
+#ifndef DOSE_FINE_DG
+#define DOSE_FINE_DG 30
+#endif
+// A dose this close to the target is done
+#ifndef DOSE_TOLERANCE_DG
+#define DOSE_TOLERANCE_DG 5
+#endif
+// Coarse half steps and fine sixteenth steps per second
+#ifndef DOSE_COARSE_RATE
+#define DOSE_COARSE_RATE 250
+#endif
+#ifndef DOSE_FINE_RATE
+#define DOSE_FINE_RATE 500
+#endif
+// Time for the kibble to land and the bowl to stop swinging after a move
+#ifndef DOSE_SETTLE_MS
+#define DOSE_SETTLE_MS 300
+#endif
+// Samples averaged for each weighing
+#ifndef DOSE_SAMPLES
+#define DOSE_SAMPLES 4
+#endif
+// Fine moves before a dose is given up as short, the hopper is empty or
+// jammed
+#ifndef DOSE_MAX_FINE_MOVES
+#define DOSE_MAX_FINE_MOVES 12
+#endif
+// Flow of a full step of the auger until one is learned, in milligrams
+#ifndef DOSE_FLOW_MG
+#define DOSE_FLOW_MG 1200
+#endif
+// Known weight dose_calibrate() is run with, in grams
+#ifndef DOSE_CALIBRATION_G
+#define DOSE_CALIBRATION_G 100
+#endif
+
+/// @brief DoseOp is an enumeration of the scale operations
+enum DoseOp
+{
+  DoseFeed = 0,
+  DoseTare,
+  DoseCalibrate,
+  DoseWeigh
+};
+
+/// @brief DoseStatus is an enumeration of the outcomes of an operation
+enum DoseStatus
+{
+  DoseOk = 0,
+  // A feed gave up before the target, the hopper may be empty
+  DoseShort,
+  // The load cell didn't answer, a feed ran the open loop program instead
+  DoseNoScale,
+  // The calibration weight wasn't on the scale, nothing was stored
+  DoseBadWeight,
+  // The motor driver refused a move, the feed stopped where it was
+  DoseMotorBusy
+};
+
+/// @brief The outcome of a finished operation
+struct dose_result_t
+{
+  enum DoseOp op;
+  enum DoseStatus status;
+  // Weight in the bowl at the end, from the tare
+  int16_t weight_dg;
+  // Dose asked for and dose weighed out by a feed
+  int16_t target_dg;
+  int16_t dosed_dg;
+  // Fine moves a feed took
+  uint8_t fine_moves;
+  // Time the operation took
+  uint16_t ms;
+};
+
+/// @brief Load the calibration and set up the load cell
+void dose_open(void);
+
+/// @brief Get the dose of a portion in a feed mode
+/// @param mode is the feed mode
+/// @returns the dose in tenths of a gram
+uint16_t dose_feed_size(enum FeedMode mode);
+
+/// @brief Feed a bowl, by weight if the scale is calibrated
+///
+/// Without a calibrated scale the open loop program of the mode is run
+/// with motion_run() instead.
+/// @param bowl is the stepper channel of the bowl on the load cell
+/// @param mode is the feed mode
+/// @param portions is the number of portions to dispense
+/// @returns 0 if the dose is weighed out, 1 if the program runs instead,
+/// 2 if the scale or the bowl is busy
+uint8_t dose_feed(uint8_t bowl, enum FeedMode mode, uint8_t portions);
+
+/// @brief Zero the scale on what is on it now, normally the empty bowl
+/// @returns 0 if taring started, 1 if the scale is busy
+uint8_t dose_tare(void);
+
+/// @brief Calibrate the scale with DOSE_CALIBRATION_G in the tared bowl
+/// @returns 0 if calibration started, 1 if the scale is busy
+uint8_t dose_calibrate(void);
+
+/// @brief Weigh the bowl
+/// @returns 0 if weighing started, 1 if the scale is busy or isn't
+/// calibrated
+uint8_t dose_weigh(void);
+
+/// @brief Abort the operation in progress and stop the motor
+void dose_stop(void);
+
+/// @brief Advance the operation in progress, call from the main loop
+///
+/// Never blocks, sets up a time base wake up for the next deadline.
+/// @param result is updated when an operation finishes
+/// @returns 1 if an operation finished, otherwise 0
+uint8_t dose_service(struct dose_result_t *result);
+
+/// @brief Check for an operation in progress
+/// @returns 1 while a feed, tare, calibration or weighing runs, otherwise 0
+uint8_t dose_busy(void);
+
+#endif
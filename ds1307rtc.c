@@ -1,5 +1,6 @@
 
 #include "ds1307rtc.h"
+#include "config.h"
 
 static uint8_t i2c_buffer[RTC_REGISTER_LEN];
 const static uint16_t year_2000_offset = 100;
@@ -14,13 +15,13 @@ uint8_t ds1307_read_rtc(struct tm *current_time)
 {
   // Write 0x00 address to clock to reset register pointer
   i2c_buffer[0] = 0x00;
-  int i2c_status = twi_write(RTC_ADDRESS, i2c_buffer, 1);
+  int i2c_status = twi_write(config.rtc_address, i2c_buffer, 1);
   if (i2c_status != TWI_OK)
   {
     return 1;
   }
   // Read register 0x00-0x07 values
-  i2c_status = twi_read(RTC_ADDRESS,i2c_buffer,RTC_REGISTER_LEN);
+  i2c_status = twi_read(config.rtc_address,i2c_buffer,RTC_REGISTER_LEN);
   if (i2c_status != TWI_OK)
   {
     return 1;
@@ -59,7 +60,7 @@ uint8_t ds1307_configure_square_wave(enum Ds1307SquareWaveEnable enable,
     i2c_buffer[1] = 0;
   }
   // Write to the device. If there was an I2C error, return generic error status
-  int i2c_status = twi_write(RTC_ADDRESS, i2c_buffer, 2);
+  int i2c_status = twi_write(config.rtc_address, i2c_buffer, 2);
   if (i2c_status != TWI_OK)
   {
     return 1;
@@ -5,6 +5,7 @@
 #include <time.h>
 #include "twi.h"
 
+// Default bus address, the address in use is in config
 #ifndef RTC_ADDRESS
 #define RTC_ADDRESS 0x68
 #endif
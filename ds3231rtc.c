@@ -0,0 +1,143 @@
+
+#include "ds3231rtc.h"
+#include "config.h"
+
+// Alarm mask bit, set in a register to leave it out of the alarm match
+#define DS3231_ALARM_MASK 0x80
+
+static uint8_t i2c_buffer[5];
+const static uint16_t year_2000_offset = 100;
+
+uint8_t ds3231_dec2bcd(uint8_t dec_value)
+{
+  return ((dec_value / 10) << 4) | (dec_value % 10);
+}
+
+/// @brief Read a single register
+/// @param address is the register address
+/// @param value is updated with the register value
+/// @returns 0 if there are no errors
+static uint8_t ds3231_read_register(uint8_t address, uint8_t *value)
+{
+  i2c_buffer[0] = address;
+  if (twi_write(config.rtc_address, i2c_buffer, 1) != TWI_OK)
+  {
+    return 1;
+  }
+  if (twi_read(config.rtc_address, value, 1) != TWI_OK)
+  {
+    return 1;
+  }
+  return 0;
+}
+
+/// @brief Write a single register
+/// @param address is the register address
+/// @param value is the value to write
+/// @returns 0 if there are no errors
+static uint8_t ds3231_write_register(uint8_t address, uint8_t value)
+{
+  i2c_buffer[0] = address;
+  i2c_buffer[1] = value;
+  if (twi_write(config.rtc_address, i2c_buffer, 2) != TWI_OK)
+  {
+    return 1;
+  }
+  return 0;
+}
+
+uint8_t ds3231_read_rtc(struct tm *current_time)
+{
+  uint8_t time_registers[DS3231_TIME_LEN];
+  // Write 0x00 address to clock to reset register pointer
+  i2c_buffer[0] = 0x00;
+  int i2c_status = twi_write(config.rtc_address, i2c_buffer, 1);
+  if (i2c_status != TWI_OK)
+  {
+    return 1;
+  }
+  // Read register 0x00-0x06 values
+  i2c_status = twi_read(config.rtc_address, time_registers, DS3231_TIME_LEN);
+  if (i2c_status != TWI_OK)
+  {
+    return 1;
+  }
+
+  // Parse register values to time
+  current_time->tm_sec = ds1307_bcd2dec(time_registers[RTC_SEC_INDEX]);
+  current_time->tm_min = ds1307_bcd2dec(time_registers[RTC_MIN_INDEX]);
+  // Clock is kept in 24 hour mode
+  current_time->tm_hour = ds1307_bcd2dec(time_registers[RTC_HOUR_INDEX]
+                                         & 0x3F);
+  // Week days need to be put in range [0-6]
+  current_time->tm_wday = ds1307_bcd2dec(time_registers[RTC_DOW_INDEX]) - 1;
+  current_time->tm_mday = ds1307_bcd2dec(time_registers[RTC_DAY_INDEX]);
+  // Months need to be put in range [0-11], bit 7 is the century flag
+  current_time->tm_mon = ds1307_bcd2dec(time_registers[RTC_MON_INDEX]
+                                        & 0x1F) - 1;
+  current_time->tm_year = ds1307_bcd2dec(time_registers[RTC_YEAR_INDEX]) + year_2000_offset;
+
+  return 0;
+}
+
+uint8_t ds3231_set_alarm(enum Ds3231Alarm alarm, const struct tm *alarm_time)
+{
+  // Setup the alarm registers to match the time of day only
+  uint8_t len;
+  if (alarm == Alarm1)
+  {
+    i2c_buffer[0] = DS3231_ALARM1_ADDRESS;
+    i2c_buffer[1] = ds3231_dec2bcd(alarm_time->tm_sec);
+    i2c_buffer[2] = ds3231_dec2bcd(alarm_time->tm_min);
+    i2c_buffer[3] = ds3231_dec2bcd(alarm_time->tm_hour);
+    i2c_buffer[4] = DS3231_ALARM_MASK;
+    len = 5;
+  }
+  else
+  {
+    i2c_buffer[0] = DS3231_ALARM2_ADDRESS;
+    i2c_buffer[1] = ds3231_dec2bcd(alarm_time->tm_min);
+    i2c_buffer[2] = ds3231_dec2bcd(alarm_time->tm_hour);
+    i2c_buffer[3] = DS3231_ALARM_MASK;
+    len = 4;
+  }
+  if (twi_write(config.rtc_address, i2c_buffer, len) != TWI_OK)
+  {
+    return 1;
+  }
+
+  // Route the alarms to the INT/SQW pin and enable this one
+  uint8_t control;
+  if (ds3231_read_register(DS3231_CONTROL_ADDRESS, &control))
+  {
+    return 1;
+  }
+  control |= (1 << DS3231_INTCN) | (1 << (DS3231_A1IE + alarm));
+  return ds3231_write_register(DS3231_CONTROL_ADDRESS, control);
+}
+
+uint8_t ds3231_disable_alarms(void)
+{
+  uint8_t control;
+  if (ds3231_read_register(DS3231_CONTROL_ADDRESS, &control))
+  {
+    return 1;
+  }
+  control &= ~((1 << DS3231_A1IE) | (1 << DS3231_A2IE));
+  return ds3231_write_register(DS3231_CONTROL_ADDRESS, control);
+}
+
+uint8_t ds3231_clear_alarms(uint8_t *fired)
+{
+  uint8_t status;
+  if (ds3231_read_register(DS3231_STATUS_ADDRESS, &status))
+  {
+    return 1;
+  }
+  if (fired)
+  {
+    *fired = status & ((1 << DS3231_A1F) | (1 << DS3231_A2F));
+  }
+  status &= ~((1 << DS3231_A1F) | (1 << DS3231_A2F));
+  return ds3231_write_register(DS3231_STATUS_ADDRESS, status);
+}
@@ -0,0 +1,64 @@
+
+#ifndef _DS3231RTC_H_
+#define _DS3231RTC_H_
+
+#include <time.h>
+#include "twi.h"
+#include "ds1307rtc.h"
+
+// The DS3231 shares the DS1307 bus address and time register layout
+#define DS3231_TIME_LEN 7
+#define DS3231_ALARM1_ADDRESS 0x07
+#define DS3231_ALARM2_ADDRESS 0x0B
+#define DS3231_CONTROL_ADDRESS 0x0E
+#define DS3231_STATUS_ADDRESS 0x0F
+
+// Control register bits
+#define DS3231_A1IE 0
+#define DS3231_A2IE 1
+#define DS3231_INTCN 2
+// Status register bits
+#define DS3231_A1F 0
+#define DS3231_A2F 1
+#define DS3231_OSF 7
+
+/// @brief An enumeration of the two DS3231 alarms
+enum Ds3231Alarm
+{
+  Alarm1=0,
+  Alarm2=1
+};
+
+/// @brief Utility function to convert decimal to binary coded decimal
+/// @param dec_value is the decimal value [0, 99] to convert
+/// @returns bcd the bcd encoding of the input
+uint8_t ds3231_dec2bcd(uint8_t dec_value);
+
+/// @brief Read current time from the RTC
+///
+/// Same interface as ds1307_read_rtc()
+/// @param current time is a pointer to the value of the current time to be updated
+/// @returns 0 if there are no errors
+uint8_t ds3231_read_rtc(struct tm *current_time);
+
+/// @brief Set a daily alarm
+///
+/// Alarm1 matches hours, minutes and seconds. Alarm2 has no seconds
+/// register and matches hours and minutes, so it fires at the start of
+/// the minute. The alarm interrupt is enabled on the INT/SQW pin.
+/// @param alarm selects which alarm to set
+/// @param alarm_time is the time of day to fire at, the date is ignored
+/// @returns 0 if the alarm was set, returns 1 if a communcation error occured.
+uint8_t ds3231_set_alarm(enum Ds3231Alarm alarm, const struct tm *alarm_time);
+
+/// @brief Disable both alarm interrupts
+/// @returns 0 if the alarms were disabled, returns 1 if a communcation error occured.
+uint8_t ds3231_disable_alarms(void);
+
+/// @brief Clear the alarm flags, releasing the INT/SQW pin
+/// @param fired is updated with the status bits of the alarms that had fired
+/// (bit 0 Alarm1, bit 1 Alarm2), may be 0
+/// @returns 0 if the flags were cleared, returns 1 if a communcation error occured.
+uint8_t ds3231_clear_alarms(uint8_t *fired);
+
+#endif
@@ -0,0 +1,107 @@
+
+#include "feed_record.h"
+#include "counters.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#define FEED_RECORD_SLOTS 2
+
+/// @brief A record as stored in one EEPROM slot
+struct feed_record_slot_t
+{
+  uint16_t sequence;
+  struct feed_record_t record;
+  // CRC of the sequence and record
+  uint16_t crc;
+};
+
+/* PRIVATE GLOBALS */
+static struct feed_record_slot_t EEMEM slots_eeprom[FEED_RECORD_SLOTS];
+// Sequence number and slot of the newest record
+static uint16_t newest_sequence;
+static uint8_t newest_slot;
+// Copy of the newest slot and its number, a watchdog reset leaves them be
+static struct feed_record_slot_t newest_copy __attribute__((section(".noinit")));
+static uint8_t newest_copy_slot __attribute__((section(".noinit")));
+
+/// @brief Calculate the CRC of a slot
+static uint16_t feed_record_crc(const struct feed_record_slot_t *slot)
+{
+  const uint8_t *data = (const uint8_t *)slot;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i=0; i < offsetof(struct feed_record_slot_t, crc); ++i)
+  {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+uint8_t feed_record_load(struct feed_record_t *record)
+{
+  struct feed_record_slot_t slots[FEED_RECORD_SLOTS];
+  eeprom_read_block(slots, slots_eeprom, sizeof(slots));
+
+  int8_t newest = -1;
+  for (uint8_t i=0; i < FEED_RECORD_SLOTS; ++i)
+  {
+    if (slots[i].crc != feed_record_crc(&slots[i]))
+    {
+      continue;
+    }
+    // Sequence numbers wrap around, compare the difference
+    if (newest < 0 ||
+        (int16_t)(slots[i].sequence - slots[newest].sequence) > 0)
+    {
+      newest = i;
+    }
+  }
+
+  if (newest < 0)
+  {
+    memset(record, 0, sizeof(*record));
+    newest_sequence = 0;
+    newest_slot = FEED_RECORD_SLOTS - 1;
+    newest_copy_slot = FEED_RECORD_SLOTS;
+    return 1;
+  }
+  *record = slots[newest].record;
+  newest_sequence = slots[newest].sequence;
+  newest_slot = newest;
+  newest_copy = slots[newest];
+  newest_copy_slot = newest;
+  return 0;
+}
+
+uint8_t feed_record_restore(struct feed_record_t *record)
+{
+  if (newest_copy_slot >= FEED_RECORD_SLOTS ||
+      newest_copy.crc != feed_record_crc(&newest_copy))
+  {
+    return 1;
+  }
+  *record = newest_copy.record;
+  newest_sequence = newest_copy.sequence;
+  newest_slot = newest_copy_slot;
+  return 0;
+}
+
+void feed_record_save(const struct feed_record_t *record)
+{
+  struct feed_record_slot_t slot;
+  slot.sequence = newest_sequence + 1;
+  slot.record = *record;
+  slot.crc = feed_record_crc(&slot);
+
+  uint8_t next_slot = (newest_slot + 1) % FEED_RECORD_SLOTS;
+  // The copy goes first, the EEPROM write is the part a reset could cut
+  // short
+  newest_copy = slot;
+  newest_copy_slot = next_slot;
+  COUNTER_BEGIN();
+  eeprom_update_block(&slot, &slots_eeprom[next_slot], sizeof(slot));
+  COUNTER_END(CounterEeprom);
+  newest_sequence = slot.sequence;
+  newest_slot = next_slot;
+}
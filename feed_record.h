@@ -0,0 +1,45 @@
+/*
+ * @file feed_record.h
+ * @brief Power loss safe storage of the feed schedule in EEPROM.
+ *
+ * The record is double buffered: each save goes to the slot that doesn't
+ * hold the newest copy, so a write cut short by a power loss leaves the
+ * previous record intact. Each slot carries a sequence number and a CRC.
+ * A copy of the newest slot is kept in .noinit RAM, where it outlasts a
+ * watchdog reset but not a power loss.
+ */
+#ifndef _CAT_FEEDER_FEED_RECORD_H_
+#define _CAT_FEEDER_FEED_RECORD_H_
+
+#include <stdint.h>
+
+/// @brief The persisted feed schedule state
+struct feed_record_t
+{
+  // Time of the last feed in seconds since 00:00:00 01/01/2000
+  uint32_t last_feed;
+  // Non zero once a manual feed has started the schedule
+  uint8_t schedule_active;
+};
+
+/// @brief Restore the newest valid record
+///
+/// Both slots are fetched with a single EEPROM block read
+/// @param record is updated with the stored record, or cleared if there is
+/// no valid record
+/// @returns 0 if a valid record was restored, 1 if none was found
+uint8_t feed_record_load(struct feed_record_t *record);
+
+/// @brief Restore the record from the RAM copy after a watchdog reset
+///
+/// Skips the EEPROM, only call after a watchdog reset. Fall back on
+/// feed_record_load() if it fails.
+/// @param record is updated with the copy of the newest record
+/// @returns 0 if the copy was valid, 1 if not
+uint8_t feed_record_restore(struct feed_record_t *record);
+
+/// @brief Store a record over the older of the two slots
+/// @param record is the record to store
+void feed_record_save(const struct feed_record_t *record);
+
+#endif
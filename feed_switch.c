@@ -1,14 +1,15 @@
 
 #include "feed_switch.h"
+#include "config.h"
+#include "counters.h"
+#include "power.h"
+#include "trace.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
-/* DEFINES */
-#define FEED_MODE_LOW_TO_MED 256
-#define FEED_MODE_MED_TO_HIGH 768
-
 /* PRIVATE GLOBALS */
 static enum ADCMode adc_mode;
+static enum AnalogChannel adc_channel;
 static volatile enum FeedMode current_mode;
 
 /* PUBLIC GLOBAL DEFINITIONS */
@@ -19,16 +20,18 @@ const char *FeedModeStrings[3] = {FeedLowString, FeedMedString, FeedHighString};
 
 ISR(ADC_vect)
 {
+  COUNTER_BEGIN();
   // copy out the value from the result register
   uint16_t adc_value =  ADCL;
   adc_value |= (ADCH << 8);
   // Decode the current mode
-  if (adc_value < FEED_MODE_LOW_TO_MED)
+  if (adc_value < config.feed_low_to_med)
     current_mode = FeedLow;
-  else if (adc_value >= FEED_MODE_LOW_TO_MED && adc_value < FEED_MODE_MED_TO_HIGH)
+  else if (adc_value >= config.feed_low_to_med && adc_value < config.feed_med_to_high)
     current_mode = FeedMed;
   else
     current_mode = FeedHigh;
+  COUNTER_END(CounterAdcIsr);
 }
 
 /// @brief Initialize the ADC driver interface
@@ -51,10 +54,14 @@ static void adc_open(enum ADCMode mode)
     {
       // Make sure interrupt enable and auto trigger is turned off 
       ADCSRA &= ~((1<< ADATE) | (1 << ADIE));
+      // Only power the ADC for each conversion
+      ADCSRA &= ~(1 << ADEN);
       break;
     }
     case FreeRunning:
     {
+      // Keep the ADC clocked until it is closed
+      power_acquire(PowerAdc);
       // ADCSRB defaults to free running mode
       // Set auto triggering and interrupts enabled
       ADCSRA |= (1 << ADATE) | (1 << ADIE);
@@ -65,9 +72,10 @@ static void adc_open(enum ADCMode mode)
     default:
     {
       adc_mode = Polling;
-      ADCSRA &= ~((1<< ADATE) | (1 << ADIE));
+      ADCSRA &= ~((1<< ADATE) | (1 << ADIE) | (1 << ADEN));
     }
   }
+  TRACE(TraceAdcMode, adc_mode);
 }
 
 /// @brief Initialize the pins of an ADC channel
@@ -84,13 +92,21 @@ static void adc_open_channel(enum AnalogChannel channel)
   }
   // Select the channel in the MUX register
   ADMUX = (ADMUX & 0xF0) | channel;
+  adc_channel = channel;
 }
 
 /// @brief Disable the ADC interface
 static void adc_close(void)
 {
-  // Turn off ADC enable bit
-  ADCSRA &= ~(1 << ADEN);
+  // Polling mode only holds the ADC during a conversion
+  if (adc_mode == FreeRunning)
+  {
+    // Turn off ADC enable bit, it has to be off before the clock stops
+    ADCSRA &= ~((1 << ADEN) | (1 << ADATE) | (1 << ADIE));
+    power_release(PowerAdc);
+    adc_mode = Polling;
+  }
+  TRACE(TraceAdcMode, 0xFF);
 }
 
 enum FeedMode feed_switch_read(void)
@@ -98,22 +114,27 @@ enum FeedMode feed_switch_read(void)
   // Polling mode
   if (adc_mode == Polling)
   {
-    // Write zero to ADC power reduction
-    PRR &= ~(1 << PRADC);
-    // Start the ADC conversion
+    COUNTER_BEGIN();
+    // Power the ADC up and start the conversion, the first conversion
+    // after enabling takes a little longer to set up the analog circuitry
+    power_acquire(PowerAdc);
+    ADCSRA |= (1 << ADEN);
     ADCSRA |= (1 << ADSC);
     // Poll until the ADSC bit is cleared
     loop_until_bit_is_clear(ADCSRA, ADSC);
     // Read the ADC value and decode it
     uint16_t current_adc_value = ADCL;
     current_adc_value |= (ADCH << 8);
+    ADCSRA &= ~(1 << ADEN);
+    power_release(PowerAdc);
     // Decode the current mode
-    if (current_adc_value  < FEED_MODE_LOW_TO_MED)
+    if (current_adc_value  < config.feed_low_to_med)
       current_mode = FeedLow;
-    else if (current_adc_value >= FEED_MODE_LOW_TO_MED && current_adc_value < FEED_MODE_MED_TO_HIGH)
+    else if (current_adc_value >= config.feed_low_to_med && current_adc_value < config.feed_med_to_high)
       current_mode = FeedMed;
     else
       current_mode = FeedHigh;
+    COUNTER_END(CounterAdcRead);
   }
 
   return current_mode;
@@ -121,10 +142,13 @@ enum FeedMode feed_switch_read(void)
 
 void feed_switch_open(enum ADCMode mode, enum AnalogChannel channel)
 {
+  // The ADC registers are set up with its clock running
+  power_acquire(PowerAdc);
   // Initialize channel for switch
   adc_open_channel(channel);
   // Initialize ADC interface
   adc_open(mode);
+  power_release(PowerAdc);
 }
 
 void feed_switch_close(void)
@@ -133,6 +157,31 @@ void feed_switch_close(void)
   adc_close();
 }
 
+void feed_switch_suspend(void)
+{
+  if (adc_mode == FreeRunning)
+  {
+    // Stop triggering and let the conversion under way finish
+    ADCSRA &= ~((1 << ADATE) | (1 << ADIE));
+    loop_until_bit_is_clear(ADCSRA, ADSC);
+  }
+}
+
+void feed_switch_resume(void)
+{
+  // Called with the ADC clocked, by whoever borrowed it
+  ADMUX = (1 << REFS0) | adc_channel;
+  ADCSRA = (1 << ADEN) | (1 << ADPS1) | (1 << ADPS0) | (1 << ADIF);
+  if (adc_mode == FreeRunning)
+  {
+    ADCSRA |= (1 << ADATE) | (1 << ADIE) | (1 << ADSC);
+  }
+  else
+  {
+    ADCSRA &= ~(1 << ADEN);
+  }
+}
+
 const char * feed_switch_get_mode_str(enum FeedMode mode)
 {
   return FeedModeStrings[mode];
@@ -10,6 +10,15 @@
 #include <stdint.h>
 #include <avr/pgmspace.h>
 
+// Default ADC readings from which the medium and high modes start, the
+// readings in use are in config
+#ifndef FEED_MODE_LOW_TO_MED
+#define FEED_MODE_LOW_TO_MED 256
+#endif
+#ifndef FEED_MODE_MED_TO_HIGH
+#define FEED_MODE_MED_TO_HIGH 768
+#endif
+
 /// @brief AnalogChannel is an enumeration of the available channels
 enum AnalogChannel
 {
@@ -27,7 +36,7 @@ enum AnalogChannel
 /// @brief ADCMode is an enumeration of the operational modes of the ADC
 ///
 /// in Polling mode, each read call will start an ADC conversion and block
-/// until the conversion is complete
+/// until the conversion is complete, the ADC is only powered meanwhile
 /// in FreeRunning mode, the ADC is continuously sampled in the background
 /// and each read call will fetch the most recent state of the switch
 enum ADCMode
@@ -62,6 +71,18 @@ void feed_switch_open(enum ADCMode mode, enum AnalogChannel channel);
 /// @brief close the feed mode select switch interface 
 void feed_switch_close(void);
 
+/// @brief Stop using the ADC so another driver can borrow it
+///
+/// Waits for a free running conversion to finish. Only the newest reading
+/// is kept meanwhile.
+void feed_switch_suspend(void);
+
+/// @brief Take the ADC back after feed_switch_suspend()
+///
+/// Must be called with the ADC clocked, it restores the channel, the
+/// reference and the conversion mode.
+void feed_switch_resume(void);
+
 /// @brief Get the current feed mode
 /// @returns FeedMode - the current mode selection of the feed selector switch
 enum FeedMode feed_switch_read(void);
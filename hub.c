@@ -0,0 +1,108 @@
+
+#include "hub.h"
+#include "config.h"
+#include "twi.h"
+#include <string.h>
+
+// Store a little endian value
+static void put_le(uint8_t *registers, uint32_t value, uint8_t size)
+{
+  for (uint8_t i=0; i < size; ++i)
+  {
+    registers[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+int hub_open(void)
+{
+  return twi_slave_open(config.hub_address);
+}
+
+void hub_publish(const struct hub_state_t *state)
+{
+  uint8_t registers[HubRegisters];
+  // Unused registers read as 0
+  memset(registers, 0, sizeof(registers));
+  registers[HubStatus] = state->status;
+  registers[HubMode] = state->mode;
+  registers[HubFeed] = 0;
+  registers[HubSchedule] = state->schedule_active;
+  put_le(&registers[HubLastFeed], state->last_feed, 4);
+  put_le(&registers[HubSlots], state->slots[0], 4);
+  put_le(&registers[HubSlots + 4], state->slots[1], 4);
+  put_le(&registers[HubSupply], state->supply_mv, 2);
+  // Both are little endian
+  memcpy(&registers[HubConfig], &config, sizeof(config));
+  twi_slave_publish(HubStatus, registers, HubRegisters);
+}
+
+uint8_t hub_pending(void)
+{
+  return twi_slave_pending();
+}
+
+uint8_t hub_receive(struct hub_request_t *request)
+{
+  uint8_t data[TWI_SLAVE_SIZE];
+  uint8_t reg;
+  uint8_t len = twi_slave_receive(&reg, data);
+  if (len == 0)
+  {
+    return 1;
+  }
+  request->flags = 0;
+  request->last_feed = 0;
+  request->config_len = 0;
+  // Bit per byte of the last feed time written
+  uint8_t last_feed_bytes = 0;
+  for (uint8_t i=0; i < len; ++i)
+  {
+    // The register pointer wraps at the end of the register file
+    uint8_t offset = (reg + i) % TWI_SLAVE_SIZE;
+    switch (offset)
+    {
+      case HubMode:
+        request->mode = data[i];
+        request->flags |= HUB_SET_MODE;
+        break;
+      case HubFeed:
+        request->portions = data[i];
+        request->flags |= HUB_FEED;
+        break;
+      case HubSchedule:
+        request->schedule_active = data[i];
+        request->flags |= HUB_SET_SCHEDULE;
+        break;
+      case HubLastFeed:
+      case HubLastFeed + 1:
+      case HubLastFeed + 2:
+      case HubLastFeed + 3:
+        request->last_feed |=
+          (uint32_t)data[i] << (8 * (offset - HubLastFeed));
+        last_feed_bytes |= 1 << (offset - HubLastFeed);
+        break;
+      default:
+        // Settings are taken up to the first gap, a write that wraps
+        // around the register file could come back to them
+        if (offset >= HubConfig && offset < HubRegisters &&
+            (request->config_len == 0 || offset == HubConfig +
+             request->config_offset + request->config_len))
+        {
+          if (request->config_len == 0)
+          {
+            request->config_offset = offset - HubConfig;
+          }
+          request->config[request->config_len++] = data[i];
+          request->flags |= HUB_SET_CONFIG;
+        }
+        // Otherwise read only
+        break;
+    }
+  }
+  if (last_feed_bytes == 0x0F)
+  {
+    request->flags |= HUB_SET_LAST_FEED;
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * @file hub.h
+ * @brief Register map a home hub reads and writes over the TWI bus.
+ *
+ * Any number of feeders share one bus with the hub, each answering as a
+ * TWI slave at its own address, HUB_ADDRESS by default. Values are little
+ * endian, times are seconds since 00:00:00 01/01/2000. A read returns
+ * every register as it was when the read was addressed, a multi byte
+ * value is never torn. A write is acted on by the main loop once the hub
+ * sends its STOP.
+ *
+ *   0x00 status     r   HUB_STATUS_* bits
+ *   0x01 mode       rw  FeedMode of the last feed, or of the next feeds
+ *                       once written; write HUB_MODE_SWITCH to go back to
+ *                       the feed switch
+ *   0x02 feed       w   portions to dispense now, the schedule is kept
+ *   0x03 schedule   rw  1 while the schedule runs, write 0 to stop it or
+ *                       1 to restart it from the last feed
+ *   0x04 last feed  rw  4 bytes, time of the last scheduled feed. Writing
+ *                       all 4 moves the schedule and starts it.
+ *   0x08 slots      r   2x4 bytes, times of the next two scheduled feeds,
+ *                       0 while the schedule is stopped
+ *   0x10 supply     r   2 bytes, supply voltage in mV
+ *   0x20 config     rw  the settings, struct config_t of config.h. A write
+ *                       is refused if it leaves them inconsistent, read
+ *                       them back to check. Changed settings are saved to
+ *                       the EEPROM a little later, a new address is
+ *                       answered after the STOP of the write.
+ */
+#ifndef _CAT_FEEDER_HUB_H_
+#define _CAT_FEEDER_HUB_H_
+
+#include <stdint.h>
+#include "config.h"
+
+// Default 7 bit bus address, give each feeder on a bus its own. The address
+// in use is in config.
+#ifndef HUB_ADDRESS
+#define HUB_ADDRESS 0x30
+#endif
+
+/// @brief HubRegister is an enumeration of the register offsets
+enum HubRegister
+{
+  HubStatus = 0x00,
+  HubMode = 0x01,
+  HubFeed = 0x02,
+  HubSchedule = 0x03,
+  HubLastFeed = 0x04,
+  HubSlots = 0x08,
+  HubSupply = 0x10,
+  HubConfig = 0x20,
+  HubRegisters = HubConfig + sizeof(struct config_t)
+};
+
+// Status register bits
+#define HUB_STATUS_SCHEDULE 0x01
+#define HUB_STATUS_FEEDING 0x02
+#define HUB_STATUS_SUPPLY_LOW 0x04
+#define HUB_STATUS_SUPPLY_CRITICAL 0x08
+
+// Mode register value of a feeder following its feed switch
+#define HUB_MODE_SWITCH 0xFF
+
+/// @brief The feeder state the hub reads
+struct hub_state_t
+{
+  // HUB_STATUS_* bits
+  uint8_t status;
+  uint8_t mode;
+  uint8_t schedule_active;
+  uint32_t last_feed;
+  // Next two scheduled feeds
+  uint32_t slots[2];
+  uint16_t supply_mv;
+};
+
+// Request flags, which fields of a hub_request_t were written
+#define HUB_SET_MODE 0x01
+#define HUB_FEED 0x02
+#define HUB_SET_SCHEDULE 0x04
+#define HUB_SET_LAST_FEED 0x08
+#define HUB_SET_CONFIG 0x10
+
+/// @brief A write from the hub
+struct hub_request_t
+{
+  // HUB_SET_* bits of the fields written
+  uint8_t flags;
+  uint8_t mode;
+  uint8_t portions;
+  uint8_t schedule_active;
+  uint32_t last_feed;
+  // Settings written, config_len bytes from offset config_offset in
+  // config_t
+  uint8_t config_offset;
+  uint8_t config_len;
+  uint8_t config[sizeof(struct config_t)];
+};
+
+/// @brief Answer the hub at the address in config, after twi_init()
+///
+/// Call again to move to a new address.
+/// @returns TWI_OK, or the error code of twi_slave_open()
+int hub_open(void);
+
+/// @brief Update the registers the hub reads
+/// @param state is the current feeder state
+void hub_publish(const struct hub_state_t *state);
+
+/// @brief Check for a write waiting to be taken, safe with interrupts off
+/// @returns 1 if hub_receive() has a request to return, otherwise 0
+uint8_t hub_pending(void);
+
+/// @brief Take the last write of the hub
+///
+/// A last feed time is only taken from a write of all 4 of its bytes.
+/// @param request is updated with the fields written
+/// @returns 0 if there was a request, 1 if not
+uint8_t hub_receive(struct hub_request_t *request);
+
+#endif
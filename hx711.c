@@ -0,0 +1,107 @@
+
+#include "hx711.h"
+#include "clock.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+#define HX711_DOUT_MASK (1 << HX711_DOUT_PIN)
+#define HX711_SCK_MASK (1 << HX711_SCK_PIN)
+
+/* PRIVATE GLOBALS */
+static int32_t sample;
+static volatile uint8_t sample_ready;
+
+// One PD_SCK pulse, returns DOUT after the rising edge. PD_SCK may only
+// stay high for 50us or the HX711 starts powering down, the interrupts
+// are held off for the high phase only. Both phases have to last 0.2us,
+// on the divided clock the instructions take longer than that on their
+// own and _delay_us(), timed for F_CPU, would run 8 times as long.
+static uint8_t hx711_clock(uint8_t delay)
+{
+  uint8_t bit;
+  ATOMIC_BLOCK(ATOMIC_FORCEON)
+  {
+    PORTC |= HX711_SCK_MASK;
+    if (delay)
+      _delay_us(1);
+    bit = (PINC & HX711_DOUT_MASK) != 0;
+    PORTC &= ~HX711_SCK_MASK;
+  }
+  if (delay)
+    _delay_us(1);
+  return bit;
+}
+
+ISR(PCINT1_vect)
+{
+  // Every change of DOUT lands here, only a low level is a sample
+  if (PINC & HX711_DOUT_MASK)
+  {
+    return;
+  }
+  // Clocking the bits out toggles DOUT, mask it so this doesn't run again
+  // meanwhile and let the other interrupts in between the bits. The low
+  // phase of PD_SCK can last as long as they take, the stepper tick isn't
+  // held up for the whole sample.
+  PCMSK1 &= ~HX711_DOUT_MASK;
+  sei();
+  uint8_t delay = clock_speed() == ClockFull;
+  uint32_t value = 0;
+  for (uint8_t i=0; i < 24; ++i)
+  {
+    value = (value << 1) | hx711_clock(delay);
+  }
+  // A 25th pulse selects channel A at gain 128 for the next conversion
+  hx711_clock(delay);
+  cli();
+  PCIFR = (1 << PCIF1);
+  PCMSK1 |= HX711_DOUT_MASK;
+  if (value & 0x800000UL)
+  {
+    value |= 0xFF000000UL;
+  }
+  sample = (int32_t)value;
+  sample_ready = 1;
+}
+
+void hx711_open(void)
+{
+  // DOUT is an input, pulled up so a missing HX711 never looks ready
+  DDRC &= ~HX711_DOUT_MASK;
+  PORTC |= HX711_DOUT_MASK;
+  DDRC |= HX711_SCK_MASK;
+  PCICR |= (1 << PCIE1);
+  hx711_power(0);
+}
+
+void hx711_power(uint8_t on)
+{
+  if (on)
+  {
+    PORTC &= ~HX711_SCK_MASK;
+    sample_ready = 0;
+    PCIFR = (1 << PCIF1);
+    PCMSK1 |= HX711_DOUT_MASK;
+  }
+  else
+  {
+    PCMSK1 &= ~HX711_DOUT_MASK;
+    PORTC |= HX711_SCK_MASK;
+  }
+}
+
+uint8_t hx711_read(int32_t *value)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!sample_ready)
+    {
+      return 1;
+    }
+    *value = sample;
+    sample_ready = 0;
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * @file hx711.h
+ * @brief Bit banged HX711 load cell amplifier driver.
+ *
+ * DOUT and PD_SCK are on port C. The HX711 pulls DOUT low when a
+ * conversion is ready, the pin change interrupt on DOUT then clocks the
+ * 24 bit sample out and selects channel A at gain 128 for the next one.
+ * Other interrupts run between the bits, only the high phase of each
+ * PD_SCK pulse is timed with them held off.
+ * The main loop picks samples up with hx711_read() and never waits on the
+ * converter. Holding PD_SCK high powers the HX711 down between doses.
+ */
+#ifndef _CAT_FEEDER_HX711_H_
+#define _CAT_FEEDER_HX711_H_
+
+#include <stdint.h>
+
+// Port C pins, DOUT has to be on a pin change interrupt (PCINT8-14)
+#ifndef HX711_DOUT_PIN
+#define HX711_DOUT_PIN PC1
+#endif
+#ifndef HX711_SCK_PIN
+#define HX711_SCK_PIN PC2
+#endif
+// Output data rate the RATE pin is strapped for, 10 or 80
+#ifndef HX711_RATE_HZ
+#define HX711_RATE_HZ 80
+#endif
+// Time from power up to the first settled sample
+#if HX711_RATE_HZ == 80
+#define HX711_SETTLE_MS 50
+#else
+#define HX711_SETTLE_MS 400
+#endif
+
+/// @brief Set up the pins and the data ready interrupt, powered down
+void hx711_open(void);
+
+/// @brief Power the converter up or down
+///
+/// Samples are only read while it is powered up. The first ones after a
+/// power up are only settled after HX711_SETTLE_MS.
+/// @param on is 1 to power up, 0 to power down
+void hx711_power(uint8_t on);
+
+/// @brief Take the newest sample
+/// @param value is updated with the signed 24 bit sample
+/// @returns 0 if there was a sample since the last call, otherwise 1
+uint8_t hx711_read(int32_t *value);
+
+#endif
@@ -0,0 +1,70 @@
+
+#include "log.h"
+#include "circular_buffer.h"
+#include "usart.h"
+#include <util/atomic.h>
+
+/* DEFINES */
+// Marker, id and argument size
+#define LOG_HEADER_SIZE 4
+
+/* PRIVATE GLOBALS */
+static uint8_t log_bytes[LOG_BUFFER_SIZE];
+// Ready from reset so messages can be logged before anything is opened
+static struct circular_buffer_t log_buffer = {log_bytes, 0, 0, LOG_BUFFER_SIZE};
+static uint16_t dropped;
+
+uint8_t log_begin(uint16_t id, uint8_t size)
+{
+  // The buffer holds one byte less than its size
+  uint8_t space = LOG_BUFFER_SIZE - 1 - circular_buffer_size(&log_buffer);
+  if (space < LOG_HEADER_SIZE + size)
+  {
+    ++dropped;
+    return 1;
+  }
+  circular_buffer_write(&log_buffer, LOG_FRAME_MARK);
+  circular_buffer_write(&log_buffer, id);
+  circular_buffer_write(&log_buffer, id >> 8);
+  circular_buffer_write(&log_buffer, size);
+  return 0;
+}
+
+void log_put(const void *value, uint8_t size)
+{
+  const uint8_t *bytes = value;
+  for (uint8_t i=0; i < size; ++i)
+  {
+    circular_buffer_write(&log_buffer, bytes[i]);
+  }
+}
+
+void log_flush(void)
+{
+  uint16_t lost;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    lost = dropped;
+    dropped = 0;
+  }
+  if (lost > 0)
+  {
+    LOG_WARN("%u log frames dropped", lost);
+  }
+
+  // Frames logged meanwhile by interrupts are sent too
+  while (1)
+  {
+    uint8_t byte;
+    int empty;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      empty = circular_buffer_read(&log_buffer, &byte);
+    }
+    if (empty)
+    {
+      break;
+    }
+    usart_put_char(byte);
+  }
+}
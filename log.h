@@ -0,0 +1,153 @@
+/*
+ * @file log.h
+ * @brief Tokenized diagnostic logging with compile time levels.
+ *
+ * A log call only queues a short binary frame: a marker byte, the id of
+ * its format string and its arguments in raw little endian binary. The
+ * format strings are kept in the non-loaded .logfmt section of the elf,
+ * at the address that is their id, and never reach the flash. `make
+ * logfmt` extracts them into main.logfmt, the dictionary
+ * tools/log_decode.py uses to print the frames as text.
+ *
+ * Calls above LOG_LEVEL compile to nothing. Build with ex:
+ * -DLOG_LEVEL=LOG_LEVEL_DEBUG to enable more.
+ */
+#ifndef _CAT_FEEDER_LOG_H_
+#define _CAT_FEEDER_LOG_H_
+
+#include <stdint.h>
+#include <util/atomic.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Queued frame bytes - MUST BE POWER OF 2, at most 128
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 64
+#endif
+
+/// @brief First byte of a frame, never sent in text
+#define LOG_FRAME_MARK 0x1E
+
+/// @brief Log a message
+///
+/// Each message is stored with a leading level character: E, W, I or D.
+/// Arguments are checked against the format like printf and sent as the
+/// type printf would take them, 2 bytes for %d %u %x %c and 4 bytes for
+/// %ld %lu %lx. No strings or floats, at most 6 arguments. Safe to call
+/// from interrupts.
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_WRITE("E", format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_WRITE("W", format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_WRITE("I", format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_WRITE("D", format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+// The host simulation has no use for a non-loaded section, it keeps the
+// formats in memory and counts the ids from the start of its section
+#ifdef __AVR__
+#define LOG_SECTION ".logfmt,\"\",@progbits ;"
+#define LOG_ID(format) ((uint16_t)(uintptr_t)(format))
+#else
+#define LOG_SECTION "logfmt"
+extern const char __start_logfmt[];
+#define LOG_ID(format) ((uint16_t)((format) - __start_logfmt))
+#endif
+
+// Arguments are sent promoted, as printf takes them
+#define LOG_ADD_SIZE(arg) + sizeof(+(arg))
+#define LOG_PUT_ARG(arg) \
+  { \
+    __typeof__(+(arg)) log_arg = (arg); \
+    log_put(&log_arg, sizeof(log_arg)); \
+  }
+
+// Apply a macro to each of up to 6 arguments
+#define LOG_COUNT(...) LOG_COUNT_(_, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_COUNT_(_, a, b, c, d, e, f, n, ...) n
+#define LOG_JOIN(a, b) LOG_JOIN_(a, b)
+#define LOG_JOIN_(a, b) a##b
+#define LOG_EACH(m, ...) \
+  LOG_JOIN(LOG_EACH_, LOG_COUNT(__VA_ARGS__))(m, ##__VA_ARGS__)
+#define LOG_EACH_0(m)
+#define LOG_EACH_1(m, a) m(a)
+#define LOG_EACH_2(m, a, ...) m(a) LOG_EACH_1(m, __VA_ARGS__)
+#define LOG_EACH_3(m, a, ...) m(a) LOG_EACH_2(m, __VA_ARGS__)
+#define LOG_EACH_4(m, a, ...) m(a) LOG_EACH_3(m, __VA_ARGS__)
+#define LOG_EACH_5(m, a, ...) m(a) LOG_EACH_4(m, __VA_ARGS__)
+#define LOG_EACH_6(m, a, ...) m(a) LOG_EACH_5(m, __VA_ARGS__)
+
+// Checked but compiled out, the arguments still count as used
+#define LOG_DISCARD(format, ...) \
+  do \
+  { \
+    if (0) \
+      log_check_format(format, ##__VA_ARGS__); \
+  } while (0)
+
+#define LOG_WRITE(level, format, ...) \
+  do \
+  { \
+    static const char log_format[] \
+      __attribute__((section(LOG_SECTION), used)) = level format; \
+    if (0) \
+      log_check_format(format, ##__VA_ARGS__); \
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) \
+    { \
+      if (log_begin(LOG_ID(log_format), \
+            0 LOG_EACH(LOG_ADD_SIZE, ##__VA_ARGS__)) == 0) \
+      { \
+        LOG_EACH(LOG_PUT_ARG, ##__VA_ARGS__) \
+      } \
+    } \
+  } while (0)
+
+// Never called, lets the compiler check the arguments against the format
+static inline void log_check_format(const char *format, ...)
+  __attribute__((format(printf, 1, 2)));
+static inline void log_check_format(const char *format, ...)
+{
+}
+
+/// @brief Queue the start of a frame, called by the LOG_* macros
+/// @param id is the format id
+/// @param size is the number of argument bytes that follow
+/// @returns 0 if the frame fits the queue, 1 if it was dropped
+uint8_t log_begin(uint16_t id, uint8_t size);
+
+/// @brief Queue an argument of the frame begun, called by the LOG_* macros
+/// @param value is the argument
+/// @param size is the size of the argument in bytes
+void log_put(const void *value, uint8_t size);
+
+/// @brief Send the queued frames over the serial port
+///
+/// Called from the main loop. Reports frames dropped because the queue was
+/// full with a frame of its own.
+void log_flush(void);
+
+#endif
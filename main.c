@@ -11,64 +11,73 @@
 #include <stdio.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 
 #include "circular_buffer.h"
 #include "feed_switch.h"
 #include "twi.h"
-#include "ds1307rtc.h"
+#include "rtc.h"
+#include "stepper.h"
+#include "motor_driver.h"
+#include "motion.h"
+#include "cat_feeder.h"
+#include "feed_record.h"
+#include "timebase.h"
+#include "counters.h"
+#include "config.h"
+#include "usart.h"
+#include "clock.h"
+#include "power.h"
+#include "log.h"
+#include "profile.h"
+#include "status_led.h"
+#include "supply.h"
+#include "watchdog.h"
+#include "hub.h"
+#include "dose.h"
+#include "trace.h"
 
 // Defines and macros
-#define USART_BAUD 9600
-#define BAUD_PRESCALE ((((F_CPU / 16) + (USART_BAUD  / 2)) / (USART_BAUD))- 1)
-
-#define BLINK_PIN PB1
+#define DRIVER_STEP_PIN PB1
 #define ADC_LED_PIN PB0
 #define ADC_PIN PC0
 #define BUTTON_PIN PD2
-#define BLINK_TIME 1000
+#define RTC_INT_PIN PD3
+#define STATUS_LED_PIN PB5
+#define DRIVER_DIR_PIN PB2
+#define DRIVER_MS1_PIN PD4
+#define DRIVER_MS2_PIN PD5
+#define DRIVER_MS3_PIN PD6
+#define DRIVER_ENABLE_PIN PD7
+// Number of bowls, bowl n is driven by stepper channel n
+#define FEEDER_BOWLS 1
+// Bowl on the load cell, dosed by weight
+#define SCALE_BOWL 0
 #define UART_BUFFER_SIZE 128
 
-// Volatile global flags
+// Volatile global flags, a byte each so the main loop clears one with a
+// single store instead of a read-modify-write an interrupt could slip into
 volatile struct
 {
-//  uint8_t adc_interrupt: 1;
-  uint8_t print: 1;
-  uint8_t button: 1;
+//  uint8_t adc_interrupt;
+  uint8_t print;
+  uint8_t button;
+  uint8_t rtc;
 } InterruptFlags;
 
-// Helper functions
-static void usart_setup(void)
-{
-  // Set baudrate prescaler
-  UBRR0H = (BAUD_PRESCALE >> 8);
-  UBRR0L = BAUD_PRESCALE;
-  // Enable RX and TX pins
-  UCSR0B = (1 << RXEN0) | (1 << TXEN0);
-  // Setings: 8 data bits, a single stop bit, no parity
-  UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
-  // Enable an interrupt on received serial data
-  UCSR0B |= (1 << RXCIE0);
-}
+// Last byte received on the serial port
+static volatile char serial_command;
 
-static void usart_put_char(char c)
-{
-  loop_until_bit_is_set(UCSR0A, UDRE0);
-  UDR0=c;
-}
+// Feed schedule state, saved to EEPROM on every change
+static struct feed_record_t schedule;
 
-static void usart_print_strn(const char *str, uint8_t size)
-{
-  for (uint8_t i=0; (i < size) && (*str != '\0');++i)
-  {
-    if (*str == '\n')
-    {
-      usart_put_char('\r');
-    }
-    usart_put_char(*str++);
-  }
-}
+// Feed mode the hub set, HUB_MODE_SWITCH to follow the feed switch
+static uint8_t mode_override = HUB_MODE_SWITCH;
+// Feed mode of the last feed
+static uint8_t last_mode = HUB_MODE_SWITCH;
 
+// Helper functions
 /* static void usart_print_strn_progmem(const char *str, uint8_t size) */
 /* { */
 /*   char c; */
@@ -109,43 +118,404 @@ static void usart_print_strn(const char *str, uint8_t size)
 /*   } */
 /* } */
 
-// Stepper driving
-void step_motor(uint16_t steps)
+// Run a motion program on every bowl
+static void run_program(const struct motion_instruction_t *program,
+    uint8_t runs)
 {
-  // Pulse the step pin
-  for (uint16_t step=0; step < steps; ++step)
+  // Start every bowl at once, the programs run in the background
+  for (uint8_t bowl=0; bowl < FEEDER_BOWLS; ++bowl)
   {
-    // Turn step pin on
-    PORTB |= (1 << BLINK_PIN);
-    _delay_ms(1);
-    // Turn step pin off
-    PORTB &= ~(1 << BLINK_PIN);
-    _delay_ms(1);
+    motion_run(bowl, program, runs);
+  }
+}
+
+// Check whether any bowl is being fed
+static uint8_t bowls_busy(void)
+{
+  return motion_busy() || dose_busy();
+}
+
+// Log a time read from the RTC, struct tm counts months from 0 and years
+// from 1900
+static void print_time(struct tm *time)
+{
+  LOG_INFO("%02d:%02d:%02d %02d/%02d/%04d",
+      time->tm_hour, time->tm_min, time->tm_sec,
+      time->tm_mon + 1, time->tm_mday, time->tm_year + 1900);
+}
+
+// Read the RTC, the status LED shows a clock that can't be read
+static uint8_t read_time(struct tm *time)
+{
+  if (rtc_read(time))
+  {
+    LOG_ERROR("Failed to read from RTC");
+    status_led_set(StatusRtcFault);
+    return 1;
+  }
+  status_led_clear(StatusRtcFault);
+  return 0;
+}
+
+// React to a change of the supply level
+static void handle_supply(enum SupplyLevel level)
+{
+  switch (level)
+  {
+    case SupplyCritical:
+    {
+      // Stop the largest load and make sure the schedule is stored before
+      // the brown out detector holds the part in reset
+      for (uint8_t bowl=0; bowl < FEEDER_BOWLS; ++bowl)
+      {
+        motion_stop(bowl);
+      }
+      dose_stop();
+      feed_record_save(&schedule);
+      LOG_ERROR("Supply critical at %u mV", supply_millivolts());
+      status_led_set(StatusLowSupply);
+      break;
+    }
+    case SupplyLow:
+    {
+      LOG_WARN("Supply low at %u mV", supply_millivolts());
+      status_led_set(StatusLowSupply);
+      break;
+    }
+    default:
+    {
+      LOG_INFO("Supply ok at %u mV", supply_millivolts());
+      status_led_clear(StatusLowSupply);
+      break;
+    }
+  }
+}
+
+// Dispense feeds at the level selected on the feed switch, or by the hub
+static void feed(uint8_t portions)
+{
+  TRACE(TraceFeed, portions);
+  // The motor would pull a critical supply into a brown out
+  enum SupplyLevel supply;
+  if (supply_update(&supply))
+  {
+    handle_supply(supply);
+  }
+  if (supply_level() == SupplyCritical)
+  {
+    LOG_WARN("Feed skipped at %u mV", supply_millivolts());
+    return;
+  }
+  // Cleared by the main loop once the bowls stop
+  status_led_set(StatusFeeding);
+  enum FeedMode mode = (mode_override == HUB_MODE_SWITCH) ?
+    feed_switch_read() : (enum FeedMode)mode_override;
+  last_mode = mode;
+  LOG_INFO("Feed %u portions in mode %u", portions, mode);
+  for (uint8_t bowl=0; bowl < FEEDER_BOWLS; ++bowl)
+  {
+    if (bowl == SCALE_BOWL)
+    {
+      // Runs the program of the mode itself without a calibrated scale
+      if (dose_feed(bowl, mode, portions) == 0)
+      {
+        LOG_INFO("Dosing %u.%u g", portions * dose_feed_size(mode) / 10,
+            portions * dose_feed_size(mode) % 10);
+      }
+      continue;
+    }
+    motion_run(bowl, motion_feed_program(mode), portions);
+  }
+}
+
+// Log the outcome of a load cell operation
+static void handle_dose(const struct dose_result_t *result)
+{
+  if (result->status == DoseNoScale)
+  {
+    LOG_ERROR("Load cell not answering");
+    return;
+  }
+  switch (result->op)
+  {
+    case DoseFeed:
+    {
+      if (result->status == DoseMotorBusy)
+      {
+        LOG_ERROR("Motor refused a dose move after %d of %d dg",
+            result->dosed_dg, result->target_dg);
+      }
+      else if (result->status == DoseShort)
+      {
+        LOG_WARN("Dose short, %d of %d dg in %u ms, hopper empty?",
+            result->dosed_dg, result->target_dg, result->ms);
+      }
+      else
+      {
+        LOG_INFO("Dosed %d of %d dg in %u ms, %u fine moves",
+            result->dosed_dg, result->target_dg, result->ms,
+            result->fine_moves);
+      }
+      break;
+    }
+    case DoseTare:
+    {
+      LOG_INFO("Scale tared");
+      break;
+    }
+    case DoseCalibrate:
+    {
+      if (result->status == DoseBadWeight)
+        LOG_ERROR("No calibration weight on the scale");
+      else
+        LOG_INFO("Scale calibrated at %d dg", result->weight_dg);
+      break;
+    }
+    default:
+    {
+      LOG_INFO("Bowl holds %d dg", result->weight_dg);
+      break;
+    }
+  }
+}
+
+// Arm the RTC to wake us for the next two feeds after the last feed
+static void schedule_wakeup(void)
+{
+  struct tm next_feed;
+  struct tm following_feed;
+  cat_feeder_from_seconds(schedule.last_feed + CAT_FEEDER_FEED_INTERVAL,
+      &next_feed);
+  cat_feeder_from_seconds(schedule.last_feed + 2 * CAT_FEEDER_FEED_INTERVAL,
+      &following_feed);
+  if (rtc_set_wakeup(&next_feed, &following_feed))
+  {
+    LOG_ERROR("Failed to set RTC wakeup");
+    status_led_set(StatusRtcFault);
+  }
+}
+
+// Act on a write from the hub
+static void handle_hub(const struct hub_request_t *request)
+{
+  TRACE(TraceHub, request->flags);
+  LOG_INFO("Hub request 0x%02x", request->flags);
+  if ((request->flags & HUB_SET_MODE) &&
+      (request->mode <= FeedHigh || request->mode == HUB_MODE_SWITCH))
+  {
+    mode_override = request->mode;
+  }
+  if (request->flags & (HUB_SET_SCHEDULE | HUB_SET_LAST_FEED))
+  {
+    if (request->flags & HUB_SET_LAST_FEED)
+    {
+      schedule.last_feed = request->last_feed;
+      schedule.schedule_active = 1;
+    }
+    else
+    {
+      schedule.schedule_active = request->schedule_active ? 1 : 0;
+    }
+    feed_record_save(&schedule);
+    // A stopped schedule ignores the alarms still set
+    if (schedule.schedule_active)
+    {
+      schedule_wakeup();
+    }
+  }
+  if (request->flags & HUB_SET_CONFIG)
+  {
+    uint8_t address = config.hub_address;
+    if (config_write(request->config_offset, request->config,
+          request->config_len))
+    {
+      LOG_WARN("Settings write at %u refused", request->config_offset);
+    }
+    else
+    {
+      LOG_INFO("Settings changed");
+      // Retime the drivers that took their settings when they opened, the
+      // log goes out at the old baud rate first
+      log_flush();
+      usart_flush();
+      usart_set_clock();
+      twi_set_clock();
+      if (config.hub_address != address)
+      {
+        hub_open();
+      }
+    }
+  }
+  if ((request->flags & HUB_FEED) && request->portions > 0)
+  {
+    feed(request->portions);
+  }
+}
+
+// Publish the feeder state for the hub to read
+static void publish_state(void)
+{
+  struct hub_state_t state;
+  state.status = 0;
+  if (schedule.schedule_active)
+    state.status |= HUB_STATUS_SCHEDULE;
+  if (bowls_busy())
+    state.status |= HUB_STATUS_FEEDING;
+  if (supply_level() == SupplyLow)
+    state.status |= HUB_STATUS_SUPPLY_LOW;
+  if (supply_level() == SupplyCritical)
+    state.status |= HUB_STATUS_SUPPLY_CRITICAL;
+  state.mode = (mode_override == HUB_MODE_SWITCH) ? last_mode : mode_override;
+  state.schedule_active = schedule.schedule_active;
+  state.last_feed = schedule.last_feed;
+  state.slots[0] = 0;
+  state.slots[1] = 0;
+  if (schedule.schedule_active)
+  {
+    state.slots[0] = schedule.last_feed + CAT_FEEDER_FEED_INTERVAL;
+    state.slots[1] = schedule.last_feed + 2 * CAT_FEEDER_FEED_INTERVAL;
+  }
+  state.supply_mv = supply_millivolts();
+  hub_publish(&state);
+}
+
+// Handle a single character command from the serial port
+//   s - print the instrumentation counters
+//   r - reset the instrumentation counters
+//   t - dump the event trace ring
+//   p - dump the profiler histogram
+//   a - run the agitation program to clear clogged kibble
+//   z - tare the scale with the empty bowl on it
+//   k - calibrate the scale with DOSE_CALIBRATION_G in the bowl
+//   w - weigh the bowl
+//   c - print the settings
+static void handle_command(char command)
+{
+  TRACE(TraceCommand, command);
+  switch (command)
+  {
+    case 's':
+    {
+      struct counters_snapshot_t snapshot;
+      counters_snapshot(&snapshot);
+      counters_print(&snapshot);
+      break;
+    }
+    case 'r':
+    {
+      counters_reset();
+      usart_print_strn("Counters reset\n", 15);
+      break;
+    }
+    case 't':
+    {
+      trace_dump();
+      break;
+    }
+    case 'p':
+    {
+      profile_dump();
+      break;
+    }
+    case 'a':
+    {
+      // Not in the middle of a dose
+      if (!dose_busy())
+        run_program(AgitateProgram, 1);
+      break;
+    }
+    case 'z':
+    {
+      if (dose_tare())
+        LOG_WARN("Scale busy");
+      break;
+    }
+    case 'k':
+    {
+      if (dose_calibrate())
+        LOG_WARN("Scale busy");
+      break;
+    }
+    case 'w':
+    {
+      if (dose_weigh())
+        LOG_WARN("Scale busy or not calibrated");
+      break;
+    }
+    case 'c':
+    {
+      LOG_INFO("Feed switch at %u and %u, %lu baud, SCL at %lu Hz",
+          config.feed_low_to_med, config.feed_med_to_high,
+          (unsigned long)config.usart_baud,
+          (unsigned long)config.twi_scl_freq);
+      // More than the log buffer holds at once
+      log_flush();
+      LOG_INFO("RTC at 0x%02x, hub at 0x%02x, supply low at %u mV, "
+          "critical at %u mV", config.rtc_address, config.hub_address,
+          config.supply_low_mv, config.supply_critical_mv);
+      log_flush();
+      LOG_INFO("Doses of %u, %u and %u dg", config.dose_dg[FeedLow],
+          config.dose_dg[FeedMed], config.dose_dg[FeedHigh]);
+      break;
+    }
+    default:
+      break;
   }
 }
 
 // ISR Definitions
 ISR(USART_RX_vect)
 {
+  COUNTER_BEGIN();
   // Read byte
-  char receivedByte;
-  receivedByte = UDR0;
+  serial_command = UDR0;
   // Set flag
   InterruptFlags.print = 1;
+  COUNTER_END(CounterSerialRxIsr);
 }
 
 ISR(INT0_vect)
 {
+  COUNTER_BEGIN();
   // Disable button interrupts
   EIMSK &= ~(1 << INT0);
   // Set button event flag
   InterruptFlags.button = 1; 
+  TRACE(TraceButton, 0);
+  COUNTER_END(CounterButtonIsr);
+}
+
+ISR(INT1_vect)
+{
+  COUNTER_BEGIN();
+  // Set RTC alarm/tick event flag
+  InterruptFlags.rtc = 1;
+  TRACE(TraceRtcWake, 0);
+  COUNTER_END(CounterRtcIsr);
 }
 
 int main(void)
 {
+  // Run at full speed whatever the fuses say, stop every peripheral clock
+  // until its driver opens it, then start the time base, boot time is
+  // measured from here
+  clock_open();
+  power_open();
+  timebase_open();
+  // Supervise from here on, a hang resets into the warm restart below
+  watchdog_open();
+  // The drivers take their settings from here on
+  uint8_t default_settings = config_open();
+
   // Set pin outputs
-  DDRB |= (1 << BLINK_PIN) | (1 << ADC_LED_PIN);
+  DDRB |= (1 << ADC_LED_PIN);
+  status_led_open(&PORTB, STATUS_LED_PIN);
+
+  // Setup the bowl stepper drivers
+  stepper_open();
+  stepper_attach(0, &PORTB, DRIVER_STEP_PIN, &PORTB, DRIVER_DIR_PIN);
+  motor_driver_attach(0, &PORTD, DRIVER_MS1_PIN, DRIVER_MS2_PIN,
+      DRIVER_MS3_PIN, &PORTD, DRIVER_ENABLE_PIN);
 
   // Set Button pin to input
   DDRD &= ~(1 << BUTTON_PIN);
@@ -155,18 +525,37 @@ int main(void)
   // Enable INT0 interrupt
   EIMSK = (1 << INT0);
 
+  // The RTC INT/SQW output is open drain, pull it up and wake on the
+  // falling edge of INT1
+  DDRD &= ~(1 << RTC_INT_PIN);
+  PORTD |= (1 << RTC_INT_PIN);
+  EICRA |= (1 << ISC11);
+  EIMSK |= (1 << INT1);
+
   // setup USART 0 on RX pin 1 and TX pin 2
-  usart_setup();
+  usart_open();
+
+  // Globally enable interrupts, the time base needs its overflow interrupt
+  // to time the boot
+  sei();
+  counters_reset();
+  // Sample from here on, if the profiler is built in
+  profile_open();
 
   // I2C Setup
   int twi_status = twi_init();
   if (twi_status != TWI_OK)
   {
-    usart_print_strn("TWI ERROR\n",10);
+    LOG_ERROR("TWI init failed %d", twi_status);
+    status_led_set(StatusTwiError);
+  }
+  else
+  {
+    // Answer the hub from here on, between our own RTC transfers
+    hub_open();
   }
   // Setup data to hold the current time read from the RTC
   struct tm my_time;
-  char time_print_buffer[34];
   
   // Allocate a byte buffer
   //uint8_t uart_byte_buffer[UART_BUFFER_SIZE];
@@ -175,52 +564,205 @@ int main(void)
 
   // Setup the feed switch
   feed_switch_open(Polling, A0); 
-  // Setup some character buffer for ADC values
-  char adc_buffer[32];
-
-  // Print a startup message
-  usart_print_strn("Prog Start:\n", 12);
+  // Load cell under the scale bowl, powered down until a dose
+  dose_open();
+  // Check the supply before the motor is ever run
+  supply_open();
+  if (supply_level() != SupplyOk)
+  {
+    handle_supply(supply_level());
+  }
 
-  // Globally enable interrupts
-  sei();
+  // Sleep between events, the timers and TWI keep running
+  set_sleep_mode(SLEEP_MODE_IDLE);
 
-  while (1)
+  // Restore the schedule saved before the power went out and work out
+  // whether any feed was missed while it was off. After a watchdog reset
+  // the copy in RAM is still current, resume from it without the EEPROM.
+  // The schedule is the only state taken over: it is saved on every feed
+  // and its .noinit copy is CRC checked. The settings and the scale
+  // calibration were loaded from the EEPROM above like at any boot, they
+  // only change on a command and a hang could have left their RAM copies
+  // half written. A settings change still waiting for its write back is
+  // lost.
+  struct watchdog_crash_t crash;
+  uint8_t warm = watchdog_crash(&crash) == 0
+    && feed_record_restore(&schedule) == 0;
+  uint16_t missed_feeds = 0;
+  if ((warm || feed_record_load(&schedule) == 0) && schedule.schedule_active)
   {
-    // print ADC value in string
-    if (InterruptFlags.button == 1)
+    if (read_time(&my_time) == 0)
     {
-      // Read time value
-      if (ds1307_read_rtc(&my_time))
+      uint32_t now = cat_feeder_to_seconds(&my_time);
+      if (now < schedule.last_feed)
       {
-        usart_print_strn("Failed to read from RTC\n",24);
+        // The clock lost its time, the schedule means nothing anymore
+        schedule.schedule_active = 0;
+        feed_record_save(&schedule);
       }
       else
       {
-        int time_print_size = sprintf(time_print_buffer, "%02d:%02d:%02d %02d/%02d/%04d\n",
-            my_time.tm_hour, my_time.tm_min, my_time.tm_sec, 
-            my_time.tm_mon, my_time.tm_mday, my_time.tm_year);
-        usart_print_strn(time_print_buffer, time_print_size);
+        missed_feeds = cat_feeder_feeds_due(schedule.last_feed, now);
+        if (missed_feeds > 0)
+        {
+          schedule.last_feed += missed_feeds * CAT_FEEDER_FEED_INTERVAL;
+          feed_record_save(&schedule);
+        }
       }
+    }
+    if (schedule.schedule_active)
+    {
+      schedule_wakeup();
+    }
+  }
+  uint32_t boot_us = timebase_ticks_to_us(timebase_ticks());
+  TRACE(TraceBoot, missed_feeds);
+
+  // Log a startup message, and what the watchdog caught
+  if (warm)
+  {
+    LOG_WARN("Warm restart, ready in %lu us", (unsigned long)boot_us);
+  }
+  else
+  {
+    LOG_INFO("Prog Start, reset cause 0x%02x, ready in %lu us",
+        watchdog_reset_cause(), (unsigned long)boot_us);
+  }
+  if (default_settings)
+  {
+    LOG_INFO("No stored settings, running on the defaults");
+  }
+  if (watchdog_crash(&crash) == 0)
+  {
+    LOG_ERROR("Watchdog reset %u at pc 0x%04x, check-ins missing 0x%02x, "
+        "last event %u arg %u", crash.resets, crash.pc, crash.missing,
+        crash.last_event.event, crash.last_event.arg);
+  }
+  else if (watchdog_reset_cause() & (1 << WDRF))
+  {
+    LOG_ERROR("Watchdog reset without a crash record");
+  }
+  if (missed_feeds > 0)
+  {
+    LOG_WARN("Missed %u feeds", missed_feeds);
+    // A feed that fell due while the feeder hung wasn't lost to a power
+    // cut, dispense it whatever the catch up policy
+    uint8_t catch_up = warm ? 1 : cat_feeder_catch_up_feeds(missed_feeds);
+    if (catch_up > 0)
+    {
+      feed(catch_up);
+    }
+  }
+
+  while (1)
+  {
+    watchdog_check_in(WatchdogMainLoop);
+    timebase_check_in();
+    // Handle events at full speed
+    if (InterruptFlags.button || InterruptFlags.rtc || InterruptFlags.print
+        || hub_pending())
+    {
+      clock_set(ClockFull);
+    }
+    // Manual feed, starts the schedule from now
+    if (InterruptFlags.button == 1)
+    {
       // Handle button interrupt
       InterruptFlags.button = 0;
-      int print_size = sprintf(adc_buffer, "%S\n", feed_switch_get_mode_str(feed_switch_read()));
-      if (print_size <= 0)
-      {
-        usart_print_strn("Fail\n",6);
-      }
-      else
+      // Read time value
+      if (read_time(&my_time) == 0)
       {
-        usart_print_strn(adc_buffer, print_size+1);
+        print_time(&my_time);
+        schedule.last_feed = cat_feeder_to_seconds(&my_time);
+        schedule.schedule_active = 1;
+        feed_record_save(&schedule);
+        schedule_wakeup();
       }
-      step_motor(200);
+      feed(1);
       // Reinable the button interrupt
       EIMSK |= (1 << INT0);
     }
-    // Toggle LED blink pin 
-    //PORTB ^= (1 << BLINK_PIN);
-    //_delay_ms(BLINK_TIME);
-    
-    // Set into sleep mode or something
+    // RTC alarm or tick, feed if a scheduled feed is due
+    if (InterruptFlags.rtc == 1)
+    {
+      InterruptFlags.rtc = 0;
+      rtc_acknowledge_wakeup();
+      if (schedule.schedule_active && read_time(&my_time) == 0)
+      {
+        uint16_t feeds_due = cat_feeder_feeds_due(schedule.last_feed,
+            cat_feeder_to_seconds(&my_time));
+        if (feeds_due > 0)
+        {
+          print_time(&my_time);
+          // Keep the cadence of the manual feed
+          schedule.last_feed += feeds_due * CAT_FEEDER_FEED_INTERVAL;
+          feed_record_save(&schedule);
+          feed(1);
+          schedule_wakeup();
+        }
+      }
+    }
+    // Serial command
+    if (InterruptFlags.print == 1)
+    {
+      InterruptFlags.print = 0;
+      handle_command(serial_command);
+    }
+    // Hub write
+    struct hub_request_t request;
+    if (hub_receive(&request) == 0)
+    {
+      handle_hub(&request);
+    }
+    // Advance the bowl motion programs and the dosing by weight
+    motion_service();
+    struct dose_result_t dose;
+    if (dose_service(&dose))
+    {
+      handle_dose(&dose);
+    }
+    // Watch the supply, closely while the motor draws current
+    enum SupplyLevel supply;
+    if (supply_service(bowls_busy(), &supply))
+    {
+      handle_supply(supply);
+    }
+    // Save changed settings. Like the feed record on a critical supply,
+    // the write goes on: the EEPROM is in spec down to the brown out
+    // level and both records are double buffered, a write the brown out
+    // cuts short leaves the previous copy.
+    config_service();
+    // Step at full speed, otherwise idle on the low clock until the next
+    // event
+    clock_set(bowls_busy() ? ClockFull : ClockLow);
+    if (!bowls_busy())
+    {
+      status_led_clear(StatusFeeding);
+    }
+    // Send what was logged meanwhile
+    log_flush();
+    publish_state();
+
+    // Sleep until the next interrupt. Interrupts are held off until the
+    // sleep instruction so a flag set in between can't be missed.
+    cli();
+    if (!InterruptFlags.button && !InterruptFlags.rtc && !InterruptFlags.print
+        && !hub_pending())
+    {
+      // A watchdog interrupt since the top of the loop took the check-ins,
+      // the next one has to find them
+      watchdog_check_in(WatchdogMainLoop);
+      timebase_check_in();
+      COUNTER_BEGIN();
+      timebase_sleep();
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      timebase_resume();
+      COUNTER_END(CounterSleep);
+    }
+    sei();
   }
 
   return 0;
@@ -0,0 +1,214 @@
+
+#include "motion.h"
+#include "timebase.h"
+
+/// @brief Per channel interpreter state
+struct motion_channel_t
+{
+  const struct motion_instruction_t *program;
+  // Index of the current instruction
+  uint8_t pc;
+  // Repetitions left of the current repeat block
+  uint16_t repeats;
+  uint8_t runs;
+  uint8_t pausing;
+  uint32_t pause_end;
+};
+
+/* PRIVATE GLOBALS */
+static struct motion_channel_t channels[STEPPER_MAX_CHANNELS];
+
+/* PUBLIC GLOBAL DEFINITIONS */
+// Doses are in half steps for the bulk with a short reverse kick against
+// jams, then finished in sixteenth steps. Medium is the original 200
+// sixteenth step dose.
+const struct motion_instruction_t FeedLowProgram[] PROGMEM = {
+  MOTION_FORWARD(12, 250, MicrostepHalf),
+  MOTION_REVERSE(4, 250, MicrostepHalf),
+  MOTION_FORWARD(4, 250, MicrostepHalf),
+  MOTION_FORWARD(32, 500, MicrostepSixteenth),
+  MOTION_END()
+};
+const struct motion_instruction_t FeedMedProgram[] PROGMEM = {
+  MOTION_FORWARD(20, 250, MicrostepHalf),
+  MOTION_REVERSE(4, 250, MicrostepHalf),
+  MOTION_FORWARD(4, 250, MicrostepHalf),
+  MOTION_FORWARD(40, 500, MicrostepSixteenth),
+  MOTION_END()
+};
+const struct motion_instruction_t FeedHighProgram[] PROGMEM = {
+  MOTION_FORWARD(32, 250, MicrostepHalf),
+  MOTION_REVERSE(4, 250, MicrostepHalf),
+  MOTION_FORWARD(4, 250, MicrostepHalf),
+  MOTION_FORWARD(48, 500, MicrostepSixteenth),
+  MOTION_END()
+};
+const struct motion_instruction_t AgitateProgram[] PROGMEM = {
+  MOTION_REVERSE(8, 400, MicrostepHalf),
+  MOTION_PAUSE(50),
+  MOTION_FORWARD(8, 400, MicrostepHalf),
+  MOTION_PAUSE(50),
+  MOTION_REPEAT(0, 4),
+  MOTION_END()
+};
+static const struct motion_instruction_t *FeedPrograms[3] = {FeedLowProgram,
+  FeedMedProgram, FeedHighProgram};
+
+const struct motion_instruction_t *motion_feed_program(enum FeedMode mode)
+{
+  return FeedPrograms[mode];
+}
+
+/// @brief Start a move instruction on the motor driver
+/// @returns 0 if the move started, 1 if the motor driver refused it
+static uint8_t motion_move(uint8_t channel,
+    const struct motion_instruction_t *instruction)
+{
+  // The whole move is done in the instruction's mode
+  struct motor_move_t move = {
+    .distance = instruction->count << (MicrostepSixteenth - instruction->mode),
+    .fine_distance = 0,
+    .coarse_mode = instruction->mode,
+    .fine_mode = instruction->mode,
+    .coarse_rate = instruction->arg,
+    .fine_rate = instruction->arg,
+    .direction = instruction->op == MotionReverse ? StepperReverse
+      : StepperForward
+  };
+  return motor_driver_move(channel, &move);
+}
+
+/// @brief Execute instructions until one has to wait
+static void motion_step(uint8_t channel)
+{
+  struct motion_channel_t *ch = &channels[channel];
+  while (ch->program)
+  {
+    struct motion_instruction_t instruction;
+    memcpy_P(&instruction, &ch->program[ch->pc], sizeof(instruction));
+    ++ch->pc;
+    switch (instruction.op)
+    {
+      case MotionForward:
+      case MotionReverse:
+      {
+        // A refused move would leave the rest of the program running
+        // against a motor that never turned, give up on it instead
+        if (motion_move(channel, &instruction))
+        {
+          ch->program = 0;
+        }
+        return;
+      }
+      case MotionPause:
+      {
+        ch->pausing = 1;
+        ch->pause_end = timebase_ticks() +
+          timebase_us_to_ticks((uint32_t)instruction.count * 1000);
+        timebase_wake_at(ch->pause_end);
+        return;
+      }
+      case MotionRepeat:
+      {
+        // First time through, load the repeat count
+        if (ch->repeats == 0)
+        {
+          ch->repeats = instruction.count;
+        }
+        else
+        {
+          --ch->repeats;
+        }
+        if (ch->repeats > 0)
+        {
+          ch->pc = instruction.arg;
+        }
+        break;
+      }
+      case MotionEnd:
+      default:
+      {
+        if (--ch->runs > 0)
+        {
+          ch->pc = 0;
+          ch->repeats = 0;
+        }
+        else
+        {
+          ch->program = 0;
+        }
+        break;
+      }
+    }
+  }
+}
+
+uint8_t motion_run(uint8_t channel, const struct motion_instruction_t *program,
+    uint8_t runs)
+{
+  if (channel >= STEPPER_MAX_CHANNELS || channels[channel].program ||
+      (motor_driver_busy() & (1 << channel)) || runs == 0)
+  {
+    return 1;
+  }
+  struct motion_channel_t *ch = &channels[channel];
+  ch->program = program;
+  ch->pc = 0;
+  ch->repeats = 0;
+  ch->runs = runs;
+  ch->pausing = 0;
+  motion_step(channel);
+  return 0;
+}
+
+void motion_stop(uint8_t channel)
+{
+  if (channel >= STEPPER_MAX_CHANNELS)
+  {
+    return;
+  }
+  channels[channel].program = 0;
+  motor_driver_stop(channel);
+}
+
+void motion_service(void)
+{
+  motor_driver_service();
+  uint8_t moving = motor_driver_busy();
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    struct motion_channel_t *ch = &channels[i];
+    if (!ch->program)
+    {
+      continue;
+    }
+    if (ch->pausing)
+    {
+      if (!timebase_reached(ch->pause_end))
+      {
+        // An earlier wake up may have replaced this one
+        timebase_wake_at(ch->pause_end);
+        continue;
+      }
+      ch->pausing = 0;
+    }
+    else if (moving & (1 << i))
+    {
+      continue;
+    }
+    motion_step(i);
+  }
+}
+
+uint8_t motion_busy(void)
+{
+  uint8_t busy = 0;
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    if (channels[i].program)
+    {
+      busy |= (1 << i);
+    }
+  }
+  return busy;
+}
@@ -0,0 +1,90 @@
+/*
+ * @file motion.h
+ * @brief Interpreter for motion programs stored in flash.
+ *
+ * A program is a PROGMEM array of instructions: move forward or reverse a
+ * number of steps at a rate and microstep mode, pause, or repeat a block.
+ * Programs run in the background on a bowl's motor driver, one instruction
+ * at a time, advanced by motion_service() from the main loop.
+ */
+#ifndef _CAT_FEEDER_MOTION_H_
+#define _CAT_FEEDER_MOTION_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "feed_switch.h"
+#include "motor_driver.h"
+
+/// @brief MotionOp is an enumeration of the program instructions
+enum MotionOp
+{
+  MotionEnd = 0,
+  MotionForward,
+  MotionReverse,
+  MotionPause,
+  MotionRepeat
+};
+
+/// @brief A single program instruction
+struct motion_instruction_t
+{
+  // MotionOp
+  uint8_t op;
+  // MicrostepMode of a move
+  uint8_t mode;
+  // Steps of a move, milliseconds of a pause or the number of times to
+  // repeat a block
+  uint16_t count;
+  // Steps per second of a move or the index of the first instruction of a
+  // repeated block
+  uint16_t arg;
+};
+
+// Helpers to write programs
+#define MOTION_FORWARD(steps, rate, mode) {MotionForward, (mode), (steps), (rate)}
+#define MOTION_REVERSE(steps, rate, mode) {MotionReverse, (mode), (steps), (rate)}
+#define MOTION_PAUSE(ms) {MotionPause, 0, (ms), 0}
+// Run the block from instruction first up to here times more times.
+// Repeats don't nest.
+#define MOTION_REPEAT(first, times) {MotionRepeat, 0, (times), (first)}
+#define MOTION_END() {MotionEnd, 0, 0, 0}
+
+/// @brief Flash stored dose program for FeedMode::FeedLow
+extern const struct motion_instruction_t FeedLowProgram[] PROGMEM;
+/// @brief Flash stored dose program for FeedMode::FeedMed
+extern const struct motion_instruction_t FeedMedProgram[] PROGMEM;
+/// @brief Flash stored dose program for FeedMode::FeedHigh
+extern const struct motion_instruction_t FeedHighProgram[] PROGMEM;
+/// @brief Flash stored program that shakes loose clogged kibble
+extern const struct motion_instruction_t AgitateProgram[] PROGMEM;
+
+/// @brief Get the dose program for a feed mode
+/// @param mode is the feed mode
+/// @returns program - a flash stored program
+const struct motion_instruction_t *motion_feed_program(enum FeedMode mode);
+
+/// @brief Start a program on a bowl in the background
+///
+/// A move the motor driver refuses, e.g. on a channel without a driver
+/// attached, ends the program there.
+/// @param channel is the stepper channel of the bowl
+/// @param program is a flash stored program
+/// @param runs is the number of times to run the program back to back
+/// @returns 0 if the program was started, 1 if the channel is invalid or busy
+uint8_t motion_run(uint8_t channel, const struct motion_instruction_t *program,
+    uint8_t runs);
+
+/// @brief Abort the program on a bowl and stop its motor
+/// @param channel is the stepper channel of the bowl
+void motion_stop(uint8_t channel);
+
+/// @brief Advance the running programs, call from the main loop
+///
+/// Also services the motor drivers. Never blocks.
+void motion_service(void);
+
+/// @brief Get the bowls running a program
+/// @returns a bit mask with bit n set while channel n runs a program
+uint8_t motion_busy(void);
+
+#endif
@@ -0,0 +1,255 @@
+
+#include "motor_driver.h"
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+/// @brief MotorDriverState is an enumeration of the phases of a move
+enum MotorDriverState
+{
+  MotorIdle = 0,
+  MotorEnabling,
+  MotorCoarse,
+  MotorModeChange,
+  MotorFine,
+  MotorHolding
+};
+
+/// @brief Per channel driver state
+struct motor_driver_t
+{
+  volatile uint8_t *ms_port;
+  uint8_t ms_masks[3];
+  volatile uint8_t *enable_port;
+  uint8_t enable_mask;
+  enum MotorDriverState state;
+  uint32_t deadline;
+  struct motor_move_t move;
+};
+
+/* PRIVATE GLOBALS */
+static struct motor_driver_t drivers[STEPPER_MAX_CHANNELS];
+
+// MS3:MS2:MS1 pin levels for each MicrostepMode
+static const uint8_t MicrostepPins[] PROGMEM = {0x0, 0x1, 0x2, 0x3, 0x7};
+
+/// @brief Drive the MS1-MS3 pins for a mode
+static void motor_driver_set_mode(struct motor_driver_t *driver,
+    enum MicrostepMode mode)
+{
+  uint8_t levels = pgm_read_byte(&MicrostepPins[mode]);
+  // Read-modify-writes through a pointer, the port is shared with pins
+  // driven from interrupts
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    for (uint8_t i=0; i < 3; ++i)
+    {
+      if (levels & (1 << i))
+        *driver->ms_port |= driver->ms_masks[i];
+      else
+        *driver->ms_port &= ~driver->ms_masks[i];
+    }
+  }
+}
+
+/// @brief Enable or disable the driver outputs (enable is active low)
+static void motor_driver_enable(struct motor_driver_t *driver, uint8_t enable)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (enable)
+      *driver->enable_port &= ~driver->enable_mask;
+    else
+      *driver->enable_port |= driver->enable_mask;
+  }
+}
+
+/// @brief Wait for a settle time before the next phase
+static void motor_driver_settle(struct motor_driver_t *driver,
+    enum MotorDriverState state, uint32_t settle_us)
+{
+  driver->state = state;
+  driver->deadline = timebase_ticks() + timebase_us_to_ticks(settle_us);
+  timebase_wake_at(driver->deadline);
+}
+
+/// @brief Coarse part of the move, in whole coarse steps
+static uint16_t motor_driver_coarse_steps(const struct motor_move_t *move)
+{
+  return (move->distance - move->fine_distance)
+    >> (MicrostepSixteenth - move->coarse_mode);
+}
+
+uint8_t motor_driver_attach(uint8_t channel, volatile uint8_t *ms_port,
+    uint8_t ms1_pin, uint8_t ms2_pin, uint8_t ms3_pin,
+    volatile uint8_t *enable_port, uint8_t enable_pin)
+{
+  if (channel >= STEPPER_MAX_CHANNELS ||
+      (drivers[channel].state != MotorIdle))
+  {
+    return 1;
+  }
+  struct motor_driver_t *driver = &drivers[channel];
+  driver->ms_port = ms_port;
+  driver->ms_masks[0] = (1 << ms1_pin);
+  driver->ms_masks[1] = (1 << ms2_pin);
+  driver->ms_masks[2] = (1 << ms3_pin);
+  driver->enable_port = enable_port;
+  driver->enable_mask = (1 << enable_pin);
+
+  // Start disabled, then make the pins outputs. The DDRx register sits
+  // just below PORTx in the I/O map.
+  motor_driver_enable(driver, 0);
+  motor_driver_set_mode(driver, MicrostepSixteenth);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *(enable_port - 1) |= driver->enable_mask;
+    *(ms_port - 1) |= driver->ms_masks[0] | driver->ms_masks[1]
+      | driver->ms_masks[2];
+  }
+  return 0;
+}
+
+uint8_t motor_driver_move(uint8_t channel, const struct motor_move_t *move)
+{
+  if (channel >= STEPPER_MAX_CHANNELS || drivers[channel].ms_port == 0 ||
+      (motor_driver_busy() & (1 << channel)))
+  {
+    return 1;
+  }
+  struct motor_driver_t *driver = &drivers[channel];
+  driver->move = *move;
+  if (driver->move.fine_distance > driver->move.distance)
+  {
+    driver->move.fine_distance = driver->move.distance;
+  }
+  // Whatever the coarse mode can't reach is left to the fine part
+  driver->move.fine_distance = driver->move.distance -
+    (motor_driver_coarse_steps(&driver->move)
+     << (MicrostepSixteenth - driver->move.coarse_mode));
+
+  motor_driver_set_mode(driver, driver->move.coarse_mode);
+  if (driver->state == MotorHolding)
+  {
+    // Still enabled from the last move, only the mode has to settle
+    motor_driver_settle(driver, MotorEnabling, MOTOR_DRIVER_MODE_SETTLE_US);
+  }
+  else
+  {
+    motor_driver_enable(driver, 1);
+    motor_driver_settle(driver, MotorEnabling, MOTOR_DRIVER_ENABLE_SETTLE_US);
+  }
+  return 0;
+}
+
+void motor_driver_stop(uint8_t channel)
+{
+  if (channel >= STEPPER_MAX_CHANNELS || drivers[channel].ms_port == 0)
+  {
+    return;
+  }
+  stepper_stop(channel);
+  motor_driver_enable(&drivers[channel], 0);
+  drivers[channel].state = MotorIdle;
+}
+
+void motor_driver_stop_all(void)
+{
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    motor_driver_stop(i);
+  }
+}
+
+void motor_driver_service(void)
+{
+  uint8_t stepping = stepper_active();
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    struct motor_driver_t *driver = &drivers[i];
+    struct motor_move_t *move = &driver->move;
+    switch (driver->state)
+    {
+      case MotorEnabling:
+      {
+        if (timebase_reached(driver->deadline))
+        {
+          driver->state = MotorCoarse;
+          stepper_move(i, motor_driver_coarse_steps(move), move->coarse_rate,
+              move->direction);
+          stepping = stepper_active();
+        }
+        else
+        {
+          // An earlier wake up may have replaced this one
+          timebase_wake_at(driver->deadline);
+        }
+        break;
+      }
+      case MotorCoarse:
+      {
+        if (!(stepping & (1 << i)))
+        {
+          motor_driver_set_mode(driver, move->fine_mode);
+          motor_driver_settle(driver, MotorModeChange,
+              MOTOR_DRIVER_MODE_SETTLE_US);
+        }
+        break;
+      }
+      case MotorModeChange:
+      {
+        if (timebase_reached(driver->deadline))
+        {
+          driver->state = MotorFine;
+          stepper_move(i,
+              move->fine_distance >> (MicrostepSixteenth - move->fine_mode),
+              move->fine_rate, move->direction);
+          stepping = stepper_active();
+        }
+        else
+        {
+          timebase_wake_at(driver->deadline);
+        }
+        break;
+      }
+      case MotorFine:
+      {
+        if (!(stepping & (1 << i)))
+        {
+          motor_driver_settle(driver, MotorHolding, MOTOR_DRIVER_HOLD_US);
+        }
+        break;
+      }
+      case MotorHolding:
+      {
+        if (timebase_reached(driver->deadline))
+        {
+          motor_driver_enable(driver, 0);
+          driver->state = MotorIdle;
+        }
+        else
+        {
+          timebase_wake_at(driver->deadline);
+        }
+        break;
+      }
+      case MotorIdle:
+      default:
+        break;
+    }
+  }
+}
+
+uint8_t motor_driver_busy(void)
+{
+  uint8_t busy = 0;
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    if (drivers[i].state != MotorIdle && drivers[i].state != MotorHolding)
+    {
+      busy |= (1 << i);
+    }
+  }
+  return busy;
+}
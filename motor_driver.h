@@ -0,0 +1,105 @@
+/*
+ * @file motor_driver.h
+ * @brief Big Easy Driver microstep mode and enable pin management.
+ *
+ * Sits on top of the step generator. Each move is split into a coarse part
+ * for fast bulk dispensing and a fine part for the end of the dose, with
+ * the driver's MS1-MS3 pins switched in between. The driver is only
+ * enabled for the duration of a move, so it doesn't hold full current
+ * between feeds.
+ *
+ * Distances are in sixteenth steps, the finest mode, so a dose is the same
+ * whatever modes it is split across.
+ */
+#ifndef _CAT_FEEDER_MOTOR_DRIVER_H_
+#define _CAT_FEEDER_MOTOR_DRIVER_H_
+
+#include <stdint.h>
+#include "stepper.h"
+
+// Time from enabling the driver to the first step
+#ifndef MOTOR_DRIVER_ENABLE_SETTLE_US
+#define MOTOR_DRIVER_ENABLE_SETTLE_US 1000
+#endif
+// Time from changing the microstep mode to the next step
+#ifndef MOTOR_DRIVER_MODE_SETTLE_US
+#define MOTOR_DRIVER_MODE_SETTLE_US 100
+#endif
+// Time the motor is held after the last step before the driver is disabled
+#ifndef MOTOR_DRIVER_HOLD_US
+#define MOTOR_DRIVER_HOLD_US 50000
+#endif
+
+/// @brief MicrostepMode is an enumeration of the driver step resolutions,
+/// each value is log2 of the number of microsteps per full step
+enum MicrostepMode
+{
+  MicrostepFull = 0,
+  MicrostepHalf = 1,
+  MicrostepQuarter = 2,
+  MicrostepEighth = 3,
+  MicrostepSixteenth = 4
+};
+
+/// @brief A move split into a coarse and a fine part
+struct motor_move_t
+{
+  // Total distance in sixteenth steps
+  uint16_t distance;
+  // Distance at the end of the move done in fine_mode, in sixteenth steps.
+  // Any part of the coarse distance that isn't a whole coarse step is
+  // added to it.
+  uint16_t fine_distance;
+  enum MicrostepMode coarse_mode;
+  enum MicrostepMode fine_mode;
+  // Step rates in steps of their own mode per second
+  uint16_t coarse_rate;
+  uint16_t fine_rate;
+  enum StepperDirection direction;
+};
+
+/// @brief Assign the driver control pins of a stepper channel
+///
+/// The channel's step and direction pins have to be attached with
+/// stepper_attach(). The pins are configured as outputs and the driver is
+/// left disabled.
+/// @param channel is the stepper channel the driver is on
+/// @param ms_port is the PORTx register of the MS1-MS3 pins
+/// @param ms1_pin is the bit number of the MS1 pin
+/// @param ms2_pin is the bit number of the MS2 pin
+/// @param ms3_pin is the bit number of the MS3 pin
+/// @param enable_port is the PORTx register of the (active low) enable pin
+/// @param enable_pin is the bit number of the enable pin
+/// @returns 0 if the driver was attached, 1 if the channel is invalid or busy
+uint8_t motor_driver_attach(uint8_t channel, volatile uint8_t *ms_port,
+    uint8_t ms1_pin, uint8_t ms2_pin, uint8_t ms3_pin,
+    volatile uint8_t *enable_port, uint8_t enable_pin);
+
+/// @brief Start a move in the background
+///
+/// motor_driver_service() has to be called from the main loop to move
+/// through the enable, coarse, fine and hold phases.
+/// @param channel is the stepper channel to move
+/// @param move is the move to make, copied
+/// @returns 0 if the move was started, 1 if the channel is invalid or busy
+uint8_t motor_driver_move(uint8_t channel, const struct motor_move_t *move);
+
+/// @brief Abort the move on a channel and disable its driver
+/// @param channel is the stepper channel to stop
+void motor_driver_stop(uint8_t channel);
+
+/// @brief Abort all moves and disable all drivers
+void motor_driver_stop_all(void);
+
+/// @brief Advance the moves in progress, call from the main loop
+///
+/// Never blocks, sets up a time base wake up for the next settle deadline.
+void motor_driver_service(void);
+
+/// @brief Get the channels that are busy with a move
+///
+/// A channel whose driver is held enabled after a move counts as idle
+/// @returns a bit mask with bit n set while channel n is busy
+uint8_t motor_driver_busy(void);
+
+#endif
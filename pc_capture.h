@@ -0,0 +1,79 @@
+/*
+ * @file pc_capture.h
+ * @brief Interrupts that hand the program counter they interrupted to C.
+ *
+ * The sampling profiler and the watchdog crash record both need the
+ * address the main program was at when their interrupt fired. The return
+ * address is on top of the stack, but a C interrupt handler's own
+ * prologue pushes an unknown number of registers over it, so the vector
+ * is written naked: it saves the registers a C call may clobber, reads the
+ * return address from a known depth and calls the handler with it.
+ */
+#ifndef _CAT_FEEDER_PC_CAPTURE_H_
+#define _CAT_FEEDER_PC_CAPTURE_H_
+
+#include <avr/interrupt.h>
+
+#ifdef __AVR__
+/// @brief Define the interrupt of vector to call handler with the program
+/// counter (word address) it interrupted
+///
+/// handler has to be a static void function taking a uint16_t, marked
+/// used so the call from the assembly keeps it.
+#define PC_CAPTURE_ISR(vector, handler) \
+ISR(vector, ISR_NAKED) \
+{ \
+  asm volatile( \
+      "push r1\n\t" \
+      "push r0\n\t" \
+      "in r0, __SREG__\n\t" \
+      "push r0\n\t" \
+      "clr r1\n\t" \
+      "push r18\n\t" \
+      "push r19\n\t" \
+      "push r20\n\t" \
+      "push r21\n\t" \
+      "push r22\n\t" \
+      "push r23\n\t" \
+      "push r24\n\t" \
+      "push r25\n\t" \
+      "push r26\n\t" \
+      "push r27\n\t" \
+      "push r30\n\t" \
+      "push r31\n\t" \
+      /* 15 bytes pushed, SP points below the last one. The return */ \
+      /* address is above them, high byte first. */ \
+      "in r30, __SP_L__\n\t" \
+      "in r31, __SP_H__\n\t" \
+      "ldd r25, Z+16\n\t" \
+      "ldd r24, Z+17\n\t" \
+      "call " #handler "\n\t" \
+      "pop r31\n\t" \
+      "pop r30\n\t" \
+      "pop r27\n\t" \
+      "pop r26\n\t" \
+      "pop r25\n\t" \
+      "pop r24\n\t" \
+      "pop r23\n\t" \
+      "pop r22\n\t" \
+      "pop r21\n\t" \
+      "pop r20\n\t" \
+      "pop r19\n\t" \
+      "pop r18\n\t" \
+      "pop r0\n\t" \
+      "out __SREG__, r0\n\t" \
+      "pop r0\n\t" \
+      "pop r1\n\t" \
+      "reti\n\t" \
+      ::); \
+}
+#else
+// The host simulation has no program counter to capture
+#define PC_CAPTURE_ISR(vector, handler) \
+ISR(vector) \
+{ \
+  handler(0); \
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+
+#include "power.h"
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/* DEFINES */
+#define POWER_DOMAINS 8
+#define POWER_ALL ((1 << PRADC) | (1 << PRUSART0) | (1 << PRSPI) \
+    | (1 << PRTIM1) | (1 << PRTIM0) | (1 << PRTIM2) | (1 << PRTWI))
+
+/* PRIVATE GLOBALS */
+// References held on each PRR bit
+static uint8_t users[POWER_DOMAINS];
+
+void power_open(void)
+{
+  for (uint8_t i=0; i < POWER_DOMAINS; ++i)
+  {
+    users[i] = 0;
+  }
+  PRR = POWER_ALL;
+  // Nothing compares analog voltages
+  ACSR |= (1 << ACD);
+}
+
+void power_acquire(enum PowerDomain domain)
+{
+  // PRR and the counts are shared by every driver
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (users[domain]++ == 0)
+    {
+      PRR &= ~(1 << domain);
+    }
+  }
+}
+
+void power_release(enum PowerDomain domain)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // A close without an open leaves the other users alone
+    if (users[domain] > 0 && --users[domain] == 0)
+    {
+      PRR |= (1 << domain);
+    }
+  }
+}
+
+uint8_t power_users(enum PowerDomain domain)
+{
+  return users[domain];
+}
@@ -0,0 +1,124 @@
+
+#include "profile.h"
+
+#if PROFILE_ENABLE
+#include "clock.h"
+#include "pc_capture.h"
+#include "power.h"
+#include "usart.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/* PRIVATE GLOBALS */
+static volatile uint16_t buckets[PROFILE_BUCKETS];
+static volatile uint16_t outside;
+static uint8_t sampling;
+
+// Count a sample of a program counter (word address)
+static void __attribute__((used)) profile_sample(uint16_t pc)
+{
+  uint16_t offset = (pc << 1) - PROFILE_BASE;
+  uint16_t bucket = offset >> PROFILE_SHIFT;
+  if ((pc << 1) < PROFILE_BASE || bucket >= PROFILE_BUCKETS)
+  {
+    if (outside < UINT16_MAX)
+      ++outside;
+  }
+  else if (buckets[bucket] < UINT16_MAX)
+  {
+    ++buckets[bucket];
+  }
+}
+
+PC_CAPTURE_ISR(TIMER0_COMPA_vect, profile_sample)
+
+void profile_open(void)
+{
+  power_acquire(PowerTimer0);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    for (uint8_t i=0; i < PROFILE_BUCKETS; ++i)
+    {
+      buckets[i] = 0;
+    }
+    outside = 0;
+    // Clear timer on compare match mode
+    TCCR0A = (1 << WGM01);
+    TCNT0 = 0;
+    sampling = 1;
+    profile_set_clock();
+    TIFR0 = (1 << OCF0A);
+    TIMSK0 |= (1 << OCIE0A);
+  }
+}
+
+void profile_close(void)
+{
+  if (!sampling)
+  {
+    return;
+  }
+  sampling = 0;
+  TIMSK0 &= ~(1 << OCIE0A);
+  TCCR0B = 0;
+  power_release(PowerTimer0);
+}
+
+void profile_set_clock(void)
+{
+  // Timer0 clock selects 1 to 5 divide by 1, 8, 64, 256 and 1024
+  static const uint8_t prescaler_shifts[5] = {0, 3, 6, 8, 10};
+  if (!sampling)
+  {
+    return;
+  }
+  uint32_t period = clock_hz() / PROFILE_HZ;
+  uint8_t select = 0;
+  while (select < 4 && (period >> prescaler_shifts[select]) > 256)
+  {
+    ++select;
+  }
+  period >>= prescaler_shifts[select];
+  OCR0A = (period > 256 ? 256 : (period ? period : 1)) - 1;
+  TCCR0B = select + 1;
+}
+
+/// @brief Send bytes over the serial port without any translation
+static void profile_send(const void *data, uint8_t size)
+{
+  const uint8_t *bytes = data;
+  for (uint8_t i=0; i < size; ++i)
+  {
+    usart_put_char(bytes[i]);
+  }
+}
+
+void profile_dump(void)
+{
+  // Pause sampling, the samples missed meanwhile aren't counted
+  TIMSK0 &= ~(1 << OCIE0A);
+
+  uint16_t hz = PROFILE_HZ;
+  uint8_t shift = PROFILE_SHIFT;
+  uint16_t base = PROFILE_BASE;
+  uint8_t count = PROFILE_BUCKETS;
+  uint16_t samples_outside = outside;
+  profile_send("PROF", 4);
+  profile_send(&hz, sizeof(hz));
+  profile_send(&shift, sizeof(shift));
+  profile_send(&base, sizeof(base));
+  profile_send(&count, sizeof(count));
+  profile_send(&samples_outside, sizeof(samples_outside));
+  for (uint8_t i=0; i < PROFILE_BUCKETS; ++i)
+  {
+    uint16_t samples = buckets[i];
+    profile_send(&samples, sizeof(samples));
+    buckets[i] = 0;
+  }
+  outside = 0;
+
+  TIFR0 = (1 << OCF0A);
+  TIMSK0 |= (1 << OCIE0A);
+}
+#endif
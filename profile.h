@@ -0,0 +1,69 @@
+/*
+ * @file profile.h
+ * @brief Statistical program counter sampling profiler.
+ *
+ * Timer0 interrupts PROFILE_HZ times a second and bins the address it
+ * interrupted into a RAM histogram of PROFILE_BUCKETS buckets of
+ * 2^PROFILE_SHIFT bytes of flash from PROFILE_BASE. The histogram is
+ * dumped in binary over the serial port on request and mapped to function
+ * names on the host with tools/profile_report.py and main.sym. Off by
+ * default, build with -DPROFILE_ENABLE=1. Time spent asleep shows up at
+ * the instruction after the sleep in main().
+ */
+#ifndef _CAT_FEEDER_PROFILE_H_
+#define _CAT_FEEDER_PROFILE_H_
+
+#include <stdint.h>
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 0
+#endif
+
+// Sampling rate
+#ifndef PROFILE_HZ
+#define PROFILE_HZ 1000
+#endif
+
+// Histogram size, 2 bytes of RAM per bucket, at most 255
+#ifndef PROFILE_BUCKETS
+#define PROFILE_BUCKETS 128
+#endif
+
+// Log2 of the flash bytes per bucket
+#ifndef PROFILE_SHIFT
+#define PROFILE_SHIFT 7
+#endif
+
+// Flash byte address of the first bucket
+#ifndef PROFILE_BASE
+#define PROFILE_BASE 0
+#endif
+
+#if PROFILE_ENABLE
+/// @brief Clear the histogram and start sampling
+void profile_open(void);
+
+/// @brief Stop sampling
+void profile_close(void);
+
+/// @brief Set the Timer0 prescaler and period for the current system clock
+///
+/// Called by clock_set() with interrupts disabled.
+void profile_set_clock(void);
+
+/// @brief Send the histogram over the serial port and clear it
+///
+/// Format: the marker "PROF", the sampling rate (uint16), PROFILE_SHIFT
+/// (uint8), PROFILE_BASE (uint16), the bucket count (uint8), the samples
+/// outside the buckets (uint16), then a uint16 count per bucket. All values
+/// little endian. Counts stop at 65535. Sampling is paused while the
+/// histogram is sent.
+void profile_dump(void);
+#else
+static inline void profile_open(void) {}
+static inline void profile_close(void) {}
+static inline void profile_set_clock(void) {}
+static inline void profile_dump(void) {}
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+
+#include "rtc.h"
+
+#ifdef RTC_DS3231
+
+uint8_t rtc_read(struct tm *current_time)
+{
+  return ds3231_read_rtc(current_time);
+}
+
+uint8_t rtc_set_wakeup(const struct tm *next_feed,
+    const struct tm *following_feed)
+{
+  // Alarm2 only matches whole minutes, round the backup up so it never
+  // fires before the feed is due
+  struct tm backup = *following_feed;
+  if (backup.tm_sec != 0)
+  {
+    backup.tm_sec = 0;
+    if (++backup.tm_min == 60)
+    {
+      backup.tm_min = 0;
+      if (++backup.tm_hour == 24)
+        backup.tm_hour = 0;
+    }
+  }
+  // Release the pin in case an old alarm is still pending. Done before
+  // arming, clearing afterwards could drop a flag the new alarm raised.
+  if (ds3231_clear_alarms(0))
+  {
+    return 1;
+  }
+  if (ds3231_set_alarm(Alarm1, next_feed))
+  {
+    return 1;
+  }
+  return ds3231_set_alarm(Alarm2, &backup);
+}
+
+uint8_t rtc_acknowledge_wakeup(void)
+{
+  return ds3231_clear_alarms(0);
+}
+
+#else
+
+uint8_t rtc_read(struct tm *current_time)
+{
+  return ds1307_read_rtc(current_time);
+}
+
+uint8_t rtc_set_wakeup(const struct tm *next_feed,
+    const struct tm *following_feed)
+{
+  return ds1307_configure_square_wave(SqwOn, SqwLogicLow, Freq1Hz);
+}
+
+uint8_t rtc_acknowledge_wakeup(void)
+{
+  return 0;
+}
+
+#endif
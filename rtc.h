@@ -0,0 +1,44 @@
+/*
+ * @file rtc.h
+ * @brief Real time clock backend selection.
+ *
+ * The feeder talks to the clock through this interface. The DS1307 is used
+ * by default, build with -DRTC_DS3231 to use a DS3231 instead. Either chip's
+ * INT/SQW pin is wired to INT1 (PD3) to wake the MCU: the DS3231 pulls it
+ * low when a feed alarm fires, the DS1307 outputs a 1 Hz tick.
+ */
+#ifndef _CAT_FEEDER_RTC_H_
+#define _CAT_FEEDER_RTC_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef RTC_DS3231
+#include "ds3231rtc.h"
+#else
+#include "ds1307rtc.h"
+#endif
+
+/// @brief Read current time from the RTC
+/// @param current time is a pointer to the value of the current time to be updated
+/// @returns 0 if there are no errors
+uint8_t rtc_read(struct tm *current_time);
+
+/// @brief Arm the RTC to wake the MCU for the upcoming feeds
+///
+/// The DS3231 sets Alarm1 to the next feed and Alarm2 to the one after it
+/// as a backup in case Alarm1 can't be rearmed. The DS1307 has no alarms,
+/// it enables its 1 Hz square wave instead and the times are ignored.
+/// @param next_feed is the time of the next feed
+/// @param following_feed is the time of the feed after next_feed
+/// @returns 0 if configuration was successfull, returns 1 if a communcation error occured.
+uint8_t rtc_set_wakeup(const struct tm *next_feed,
+    const struct tm *following_feed);
+
+/// @brief Acknowledge a wake up from the INT/SQW pin
+///
+/// Releases the pin on the DS3231, does nothing on the DS1307.
+/// @returns 0 if there are no errors
+uint8_t rtc_acknowledge_wakeup(void);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Host simulation stand-in for <avr/eeprom.h>
+ *
+ * EEMEM variables are collected in their own section, which is the EEPROM
+ * image. Writes take the EEPROM programming time in virtual time.
+ */
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEMEM __attribute__((section("sim_eeprom")))
+#define E2END 0x3FF
+
+uint8_t eeprom_read_byte(const uint8_t *address);
+uint16_t eeprom_read_word(const uint16_t *address);
+uint32_t eeprom_read_dword(const uint32_t *address);
+void eeprom_read_block(void *destination, const void *source, size_t size);
+void eeprom_write_byte(uint8_t *address, uint8_t value);
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+void eeprom_update_word(uint16_t *address, uint16_t value);
+void eeprom_update_dword(uint32_t *address, uint32_t value);
+void eeprom_write_block(const void *source, void *destination, size_t size);
+void eeprom_update_block(const void *source, void *destination, size_t size);
+
+#define eeprom_is_ready() 1
+#define eeprom_busy_wait() do {} while (0)
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Host simulation stand-in for <avr/interrupt.h>
+ *
+ * Interrupt handlers are plain functions, the simulation calls them when
+ * their flag and enable bits are set and the global interrupt enable bit
+ * in SREG is set.
+ */
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+void sim_sei(void);
+void sim_cli(void);
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void) {}
+#define sei() sim_sei()
+#define cli() sim_cli()
+#define reti() return
+
+#define INT0_vect sim_isr_int0
+#define INT1_vect sim_isr_int1
+#define PCINT0_vect sim_isr_pcint0
+#define PCINT1_vect sim_isr_pcint1
+#define PCINT2_vect sim_isr_pcint2
+#define WDT_vect sim_isr_wdt
+#define TIMER2_COMPA_vect sim_isr_timer2_compa
+#define TIMER2_COMPB_vect sim_isr_timer2_compb
+#define TIMER2_OVF_vect sim_isr_timer2_ovf
+#define TIMER1_CAPT_vect sim_isr_timer1_capt
+#define TIMER1_COMPA_vect sim_isr_timer1_compa
+#define TIMER1_COMPB_vect sim_isr_timer1_compb
+#define TIMER1_OVF_vect sim_isr_timer1_ovf
+#define TIMER0_COMPA_vect sim_isr_timer0_compa
+#define TIMER0_COMPB_vect sim_isr_timer0_compb
+#define TIMER0_OVF_vect sim_isr_timer0_ovf
+#define SPI_STC_vect sim_isr_spi_stc
+#define USART_RX_vect sim_isr_usart_rx
+#define USART_UDRE_vect sim_isr_usart_udre
+#define USART_TX_vect sim_isr_usart_tx
+#define ADC_vect sim_isr_adc
+#define EE_READY_vect sim_isr_ee_ready
+#define ANALOG_COMP_vect sim_isr_analog_comp
+#define TWI_vect sim_isr_twi
+#define SPM_READY_vect sim_isr_spm_ready
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Host simulation stand-in for <avr/io.h> (ATmega328P).
+ *
+ * The I/O registers are a plain byte array at their data memory addresses.
+ * Register reads and writes have no side effects of their own: the
+ * peripheral models act when the firmware waits on a register with
+ * loop_until_bit_is_set()/loop_until_bit_is_clear(), when it sleeps, and
+ * as virtual time passes.
+ *
+ * The interrupt flag registers are cleared by writing ones. The simulation
+ * keeps their real value to itself and shows it with the reserved bit 7
+ * set, so a write by the firmware is the value with bit 7 clear.
+ */
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t sim_io[0x100];
+void sim_wait(volatile uint8_t *reg);
+
+#define _SFR_MEM8(a) (sim_io[(a)])
+#define _SFR_MEM16(a) (*(volatile uint16_t *)&sim_io[(a)])
+#define _BV(b) (1 << (b))
+#define bit_is_set(r,b) ((r) & _BV(b))
+#define bit_is_clear(r,b) (!((r) & _BV(b)))
+// Every wait lets the simulated peripheral act on the register first
+#define loop_until_bit_is_set(r,b) do { sim_wait(&(r)); } while (bit_is_clear(r,b))
+#define loop_until_bit_is_clear(r,b) do { sim_wait(&(r)); } while (bit_is_set(r,b))
+#define PINB _SFR_MEM8(0x23)
+#define DDRB _SFR_MEM8(0x24)
+#define PORTB _SFR_MEM8(0x25)
+#define PINC _SFR_MEM8(0x26)
+#define DDRC _SFR_MEM8(0x27)
+#define PORTC _SFR_MEM8(0x28)
+#define PIND _SFR_MEM8(0x29)
+#define DDRD _SFR_MEM8(0x2A)
+#define PORTD _SFR_MEM8(0x2B)
+#define TIFR0 _SFR_MEM8(0x35)
+#define TIFR1 _SFR_MEM8(0x36)
+#define TIFR2 _SFR_MEM8(0x37)
+#define PCIFR _SFR_MEM8(0x3B)
+#define EIFR _SFR_MEM8(0x3C)
+#define EIMSK _SFR_MEM8(0x3D)
+#define GPIOR0 _SFR_MEM8(0x3E)
+#define EECR _SFR_MEM8(0x3F)
+#define EEDR _SFR_MEM8(0x40)
+#define EEAR _SFR_MEM16(0x41)
+#define GTCCR _SFR_MEM8(0x43)
+#define TCCR0A _SFR_MEM8(0x44)
+#define TCCR0B _SFR_MEM8(0x45)
+#define TCNT0 _SFR_MEM8(0x46)
+#define OCR0A _SFR_MEM8(0x47)
+#define OCR0B _SFR_MEM8(0x48)
+#define GPIOR1 _SFR_MEM8(0x4A)
+#define GPIOR2 _SFR_MEM8(0x4B)
+#define SPCR _SFR_MEM8(0x4C)
+#define SPSR _SFR_MEM8(0x4D)
+#define SPDR _SFR_MEM8(0x4E)
+#define ACSR _SFR_MEM8(0x50)
+#define SMCR _SFR_MEM8(0x53)
+#define MCUSR _SFR_MEM8(0x54)
+#define MCUCR _SFR_MEM8(0x55)
+#define SPL _SFR_MEM8(0x5D)
+#define SPH _SFR_MEM8(0x5E)
+#define SREG _SFR_MEM8(0x5F)
+#define WDTCSR _SFR_MEM8(0x60)
+#define CLKPR _SFR_MEM8(0x61)
+#define PRR _SFR_MEM8(0x64)
+#define OSCCAL _SFR_MEM8(0x66)
+#define PCICR _SFR_MEM8(0x68)
+#define EICRA _SFR_MEM8(0x69)
+#define PCMSK0 _SFR_MEM8(0x6B)
+#define PCMSK1 _SFR_MEM8(0x6C)
+#define PCMSK2 _SFR_MEM8(0x6D)
+#define TIMSK0 _SFR_MEM8(0x6E)
+#define TIMSK1 _SFR_MEM8(0x6F)
+#define TIMSK2 _SFR_MEM8(0x70)
+#define ADC _SFR_MEM16(0x78)
+#define ADCW _SFR_MEM16(0x78)
+#define ADCL _SFR_MEM8(0x78)
+#define ADCH _SFR_MEM8(0x79)
+#define ADCSRA _SFR_MEM8(0x7A)
+#define ADCSRB _SFR_MEM8(0x7B)
+#define ADMUX _SFR_MEM8(0x7C)
+#define DIDR0 _SFR_MEM8(0x7E)
+#define DIDR1 _SFR_MEM8(0x7F)
+#define TCCR1A _SFR_MEM8(0x80)
+#define TCCR1B _SFR_MEM8(0x81)
+#define TCCR1C _SFR_MEM8(0x82)
+#define TCNT1 _SFR_MEM16(0x84)
+#define ICR1 _SFR_MEM16(0x86)
+#define OCR1A _SFR_MEM16(0x88)
+#define OCR1B _SFR_MEM16(0x8A)
+#define TCCR2A _SFR_MEM8(0xB0)
+#define TCCR2B _SFR_MEM8(0xB1)
+#define TCNT2 _SFR_MEM8(0xB2)
+#define OCR2A _SFR_MEM8(0xB3)
+#define OCR2B _SFR_MEM8(0xB4)
+#define ASSR _SFR_MEM8(0xB6)
+#define TWBR _SFR_MEM8(0xB8)
+#define TWSR _SFR_MEM8(0xB9)
+#define TWAR _SFR_MEM8(0xBA)
+#define TWDR _SFR_MEM8(0xBB)
+#define TWCR _SFR_MEM8(0xBC)
+#define TWAMR _SFR_MEM8(0xBD)
+#define UCSR0A _SFR_MEM8(0xC0)
+#define UCSR0B _SFR_MEM8(0xC1)
+#define UCSR0C _SFR_MEM8(0xC2)
+#define UBRR0 _SFR_MEM16(0xC4)
+#define UBRR0L _SFR_MEM8(0xC4)
+#define UBRR0H _SFR_MEM8(0xC5)
+// UDR0 is widened over the reserved byte after it so the simulation can
+// tell a character written by the firmware (high byte 0x00) from a received
+// one (0x01) and an empty register (0xFF)
+#define UDR0 _SFR_MEM16(0xC6)
+
+/* pins */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PCINT0 0
+#define PCINT8 0
+#define PCINT16 0
+/* TIFR/TIMSK */
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+/* PCICR/PCIFR */
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+/* EIMSK/EIFR/EICRA */
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+/* EECR */
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+/* GTCCR */
+#define PSRSYNC 0
+#define PSRASY 1
+#define TSM 7
+/* TCCR0A/B */
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define FOC0B 6
+#define FOC0A 7
+/* TCCR1 */
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+/* TCCR2 */
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+/* ASSR */
+#define TCR2BUB 0
+#define TCR2AUB 1
+#define OCR2BUB 2
+#define OCR2AUB 3
+#define TCN2UB 4
+#define AS2 5
+#define EXCLK 6
+/* SMCR */
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+/* MCUSR */
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+/* MCUCR */
+#define IVCE 0
+#define IVSEL 1
+#define PUD 4
+#define BODSE 5
+#define BODS 6
+/* WDTCSR */
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+/* CLKPR */
+#define CLKPS0 0
+#define CLKPS1 1
+#define CLKPS2 2
+#define CLKPS3 3
+#define CLKPCE 7
+/* PRR */
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+/* ADC */
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ACME 6
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define ADC0D 0
+/* ACSR */
+#define ACD 7
+/* SPCR */
+#define SPE 6
+/* TWI */
+#define TWPS0 0
+#define TWPS1 1
+#define TWGCE 0
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+/* USART */
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+#define UMSEL00 6
+#define UMSEL01 7
+#define RAMEND 0x8FF
+#define FLASHEND 0x7FFF
+#define E2END 0x3FF
+#endif
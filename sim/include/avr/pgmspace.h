@@ -0,0 +1,36 @@
+/*
+ * Host simulation stand-in for <avr/pgmspace.h>
+ *
+ * Program memory is ordinary memory on the host.
+ */
+#ifndef _SIM_AVR_PGMSPACE_H_
+#define _SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+#define pgm_read_byte_near pgm_read_byte
+#define pgm_read_word_near pgm_read_word
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+
+// avr-libc prints program memory strings with %S, the host library
+// doesn't know it
+int sim_sprintf(char *buffer, const char *format, ...);
+#define sprintf sim_sprintf
+#define sprintf_P sim_sprintf
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Host simulation stand-in for <avr/sleep.h>
+ *
+ * sleep_cpu() runs virtual time forward to the next interrupt.
+ */
+#ifndef _SIM_AVR_SLEEP_H_
+#define _SIM_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+void sim_sleep(void);
+
+#define SLEEP_MODE_IDLE 0x00
+#define SLEEP_MODE_ADC 0x02
+#define SLEEP_MODE_PWR_DOWN 0x04
+#define SLEEP_MODE_PWR_SAVE 0x06
+#define SLEEP_MODE_STANDBY 0x0C
+#define SLEEP_MODE_EXT_STANDBY 0x0E
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~0x0E) | (mode))
+#define sleep_enable() (SMCR |= (1 << SE))
+#define sleep_disable() (SMCR &= ~(1 << SE))
+#define sleep_cpu() sim_sleep()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+#define sleep_bod_disable() do {} while (0)
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Host simulation stand-in for <util/atomic.h>, built the same way as the
+ * avr-libc one on the I bit of SREG.
+ */
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+static inline uint8_t sim_atomic_begin(void)
+{
+  cli();
+  return 1;
+}
+
+static inline void sim_atomic_restore(const uint8_t *sreg)
+{
+  if (*sreg & 0x80)
+    sei();
+  else
+    cli();
+}
+
+static inline void sim_atomic_force_on(const uint8_t *sreg)
+{
+  (void)sreg;
+  sei();
+}
+
+static inline void sim_atomic_force_off(const uint8_t *sreg)
+{
+  (void)sreg;
+  cli();
+}
+
+#define ATOMIC_BLOCK(type) \
+  for (type, sim_atomic_todo = sim_atomic_begin(); sim_atomic_todo; \
+      sim_atomic_todo = 0)
+#define ATOMIC_RESTORESTATE \
+  uint8_t sim_sreg_save __attribute__((cleanup(sim_atomic_restore))) = SREG
+#define ATOMIC_FORCEON \
+  uint8_t sim_sreg_save __attribute__((cleanup(sim_atomic_force_on))) = SREG
+
+#define NONATOMIC_BLOCK(type) \
+  for (type, sim_atomic_todo = (sei(), 1); sim_atomic_todo; \
+      sim_atomic_todo = 0)
+#define NONATOMIC_RESTORESTATE \
+  uint8_t sim_sreg_save __attribute__((cleanup(sim_atomic_restore))) = SREG
+#define NONATOMIC_FORCEOFF \
+  uint8_t sim_sreg_save __attribute__((cleanup(sim_atomic_force_off))) = SREG
+
+#endif
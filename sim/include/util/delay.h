@@ -0,0 +1,20 @@
+/*
+ * Host simulation stand-in for <util/delay.h>
+ *
+ * Busy waits take their CPU cycles in virtual time.
+ */
+#ifndef _SIM_UTIL_DELAY_H_
+#define _SIM_UTIL_DELAY_H_
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 1000000UL
+#endif
+
+void sim_delay_cycles(uint64_t cycles);
+
+#define _delay_us(us) sim_delay_cycles((uint64_t)((us) * (F_CPU / 1e6)))
+#define _delay_ms(ms) sim_delay_cycles((uint64_t)((ms) * (F_CPU / 1e3)))
+
+#endif
@@ -0,0 +1,1416 @@
+/*
+ * @file sim.c
+ * @brief Virtual clock, interrupt controller, timers, USART and EEPROM of
+ * the host simulation, and the command line that drives it.
+ *
+ * A peripheral stopped in PRR doesn't run: its timer doesn't count, and a
+ * wait on it is logged once as a driver bug. The time each PRR clock ran
+ * is reported at the end.
+ *
+ * A watchdog reset starts the firmware over from main() with its data and
+ * bss sections as at power on and its .noinit RAM as it was, the models
+ * of the devices around the chip carry on. The sim Makefile renames the
+ * firmware's data sections so they can be told apart from the models'.
+ */
+#define _GNU_SOURCE
+#include "sim.h"
+#include "log.h"
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* DEFINES */
+#define SIM_MAX_EVENTS 256
+// A button press holds the pin high this long
+#define SIM_BUTTON_PRESS SIM_SECONDS(0.05)
+// A wait on a register no model drives takes this long per check
+#define SIM_SPIN_CYCLES 16
+// EEPROM programming time of a byte
+#define SIM_EEPROM_WRITE_CYCLES SIM_SECONDS(0.0034)
+// Reserved bit 7 of the flag registers marks the value the simulation set,
+// see sim/include/avr/io.h
+#define SIM_FLAG_MARK 0x80
+#define SIM_UDR_EMPTY 0xFFFF
+#define SIM_UDR_RECEIVED 0x0100
+// Baud rate of the host end of the serial line
+#define SIM_BAUD 9600
+#define SIM_FEED_LOW 128
+#define SIM_FEED_MED 512
+#define SIM_FEED_HIGH 900
+// Watchdog oscillator
+#define SIM_WDT_HZ 128000
+
+/// @brief SimEventType is an enumeration of the scheduled inputs
+enum SimEventType
+{
+  SimButtonDown,
+  SimButtonUp,
+  SimSerial,
+  SimFeedSwitch,
+  SimSupply,
+  SimHang,
+  SimHub,
+  SimScale,
+  SimKibble
+};
+
+/// @brief An input applied at a point in virtual time
+struct sim_event_t
+{
+  uint64_t at;
+  enum SimEventType type;
+  const char *text;
+  uint16_t value;
+  uint16_t sag;
+  uint16_t order;
+};
+
+/// @brief An interrupt vector, in priority order
+struct sim_vector_t
+{
+  void (*handler)(void);
+  const char *name;
+  volatile uint8_t *flag_reg;
+  uint8_t flag;
+  volatile uint8_t *enable_reg;
+  uint8_t enable;
+};
+
+/// @brief A timer/counter and the registers that drive it
+struct sim_timer_t
+{
+  volatile uint8_t *tccra;
+  volatile uint8_t *tccrb;
+  volatile uint8_t *tcnt;
+  volatile uint8_t *ocra;
+  volatile uint8_t *ocrb;
+  volatile uint8_t *timsk;
+  volatile uint8_t *tifr;
+  uint8_t wide;
+  const uint16_t *prescalers;
+  // PRR bit that stops the timer
+  uint8_t power_bit;
+  // Clock cycles counted towards the next timer tick
+  uint64_t residue;
+};
+
+/* FIRMWARE */
+int firmware_main(void);
+
+#define SIM_VECTOR(vector) \
+  extern void vector(void) __attribute__((weak));
+SIM_VECTOR(INT0_vect)
+SIM_VECTOR(INT1_vect)
+SIM_VECTOR(PCINT1_vect)
+SIM_VECTOR(WDT_vect)
+SIM_VECTOR(TIMER2_COMPA_vect)
+SIM_VECTOR(TIMER2_COMPB_vect)
+SIM_VECTOR(TIMER2_OVF_vect)
+SIM_VECTOR(TIMER1_COMPA_vect)
+SIM_VECTOR(TIMER1_COMPB_vect)
+SIM_VECTOR(TIMER1_OVF_vect)
+SIM_VECTOR(TIMER0_COMPA_vect)
+SIM_VECTOR(TIMER0_COMPB_vect)
+SIM_VECTOR(TIMER0_OVF_vect)
+SIM_VECTOR(USART_RX_vect)
+SIM_VECTOR(ADC_vect)
+SIM_VECTOR(TWI_vect)
+
+// The EEMEM variables, their section is the EEPROM image
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+// The firmware's data and bss, see the sim Makefile
+extern uint8_t __start_sim_firmware_data[] __attribute__((weak));
+extern uint8_t __stop_sim_firmware_data[] __attribute__((weak));
+extern uint8_t __start_sim_firmware_bss[] __attribute__((weak));
+extern uint8_t __stop_sim_firmware_bss[] __attribute__((weak));
+
+/* PUBLIC GLOBALS */
+volatile uint8_t sim_io[0x100] __attribute__((aligned(2)));
+uint64_t sim_cycles;
+time_t sim_start_time;
+
+/* PRIVATE GLOBALS */
+static struct sim_event_t events[SIM_MAX_EVENTS];
+static uint16_t event_count;
+static uint16_t next_event;
+static uint64_t end_cycles;
+
+// Serial input still to be received
+static const char *serial_input;
+static uint64_t serial_input_at;
+
+// Serial output
+static FILE *capture_file;
+static const char *eeprom_file;
+static char serial_line[256];
+static uint16_t serial_line_len;
+static uint64_t serial_line_at;
+static uint32_t serial_lines;
+// Log frame being received, see log.h
+static uint8_t log_frame[4 + 255];
+static uint16_t log_frame_len;
+static uint32_t log_frames;
+static uint8_t quiet;
+
+static uint32_t eeprom_writes;
+static uint32_t wakeups;
+static uint32_t watchdog_resets;
+
+// Where a reset starts the firmware over, and its data as at power on
+static jmp_buf reset_point;
+static uint8_t *firmware_data_image;
+
+// Virtual time the watchdog counter was last cleared
+static uint64_t wdt_start;
+// WDIF, apart from WDTCSR since bit 7 is no flag mark there
+static volatile uint8_t wdt_flags;
+
+// Register of the peripheral that never completes a wait until reset
+static volatile uint8_t *hung_reg;
+// Virtual time spent at each system clock prescaler setting
+static uint64_t clock_cycles[9];
+// Virtual time each PRR bit was clear
+static uint64_t power_cycles[8];
+static const char *power_names[8] =
+{
+  "ADC", "USART0", "SPI", "TIMER1", 0, "TIMER0", "TIMER2", "TWI"
+};
+
+// Real value of each write one to clear flag register
+static uint8_t flag_regs[0x100];
+static const uint8_t flag_reg_addresses[] = {0x35, 0x36, 0x37, 0x3B, 0x3C};
+
+static const uint16_t timer01_prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const uint16_t timer2_prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+static struct sim_timer_t timers[] =
+{
+  {&TCCR0A, &TCCR0B, &TCNT0, &OCR0A, &OCR0B, &TIMSK0, &TIFR0, 0,
+    timer01_prescalers, PRTIM0, 0},
+  {&TCCR1A, &TCCR1B, (volatile uint8_t *)&TCNT1, (volatile uint8_t *)&OCR1A,
+    (volatile uint8_t *)&OCR1B, &TIMSK1, &TIFR1, 1, timer01_prescalers,
+    PRTIM1, 0},
+  {&TCCR2A, &TCCR2B, &TCNT2, &OCR2A, &OCR2B, &TIMSK2, &TIFR2, 0,
+    timer2_prescalers, PRTIM2, 0},
+};
+#define SIM_TIMERS (sizeof(timers) / sizeof(timers[0]))
+
+static const struct sim_vector_t vectors[] =
+{
+  {INT0_vect, "INT0", &EIFR, INTF0, &EIMSK, INT0},
+  {INT1_vect, "INT1", &EIFR, INTF1, &EIMSK, INT1},
+  {PCINT1_vect, "PCINT1", &PCIFR, PCIF1, &PCICR, PCIE1},
+  {WDT_vect, "WDT", &wdt_flags, WDIF, &WDTCSR, WDIE},
+  {TIMER2_COMPA_vect, "TIMER2_COMPA", &TIFR2, OCF2A, &TIMSK2, OCIE2A},
+  {TIMER2_COMPB_vect, "TIMER2_COMPB", &TIFR2, OCF2B, &TIMSK2, OCIE2B},
+  {TIMER2_OVF_vect, "TIMER2_OVF", &TIFR2, TOV2, &TIMSK2, TOIE2},
+  {TIMER1_COMPA_vect, "TIMER1_COMPA", &TIFR1, OCF1A, &TIMSK1, OCIE1A},
+  {TIMER1_COMPB_vect, "TIMER1_COMPB", &TIFR1, OCF1B, &TIMSK1, OCIE1B},
+  {TIMER1_OVF_vect, "TIMER1_OVF", &TIFR1, TOV1, &TIMSK1, TOIE1},
+  {TIMER0_COMPA_vect, "TIMER0_COMPA", &TIFR0, OCF0A, &TIMSK0, OCIE0A},
+  {TIMER0_COMPB_vect, "TIMER0_COMPB", &TIFR0, OCF0B, &TIMSK0, OCIE0B},
+  {TIMER0_OVF_vect, "TIMER0_OVF", &TIFR0, TOV0, &TIMSK0, TOIE0},
+  {USART_RX_vect, "USART_RX", &UCSR0A, RXC0, &UCSR0B, RXCIE0},
+  {ADC_vect, "ADC", &ADCSRA, ADIF, &ADCSRA, ADIE},
+  {TWI_vect, "TWI", &sim_twi_flags, TWINT, &TWCR, TWIE},
+};
+#define SIM_VECTORS (sizeof(vectors) / sizeof(vectors[0]))
+
+static void sim_finish(void);
+static void reset_registers(void);
+
+/* LOGGING */
+
+// Format the wall clock time at a virtual time
+static void format_time(uint64_t cycles, char *buffer, size_t size)
+{
+  time_t seconds = sim_start_time + (time_t)(cycles / F_CPU);
+  unsigned ms = (unsigned)((cycles % F_CPU) * 1000 / F_CPU);
+  struct tm wall;
+  gmtime_r(&seconds, &wall);
+  size_t len = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &wall);
+  snprintf(buffer + len, size - len, ".%03u", ms);
+}
+
+static void log_at(uint64_t cycles, const char *format, va_list args)
+{
+  char stamp[32];
+  format_time(cycles, stamp, sizeof(stamp));
+  printf("%s  ", stamp);
+  vprintf(format, args);
+  putchar('\n');
+}
+
+void sim_log(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  log_at(sim_cycles, format, args);
+  va_end(args);
+}
+
+static void log_serial_line(void)
+{
+  serial_line[serial_line_len] = '\0';
+  ++serial_lines;
+  if (!quiet)
+  {
+    char stamp[32];
+    format_time(serial_line_at, stamp, sizeof(stamp));
+    printf("%s  serial: %s\n", stamp, serial_line);
+  }
+  serial_line_len = 0;
+}
+
+// Print a log frame with its format, the arguments have the host sizes
+static void log_frame_decode(void)
+{
+  uint16_t id = log_frame[1] | (log_frame[2] << 8);
+  const char *format = __start_logfmt + id;
+  const uint8_t *arg = &log_frame[4];
+  const uint8_t *end = arg + log_frame[3];
+  char text[256];
+  size_t len = 0;
+  char level = *format++;
+  while (*format && len < sizeof(text) - 1)
+  {
+    if (*format != '%' || format[1] == '%')
+    {
+      text[len++] = *format;
+      format += (*format == '%') ? 2 : 1;
+      continue;
+    }
+    // Copy one conversion and print its argument with it
+    char spec[16];
+    size_t spec_len = 0;
+    uint8_t is_long = 0;
+    spec[spec_len++] = *format++;
+    while (*format && strchr("-+ #0123456789.l", *format)
+        && spec_len < sizeof(spec) - 2)
+    {
+      is_long |= (*format == 'l');
+      spec[spec_len++] = *format++;
+    }
+    char conversion = *format ? *format++ : 'd';
+    spec[spec_len++] = conversion;
+    spec[spec_len] = '\0';
+    size_t size = is_long ? sizeof(long) : sizeof(int);
+    if (arg + size > end)
+    {
+      len += snprintf(text + len, sizeof(text) - len, "<missing>");
+      break;
+    }
+    long value = 0;
+    memcpy(&value, arg, size);
+    arg += size;
+    if (is_long)
+      len += snprintf(text + len, sizeof(text) - len, spec, value);
+    else
+      len += snprintf(text + len, sizeof(text) - len, spec, (int)value);
+  }
+  text[len < sizeof(text) ? len : sizeof(text) - 1] = '\0';
+  ++log_frames;
+  if (!quiet)
+  {
+    char stamp[32];
+    format_time(sim_cycles, stamp, sizeof(stamp));
+    printf("%s  log: %c %s\n", stamp, level, text);
+  }
+}
+
+// Collect a byte of a log frame, returns 0 if it isn't part of one
+static uint8_t log_frame_byte(uint8_t c)
+{
+  if (log_frame_len == 0 && c != LOG_FRAME_MARK)
+    return 0;
+  log_frame[log_frame_len++] = c;
+  if (log_frame_len >= 4 && log_frame_len == 4 + log_frame[3])
+  {
+    log_frame_decode();
+    log_frame_len = 0;
+  }
+  return 1;
+}
+
+int sim_sprintf(char *buffer, const char *format, ...)
+{
+  char host_format[256];
+  size_t i = 0;
+  while (*format && i < sizeof(host_format) - 1)
+  {
+    char c = *format++;
+    host_format[i++] = c;
+    if (c != '%')
+      continue;
+    // Copy the flags, width and length up to the conversion
+    while (*format && strchr("-+ #0123456789.hlz", *format)
+        && i < sizeof(host_format) - 1)
+      host_format[i++] = *format++;
+    if (*format && i < sizeof(host_format) - 1)
+    {
+      c = *format++;
+      host_format[i++] = (c == 'S') ? 's' : c;
+    }
+  }
+  host_format[i] = '\0';
+
+  va_list args;
+  va_start(args, format);
+  int len = vsprintf(buffer, host_format, args);
+  va_end(args);
+  return len;
+}
+
+/* SYSTEM CLOCK */
+
+static uint8_t clock_select(void)
+{
+  uint8_t select = CLKPR & 0x0F;
+  return select > 8 ? 8 : select;
+}
+
+uint64_t sim_io_cycles(uint64_t clocks)
+{
+  return clocks << clock_select();
+}
+
+/* INTERRUPTS */
+
+// Take in the flags the firmware cleared by writing ones to a register
+static inline void sync_flag_reg(uint8_t address)
+{
+  if (!(sim_io[address] & SIM_FLAG_MARK))
+  {
+    flag_regs[address] &= ~sim_io[address];
+    sim_io[address] = flag_regs[address] | SIM_FLAG_MARK;
+  }
+}
+
+static void sync_flags(void)
+{
+  for (uint8_t i=0; i < sizeof(flag_reg_addresses); ++i)
+  {
+    sync_flag_reg(flag_reg_addresses[i]);
+  }
+}
+
+static uint8_t is_flag_reg(volatile uint8_t *reg)
+{
+  if (reg < sim_io || reg >= sim_io + sizeof(sim_io))
+    return 0;
+  return memchr(flag_reg_addresses, (int)(reg - sim_io),
+      sizeof(flag_reg_addresses)) != 0;
+}
+
+void sim_flag_set(volatile uint8_t *reg, uint8_t bit)
+{
+  uint8_t address = reg - sim_io;
+  sync_flag_reg(address);
+  flag_regs[address] |= (1 << bit);
+  sim_io[address] = flag_regs[address] | SIM_FLAG_MARK;
+}
+
+static void flag_clear(volatile uint8_t *reg, uint8_t bit)
+{
+  if (is_flag_reg(reg))
+  {
+    uint8_t address = reg - sim_io;
+    flag_regs[address] &= ~(1 << bit);
+    sim_io[address] = flag_regs[address] | SIM_FLAG_MARK;
+  }
+  else
+  {
+    *reg &= ~(1 << bit);
+  }
+}
+
+void sim_sei(void)
+{
+  sync_flags();
+  SREG |= 0x80;
+}
+
+void sim_cli(void)
+{
+  sync_flags();
+  SREG &= ~0x80;
+}
+
+void sim_external_interrupt(uint8_t n, uint8_t level)
+{
+  uint8_t pin_bit = (n == 0) ? (1 << PD2) : (1 << PD3);
+  uint8_t last = (PIND & pin_bit) != 0;
+  if (level)
+    PIND |= pin_bit;
+  else
+    PIND &= ~pin_bit;
+  if (last == level)
+    return;
+  uint8_t sense = (EICRA >> (2 * n)) & 0x03;
+  // A low level interrupt is taken as the falling edge
+  if ((sense == 0x01) || (sense == 0x03 && level) || (sense != 0x03 && !level))
+  {
+    sim_flag_set(&EIFR, n);
+  }
+}
+
+// Call every interrupt that is pending, returns the number called
+static uint16_t deliver_interrupts(void)
+{
+  uint16_t delivered = 0;
+  if (!(SREG & 0x80))
+    return 0;
+  sync_flags();
+  while (SREG & 0x80)
+  {
+    const struct sim_vector_t *vector = 0;
+    for (uint8_t i=0; i < SIM_VECTORS; ++i)
+    {
+      if ((*vectors[i].flag_reg & (1 << vectors[i].flag))
+          && (*vectors[i].enable_reg & (1 << vectors[i].enable)))
+      {
+        vector = &vectors[i];
+        break;
+      }
+    }
+    if (!vector)
+      break;
+
+    // The flag is cleared when the vector is taken
+    if (vector->flag_reg == &UCSR0A)
+    {
+      UCSR0A &= ~(1 << RXC0);
+    }
+    else if (vector->flag_reg == &wdt_flags)
+    {
+      // In interrupt and system reset mode the next timeout resets
+      wdt_flags = 0;
+      if (WDTCSR & (1 << WDE))
+        WDTCSR &= ~(1 << WDIE);
+    }
+    else
+    {
+      flag_clear(vector->flag_reg, vector->flag);
+    }
+    if (!vector->handler)
+    {
+      sim_log("sim: no handler for enabled interrupt %s", vector->name);
+      *vector->enable_reg &= ~(1 << vector->enable);
+      continue;
+    }
+    SREG &= ~0x80;
+    vector->handler();
+    sync_flags();
+    SREG |= 0x80;
+    // The receive interrupt has read the data register
+    if (vector->flag_reg == &UCSR0A && (UDR0 & 0xFF00) == SIM_UDR_RECEIVED)
+    {
+      UDR0 = SIM_UDR_EMPTY;
+    }
+    sim_motor_sample();
+    sim_led_sample();
+    sim_scale_sample();
+    ++delivered;
+  }
+  return delivered;
+}
+
+/* TIMERS */
+
+static uint16_t timer_read(const struct sim_timer_t *timer,
+    volatile uint8_t *reg)
+{
+  return timer->wide ? *(volatile uint16_t *)reg : *reg;
+}
+
+// Oscillator cycles per timer tick, 0 if the timer is stopped
+static uint32_t timer_prescaler(const struct sim_timer_t *timer)
+{
+  if (PRR & (1 << timer->power_bit))
+    return 0;
+  return sim_io_cycles(timer->prescalers[*timer->tccrb & 0x07]);
+}
+
+// Clear timer on compare match mode counts up to OCRxA, the other modes
+// are taken as the normal mode
+static uint8_t timer_ctc(const struct sim_timer_t *timer)
+{
+  if (timer->wide)
+    return (*timer->tccrb & ((1 << WGM13) | (1 << WGM12))) == (1 << WGM12);
+  return (*timer->tccra & 0x03) == (1 << WGM01)
+    && !(*timer->tccrb & (1 << WGM02));
+}
+
+static uint32_t timer_top(const struct sim_timer_t *timer)
+{
+  if (timer_ctc(timer))
+    return timer_read(timer, timer->ocra);
+  return timer->wide ? 0xFFFF : 0xFF;
+}
+
+// Timer ticks from count until the counter reaches target
+static uint32_t timer_distance(uint32_t count, uint32_t target, uint32_t top)
+{
+  uint32_t period = top + 1;
+  uint32_t distance = (target + period - (count % period)) % period;
+  return distance ? distance : period;
+}
+
+// Timer ticks until each of compare A, compare B and overflow
+static void timer_distances(const struct sim_timer_t *timer,
+    uint32_t distances[3])
+{
+  uint32_t top = timer_top(timer);
+  uint32_t count = timer_read(timer, timer->tcnt);
+  distances[0] = timer_distance(count, timer_read(timer, timer->ocra), top);
+  distances[1] = timer_distance(count, timer_read(timer, timer->ocrb), top);
+  // The counter only reaches MAX to overflow in normal mode
+  distances[2] = timer_ctc(timer) ? UINT32_MAX : timer_distance(count, 0, top);
+}
+
+// Virtual time of the next enabled timer interrupt
+static uint64_t timer_next(struct sim_timer_t *timer)
+{
+  uint32_t prescaler = timer_prescaler(timer);
+  uint8_t enabled = *timer->timsk & 0x07;
+  if (prescaler == 0 || enabled == 0)
+    return UINT64_MAX;
+  // The prescaler may have changed since the last tick
+  timer->residue %= prescaler;
+  uint32_t distances[3];
+  timer_distances(timer, distances);
+  // Flag bits: TOVn 0, OCFnA 1, OCFnB 2
+  uint32_t ticks = UINT32_MAX;
+  if ((enabled & 0x02) && distances[0] < ticks)
+    ticks = distances[0];
+  if ((enabled & 0x04) && distances[1] < ticks)
+    ticks = distances[1];
+  if ((enabled & 0x01) && distances[2] < ticks)
+    ticks = distances[2];
+  return sim_cycles + (uint64_t)ticks * prescaler - timer->residue;
+}
+
+static void timer_elapse(struct sim_timer_t *timer, uint64_t cycles)
+{
+  uint32_t prescaler = timer_prescaler(timer);
+  if (prescaler == 0)
+    return;
+  uint64_t total = timer->residue % prescaler + cycles;
+  uint64_t ticks = total / prescaler;
+  timer->residue = total % prescaler;
+  if (ticks == 0)
+    return;
+
+  uint32_t distances[3];
+  timer_distances(timer, distances);
+  if (distances[0] <= ticks)
+    sim_flag_set(timer->tifr, 1);
+  if (distances[1] <= ticks)
+    sim_flag_set(timer->tifr, 2);
+  if (distances[2] <= ticks)
+    sim_flag_set(timer->tifr, 0);
+
+  uint32_t period = timer_top(timer) + 1;
+  uint32_t count = (timer_read(timer, timer->tcnt) + ticks % period) % period;
+  if (timer->wide)
+    *(volatile uint16_t *)timer->tcnt = count;
+  else
+    *timer->tcnt = count;
+}
+
+/* WATCHDOG AND RESET */
+
+// Start the firmware over from main(), as the hardware does on a reset
+static void mcu_reset(uint8_t cause)
+{
+  // The reset flags add up until the firmware clears them, the pins are
+  // driven from outside the chip
+  uint8_t flags = MCUSR;
+  uint8_t pins = PIND;
+  memcpy(__start_sim_firmware_data, firmware_data_image,
+      __stop_sim_firmware_data - __start_sim_firmware_data);
+  memset(__start_sim_firmware_bss, 0,
+      __stop_sim_firmware_bss - __start_sim_firmware_bss);
+  memset((void *)sim_io, 0, sizeof(sim_io));
+  memset(flag_regs, 0, sizeof(flag_regs));
+  for (uint8_t i=0; i < SIM_TIMERS; ++i)
+    timers[i].residue = 0;
+  reset_registers();
+  MCUSR = flags | (1 << cause);
+  PIND = pins;
+  wdt_flags = 0;
+  hung_reg = 0;
+  // A log frame cut short is dropped
+  log_frame_len = 0;
+  sim_twi_reset();
+  longjmp(reset_point, 1);
+}
+
+// Oscillator cycles of a watchdog period
+static uint64_t wdt_timeout(void)
+{
+  uint8_t select = (WDTCSR & 0x07) | ((WDTCSR & (1 << WDP3)) ? 0x08 : 0);
+  return SIM_SECONDS((2048.0 * (1 << select)) / SIM_WDT_HZ);
+}
+
+void sim_wdt_reset(void)
+{
+  wdt_start = sim_cycles;
+}
+
+// Virtual time of the next watchdog timeout
+static uint64_t wdt_next(void)
+{
+  if (!(WDTCSR & ((1 << WDE) | (1 << WDIE))))
+  {
+    // Stopped, the counter starts from zero when enabled
+    wdt_start = sim_cycles;
+    return UINT64_MAX;
+  }
+  return wdt_start + wdt_timeout();
+}
+
+// Interrupt on a timeout, or reset if the interrupt is off or the last
+// one is still pending
+static void wdt_expire(void)
+{
+  wdt_start = sim_cycles;
+  if ((WDTCSR & (1 << WDIE)) && !(wdt_flags & (1 << WDIF)))
+  {
+    wdt_flags |= (1 << WDIF);
+    return;
+  }
+  if (WDTCSR & (1 << WDE))
+  {
+    ++watchdog_resets;
+    sim_log("sim: watchdog reset");
+    mcu_reset(WDRF);
+  }
+}
+
+/* USART */
+
+static void usart_output(uint8_t c)
+{
+  if (capture_file)
+    fputc(c, capture_file);
+  if (log_frame_byte(c))
+    return;
+  if (c == '\r')
+    return;
+  if (c == '\n')
+  {
+    log_serial_line();
+    return;
+  }
+  if (serial_line_len == 0)
+    serial_line_at = sim_cycles;
+  if (serial_line_len > sizeof(serial_line) - 5)
+    log_serial_line();
+  if (c >= 0x20 && c < 0x7F)
+    serial_line[serial_line_len++] = c;
+  else
+    serial_line_len += sprintf(serial_line + serial_line_len, "\\x%02x", c);
+}
+
+static uint64_t usart_char_cycles(void)
+{
+  uint16_t bit_cycles = (UCSR0A & (1 << U2X0)) ? 8 : 16;
+  return sim_io_cycles(10ULL * bit_cycles * (UBRR0 + 1));
+}
+
+// Complain once per setting when the baud rate is too far off for the
+// host end of the line to read
+static void usart_check_baud(void)
+{
+  static uint64_t last_setting;
+  uint64_t char_cycles = usart_char_cycles();
+  if (char_cycles == last_setting)
+    return;
+  last_setting = char_cycles;
+  double error = (double)F_CPU * 10 / char_cycles / SIM_BAUD - 1;
+  if (error > 0.02 || error < -0.02)
+    sim_log("sim: serial baud rate is %+.1f%% off %u", error * 100,
+        SIM_BAUD);
+}
+
+// Send the character written to UDR0, if there is one
+static uint8_t usart_transmit(void)
+{
+  if ((UDR0 & 0xFF00) != 0)
+    return 0;
+  uint8_t c = UDR0;
+  UDR0 = SIM_UDR_EMPTY;
+  if (UCSR0B & (1 << TXEN0))
+  {
+    usart_check_baud();
+    usart_output(c);
+  }
+  return 1;
+}
+
+// The transmit register empties once the last character has been sent
+static void usart_wait(void)
+{
+  if (usart_transmit())
+    sim_advance(usart_char_cycles());
+  UCSR0A |= (1 << UDRE0) | (1 << TXC0);
+}
+
+static void usart_receive(char c)
+{
+  // Output still in the data register goes out first
+  usart_transmit();
+  if (!(UCSR0B & (1 << RXEN0)))
+    return;
+  UDR0 = SIM_UDR_RECEIVED | (uint8_t)c;
+  UCSR0A |= (1 << RXC0);
+}
+
+/* VIRTUAL TIME */
+
+static uint8_t clock_io_running(uint8_t sleeping)
+{
+  // The I/O clock stops in the sleep modes deeper than ADC noise reduction
+  return !sleeping || (SMCR & 0x0C) == 0;
+}
+
+static uint64_t next_time(uint64_t until, uint8_t sleeping)
+{
+  uint64_t next = until < end_cycles ? until : end_cycles;
+  if (next_event < event_count && events[next_event].at < next)
+    next = events[next_event].at;
+  if (serial_input && serial_input_at < next)
+    next = serial_input_at;
+  uint64_t rtc = sim_rtc_next();
+  if (rtc < next)
+    next = rtc;
+  // The watchdog runs on its own oscillator
+  uint64_t wdt = wdt_next();
+  if (wdt < next)
+    next = wdt;
+  // The hub clocks the bus, an address match wakes the CPU from any sleep
+  uint64_t hub = sim_twi_hub_next();
+  if (hub < next)
+    next = hub;
+  uint64_t scale = sim_scale_next();
+  if (scale < next)
+    next = scale;
+  // The shared Timer0/Timer1 prescaler reset clears itself
+  if (GTCCR & (1 << PSRSYNC))
+  {
+    GTCCR &= ~(1 << PSRSYNC);
+    timers[0].residue = 0;
+    timers[1].residue = 0;
+  }
+  if (clock_io_running(sleeping))
+  {
+    for (uint8_t i=0; i < SIM_TIMERS; ++i)
+    {
+      uint64_t timer = timer_next(&timers[i]);
+      if (timer < next)
+        next = timer;
+    }
+    uint64_t adc = sim_adc_next();
+    if (adc < next)
+      next = adc;
+  }
+  return next;
+}
+
+static void apply_event(const struct sim_event_t *event)
+{
+  switch (event->type)
+  {
+    case SimButtonDown:
+      sim_log("sim: button pressed");
+      sim_external_interrupt(0, 1);
+      break;
+    case SimButtonUp:
+      sim_external_interrupt(0, 0);
+      break;
+    case SimSerial:
+      serial_input = event->text;
+      serial_input_at = sim_cycles;
+      break;
+    case SimFeedSwitch:
+      sim_log("sim: feed switch at %u", event->value);
+      sim_adc_set_input(0, event->value);
+      break;
+    case SimSupply:
+      sim_log("sim: supply at %u mV, %u mV under load", event->value,
+          event->value - event->sag);
+      sim_adc_set_supply(event->value, event->sag);
+      break;
+    case SimHang:
+      sim_log("sim: %s hangs until reset", event->text);
+      hung_reg = &sim_io[event->value];
+      break;
+    case SimHub:
+      sim_twi_hub_queue(event->text);
+      break;
+    case SimScale:
+      sim_log("sim: %.1f g in the bowl", event->value / 10.0);
+      sim_scale_set(event->value / 10.0);
+      break;
+    case SimKibble:
+      sim_log("sim: %.2f g of kibble per step", event->value / 1000.0);
+      sim_scale_set_flow(event->value / 1000.0);
+      break;
+  }
+}
+
+static void apply_events(uint8_t sleeping)
+{
+  if (clock_io_running(sleeping))
+  {
+    if (sim_adc_next() <= sim_cycles)
+      sim_adc_convert();
+  }
+  if (sim_rtc_next() <= sim_cycles)
+    sim_rtc_tick();
+  if (wdt_next() <= sim_cycles)
+    wdt_expire();
+  if (sim_twi_hub_next() <= sim_cycles)
+    sim_twi_hub_step();
+  if (sim_scale_next() <= sim_cycles)
+    sim_scale_convert();
+  while (next_event < event_count && events[next_event].at <= sim_cycles)
+    apply_event(&events[next_event++]);
+  if (serial_input && serial_input_at <= sim_cycles)
+  {
+    usart_receive(*serial_input++);
+    serial_input_at = sim_cycles + usart_char_cycles();
+    if (*serial_input == '\0')
+      serial_input = 0;
+  }
+}
+
+// Run virtual time up to until, or while sleeping only up to the first
+// interrupt
+static void run(uint64_t until, uint8_t sleeping)
+{
+  while (1)
+  {
+    if (deliver_interrupts() && sleeping)
+      return;
+    if (sim_cycles >= end_cycles)
+      sim_finish();
+    if (sim_cycles >= until)
+      return;
+
+    uint64_t next = next_time(until, sleeping);
+    clock_cycles[clock_select()] += next - sim_cycles;
+    for (uint8_t i=0; i < 8; ++i)
+    {
+      if (power_names[i] && !(PRR & (1 << i)))
+        power_cycles[i] += next - sim_cycles;
+    }
+    if (clock_io_running(sleeping))
+    {
+      for (uint8_t i=0; i < SIM_TIMERS; ++i)
+        timer_elapse(&timers[i], next - sim_cycles);
+    }
+    sim_cycles = next;
+    apply_events(sleeping);
+  }
+}
+
+void sim_advance(uint64_t cycles)
+{
+  run(sim_cycles + cycles, 0);
+}
+
+void sim_delay_cycles(uint64_t cycles)
+{
+  sim_advance(sim_io_cycles(cycles));
+  sim_motor_sample();
+  sim_led_sample();
+  sim_scale_sample();
+}
+
+// Complain once per peripheral about a wait on a stopped clock, the
+// hardware would hang
+static void power_check(uint8_t bit)
+{
+  static uint8_t reported;
+  if ((PRR & (1 << bit)) && !(reported & (1 << bit)))
+  {
+    reported |= (1 << bit);
+    sim_log("sim: %s used while stopped in PRR", power_names[bit]);
+  }
+}
+
+void sim_wait(volatile uint8_t *reg)
+{
+  sync_flags();
+  if (reg == &UCSR0A)
+    power_check(PRUSART0);
+  else if (reg == &TWCR)
+    power_check(PRTWI);
+  else if (reg == &ADCSRA)
+    power_check(PRADC);
+
+  if (reg == hung_reg)
+  {
+    // Never ready, the firmware spins until the watchdog steps in
+    if (reg == &UCSR0A)
+      UCSR0A &= ~(1 << UDRE0);
+    else if (reg == &TWCR)
+      TWCR &= ~(1 << TWINT);
+    sim_advance(sim_io_cycles(SIM_SPIN_CYCLES));
+  }
+  else if (reg == &UCSR0A)
+    usart_wait();
+  else if (reg == &TWCR)
+    sim_twi_wait();
+  else if (reg == &ADCSRA)
+    sim_adc_wait();
+  else
+    sim_advance(sim_io_cycles(SIM_SPIN_CYCLES));
+  sim_motor_sample();
+  sim_led_sample();
+  sim_scale_sample();
+}
+
+void sim_sleep(void)
+{
+  if (!(SMCR & (1 << SE)))
+    return;
+  // The last character written goes out while the CPU sleeps
+  usart_transmit();
+  sim_motor_sample();
+  sim_led_sample();
+  sim_scale_sample();
+  ++wakeups;
+  run(UINT64_MAX, 1);
+}
+
+/* EEPROM */
+
+static size_t eeprom_size(void)
+{
+  return __start_sim_eeprom ? __stop_sim_eeprom - __start_sim_eeprom : 0;
+}
+
+static void eeprom_open(void)
+{
+  memset(__start_sim_eeprom, 0xFF, eeprom_size());
+  if (eeprom_size() > E2END + 1)
+    fprintf(stderr, "sim: EEMEM uses %zu bytes, the device has %d\n",
+        eeprom_size(), E2END + 1);
+  if (!eeprom_file)
+    return;
+  FILE *file = fopen(eeprom_file, "rb");
+  if (!file)
+    return;
+  if (fread(__start_sim_eeprom, 1, eeprom_size(), file) != eeprom_size())
+    memset(__start_sim_eeprom, 0xFF, eeprom_size());
+  fclose(file);
+}
+
+static void eeprom_close(void)
+{
+  if (!eeprom_file)
+    return;
+  FILE *file = fopen(eeprom_file, "wb");
+  if (!file)
+  {
+    fprintf(stderr, "sim: can't write %s: %s\n", eeprom_file,
+        strerror(errno));
+    return;
+  }
+  fwrite(__start_sim_eeprom, 1, eeprom_size(), file);
+  fclose(file);
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address)
+{
+  return *address;
+}
+
+uint16_t eeprom_read_word(const uint16_t *address)
+{
+  uint16_t value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+
+uint32_t eeprom_read_dword(const uint32_t *address)
+{
+  uint32_t value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+
+void eeprom_read_block(void *destination, const void *source, size_t size)
+{
+  memcpy(destination, source, size);
+}
+
+void eeprom_write_byte(uint8_t *address, uint8_t value)
+{
+  sim_advance(SIM_EEPROM_WRITE_CYCLES);
+  ++eeprom_writes;
+  *address = value;
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+  if (*address != value)
+    eeprom_write_byte(address, value);
+}
+
+void eeprom_update_word(uint16_t *address, uint16_t value)
+{
+  eeprom_update_block(&value, address, sizeof(value));
+}
+
+void eeprom_update_dword(uint32_t *address, uint32_t value)
+{
+  eeprom_update_block(&value, address, sizeof(value));
+}
+
+void eeprom_write_block(const void *source, void *destination, size_t size)
+{
+  for (size_t i=0; i < size; ++i)
+    eeprom_write_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t size)
+{
+  for (size_t i=0; i < size; ++i)
+    eeprom_update_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+}
+
+/* COMMAND LINE */
+
+static struct timeval host_start;
+
+static void sim_finish(void)
+{
+  usart_transmit();
+  if (serial_line_len)
+    log_serial_line();
+  struct timeval host_end;
+  gettimeofday(&host_end, 0);
+  double host_seconds = (host_end.tv_sec - host_start.tv_sec)
+    + (host_end.tv_usec - host_start.tv_usec) / 1e6;
+  double virtual_seconds = (double)sim_cycles / F_CPU;
+
+  sim_log("sim: end");
+  printf("\nsimulated %.0f s (%.2f days) in %.2f s\n", virtual_seconds,
+      virtual_seconds / 86400, host_seconds);
+  sim_motor_summary();
+  sim_led_summary();
+  sim_scale_summary();
+  sim_rtc_summary();
+  printf("serial: %lu lines, %lu log frames\n", (unsigned long)serial_lines,
+      (unsigned long)log_frames);
+  printf("eeprom: %lu bytes written\n", (unsigned long)eeprom_writes);
+  printf("sleep: %lu wakeups\n", (unsigned long)wakeups);
+  if (watchdog_resets)
+    printf("watchdog: %lu resets\n", (unsigned long)watchdog_resets);
+  printf("clock:");
+  for (uint8_t i=0; i < 9; ++i)
+  {
+    if (clock_cycles[i])
+      printf(" %lu Hz %.1f%%", (unsigned long)(F_CPU >> i),
+          100.0 * clock_cycles[i] / sim_cycles);
+  }
+  printf("\n");
+  printf("power: clocked");
+  for (uint8_t i=0; i < 8; ++i)
+  {
+    if (power_names[i])
+      printf(" %s %.1f%%", power_names[i],
+          100.0 * power_cycles[i] / sim_cycles);
+  }
+  printf("\n");
+
+  eeprom_close();
+  if (capture_file)
+    fclose(capture_file);
+  fflush(stdout);
+  exit(0);
+}
+
+static void usage(const char *program)
+{
+  fprintf(stderr,
+      "usage: %s [options]\n"
+      "  --run TIME           length of the run (default 1d)\n"
+      "  --start DATE         RTC time at reset, \"YYYY-MM-DD HH:MM:SS\" UTC\n"
+      "  --button TIME        press the feed button\n"
+      "  --serial TIME:TEXT   send text to the serial port\n"
+      "  --mode [TIME:]MODE   set the feed switch to low, med or high\n"
+      "  --supply [TIME:]MV[/SAG]\n"
+      "                       set the supply in mV, and its drop while the\n"
+      "                       motor runs (default 3300/0)\n"
+      "  --hang TIME:DEVICE   make twi, serial or adc stop responding until\n"
+      "                       the next reset\n"
+      "  --hub TIME:rREG/LEN  read LEN registers from REG (hex) as the hub\n"
+      "  --hub TIME:wREG=BYTES\n"
+      "                       write hex bytes from REG as the hub\n"
+      "  --scale [TIME:]GRAMS put a load cell under the bowl, or set what\n"
+      "                       is in the bowl\n"
+      "  --kibble [TIME:]GRAMS\n"
+      "                       set the kibble per full step (default 1.2)\n"
+      "  --eeprom FILE        load and save the EEPROM image\n"
+      "  --capture FILE       write the raw serial output\n"
+      "  --quiet              don't log the serial output\n"
+      "TIME is seconds after reset, or a number with an s, m, h or d suffix\n",
+      program);
+  exit(2);
+}
+
+// Parse a time after reset, returns the text after it
+static const char *parse_time(const char *text, uint64_t *cycles)
+{
+  char *end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0)
+    return 0;
+  switch (*end)
+  {
+    case 'd': value *= 24;
+      /* fall through */
+    case 'h': value *= 60;
+      /* fall through */
+    case 'm': value *= 60;
+      /* fall through */
+    case 's': ++end;
+      break;
+    default:
+      break;
+  }
+  *cycles = SIM_SECONDS(value);
+  return end;
+}
+
+static struct sim_event_t *add_event(uint64_t at, enum SimEventType type)
+{
+  if (event_count == SIM_MAX_EVENTS)
+  {
+    fprintf(stderr, "sim: too many events\n");
+    exit(2);
+  }
+  struct sim_event_t *event = &events[event_count];
+  event->at = at;
+  event->type = type;
+  event->text = 0;
+  event->value = 0;
+  event->sag = 0;
+  event->order = event_count++;
+  return event;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+  const struct sim_event_t *event_a = a;
+  const struct sim_event_t *event_b = b;
+  if (event_a->at != event_b->at)
+    return event_a->at < event_b->at ? -1 : 1;
+  return (int)event_a->order - (int)event_b->order;
+}
+
+static uint16_t parse_mode(const char *text)
+{
+  if (strcmp(text, "low") == 0)
+    return SIM_FEED_LOW;
+  if (strcmp(text, "med") == 0)
+    return SIM_FEED_MED;
+  if (strcmp(text, "high") == 0)
+    return SIM_FEED_HIGH;
+  fprintf(stderr, "sim: unknown feed mode %s\n", text);
+  exit(2);
+}
+
+// Get the register a wait on a device is made on
+static uint16_t parse_hang(const char *text)
+{
+  if (strcmp(text, "twi") == 0)
+    return &TWCR - sim_io;
+  if (strcmp(text, "serial") == 0)
+    return &UCSR0A - sim_io;
+  if (strcmp(text, "adc") == 0)
+    return &ADCSRA - sim_io;
+  fprintf(stderr, "sim: unknown device %s\n", text);
+  exit(2);
+}
+
+static void parse_arguments(int argc, char **argv)
+{
+  end_cycles = SIM_SECONDS(86400);
+  // 2024-01-01 07:00:00
+  sim_start_time = 1704092400;
+  for (int i=1; i < argc; ++i)
+  {
+    const char *option = argv[i];
+    if (strcmp(option, "--quiet") == 0)
+    {
+      quiet = 1;
+      continue;
+    }
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    const char *value = argv[++i];
+    uint64_t at = 0;
+    const char *rest;
+    if (strcmp(option, "--run") == 0)
+    {
+      rest = parse_time(value, &end_cycles);
+      if (!rest || *rest)
+        usage(argv[0]);
+    }
+    else if (strcmp(option, "--start") == 0)
+    {
+      struct tm start = {0};
+      if (!strptime(value, "%Y-%m-%d %H:%M:%S", &start))
+        usage(argv[0]);
+      sim_start_time = timegm(&start);
+    }
+    else if (strcmp(option, "--button") == 0)
+    {
+      rest = parse_time(value, &at);
+      if (!rest || *rest)
+        usage(argv[0]);
+      add_event(at, SimButtonDown);
+      add_event(at + SIM_BUTTON_PRESS, SimButtonUp);
+    }
+    else if (strcmp(option, "--serial") == 0)
+    {
+      rest = parse_time(value, &at);
+      if (!rest || *rest != ':' || rest[1] == '\0')
+        usage(argv[0]);
+      add_event(at, SimSerial)->text = rest + 1;
+    }
+    else if (strcmp(option, "--mode") == 0)
+    {
+      const char *mode = value;
+      if (strchr(value, ':'))
+      {
+        rest = parse_time(value, &at);
+        if (!rest || *rest != ':')
+          usage(argv[0]);
+        mode = rest + 1;
+      }
+      add_event(at, SimFeedSwitch)->value = parse_mode(mode);
+    }
+    else if (strcmp(option, "--supply") == 0)
+    {
+      const char *supply = value;
+      if (strchr(value, ':'))
+      {
+        rest = parse_time(value, &at);
+        if (!rest || *rest != ':')
+          usage(argv[0]);
+        supply = rest + 1;
+      }
+      char *end;
+      struct sim_event_t *event = add_event(at, SimSupply);
+      event->value = strtoul(supply, &end, 10);
+      event->sag = (*end == '/') ? strtoul(end + 1, &end, 10) : 0;
+      if (*end || event->value == 0 || event->sag >= event->value)
+        usage(argv[0]);
+    }
+    else if (strcmp(option, "--hang") == 0)
+    {
+      rest = parse_time(value, &at);
+      if (!rest || *rest != ':')
+        usage(argv[0]);
+      struct sim_event_t *event = add_event(at, SimHang);
+      event->text = rest + 1;
+      event->value = parse_hang(rest + 1);
+    }
+    else if (strcmp(option, "--hub") == 0)
+    {
+      rest = parse_time(value, &at);
+      if (!rest || *rest != ':' || sim_twi_hub_check(rest + 1))
+        usage(argv[0]);
+      add_event(at, SimHub)->text = rest + 1;
+    }
+    else if (strcmp(option, "--scale") == 0 || strcmp(option, "--kibble") == 0)
+    {
+      const char *grams = value;
+      if (strchr(value, ':'))
+      {
+        rest = parse_time(value, &at);
+        if (!rest || *rest != ':')
+          usage(argv[0]);
+        grams = rest + 1;
+      }
+      char *end;
+      double weight = strtod(grams, &end);
+      if (end == grams || *end || weight < 0 || weight > 6000)
+        usage(argv[0]);
+      // Tenths of a gram in the bowl, milligrams per step
+      if (option[2] == 's')
+        add_event(at, SimScale)->value = (uint16_t)(weight * 10 + 0.5);
+      else
+        add_event(at, SimKibble)->value = (uint16_t)(weight * 1000 + 0.5);
+    }
+    else if (strcmp(option, "--eeprom") == 0)
+    {
+      eeprom_file = value;
+    }
+    else if (strcmp(option, "--capture") == 0)
+    {
+      capture_file = fopen(value, "wb");
+      if (!capture_file)
+      {
+        fprintf(stderr, "sim: can't write %s: %s\n", value, strerror(errno));
+        exit(2);
+      }
+    }
+    else
+    {
+      usage(argv[0]);
+    }
+  }
+  qsort(events, event_count, sizeof(events[0]), compare_events);
+}
+
+// Power on values of the registers the models rely on
+static void reset_registers(void)
+{
+  for (uint8_t i=0; i < sizeof(flag_reg_addresses); ++i)
+    sim_io[flag_reg_addresses[i]] = SIM_FLAG_MARK;
+  UCSR0A = (1 << UDRE0);
+  UDR0 = SIM_UDR_EMPTY;
+  TWBR = 0;
+  TWCR = 0;
+  TWSR = 0xF8;
+  TWAR = 0xFE;
+  PIND = 0;
+}
+
+int main(int argc, char **argv)
+{
+  parse_arguments(argc, argv);
+  gettimeofday(&host_start, 0);
+  reset_registers();
+  eeprom_open();
+  sim_adc_set_input(0, SIM_FEED_LOW);
+  sim_rtc_open();
+
+  // Power on reset
+  MCUSR = (1 << PORF);
+  size_t data_size = __stop_sim_firmware_data - __start_sim_firmware_data;
+  firmware_data_image = malloc(data_size);
+  memcpy(firmware_data_image, __start_sim_firmware_data, data_size);
+  setjmp(reset_point);
+
+  sim_log("sim: reset");
+  firmware_main();
+  sim_log("sim: firmware returned from main");
+  sim_finish();
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * @file sim.h
+ * @brief Virtual time host simulation of the cat feeder firmware.
+ *
+ * The firmware sources are built for the host against the stand-in AVR
+ * headers in sim/include. Its registers are a byte array that the
+ * peripheral models here read and update as virtual time advances. Time
+ * only moves while the firmware waits on a register, delays or sleeps, so
+ * weeks of schedule run in seconds.
+ */
+#ifndef _CAT_FEEDER_SIM_H_
+#define _CAT_FEEDER_SIM_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <avr/io.h>
+
+/// @brief Virtual time, oscillator cycles (F_CPU per second) since reset
+extern uint64_t sim_cycles;
+
+/// @brief Wall clock time of the reset, seconds since the unix epoch
+extern time_t sim_start_time;
+
+/// @brief Convert a time in seconds to oscillator cycles
+#define SIM_SECONDS(s) ((uint64_t)((s) * (double)F_CPU))
+
+/// @brief Let the CPU busy wait, interrupts are serviced as they come
+/// @param cycles is the number of oscillator cycles to wait
+void sim_advance(uint64_t cycles);
+
+/// @brief Convert CPU and I/O clock cycles to oscillator cycles at the
+/// current system clock prescaler (CLKPR)
+/// @param clocks is the number of CPU clock cycles
+/// @returns cycles - the number of oscillator cycles they take
+uint64_t sim_io_cycles(uint64_t clocks);
+
+/// @brief Print a line to the simulation log, stamped with the wall clock
+/// @param format is a printf format string
+void sim_log(const char *format, ...)
+  __attribute__((format(printf, 1, 2)));
+
+/// @brief Raise an interrupt flag in a write one to clear flag register
+/// @param reg is the flag register. ex: &EIFR
+/// @param bit is the bit number of the flag
+void sim_flag_set(volatile uint8_t *reg, uint8_t bit);
+
+/// @brief Drive an external interrupt pin, flags the edges EICRA selects
+/// @param n is the interrupt number, 0 for INT0 (PD2) and 1 for INT1 (PD3)
+/// @param level is the new pin level
+void sim_external_interrupt(uint8_t n, uint8_t level);
+
+/// @brief Printf for the firmware, avr-libc's %S is taken as %s
+/// @param buffer is the output buffer
+/// @param format is the format string
+/// @returns the number of characters written
+int sim_sprintf(char *buffer, const char *format, ...);
+
+/* TWI bus, sim_twi.c */
+
+/// @brief A slave device on the simulated TWI bus
+struct sim_twi_device_t
+{
+  uint8_t address;
+  // Addressed after a START, return 1 to acknowledge
+  uint8_t (*start)(uint8_t read);
+  // A data byte written by the master, return 1 to acknowledge
+  uint8_t (*write)(uint8_t data);
+  // The next data byte read by the master
+  uint8_t (*read)(void);
+  // The master sent a STOP
+  void (*stop)(void);
+};
+
+/// @brief Connect a slave device to the bus
+void sim_twi_attach(const struct sim_twi_device_t *device);
+
+/// @brief Carry out the bus operation the firmware started in TWCR
+void sim_twi_wait(void);
+
+/// @brief Drop the transfer in progress, the MCU was reset
+void sim_twi_reset(void);
+
+/// @brief TWINT of a hub slave event, the TWI interrupt flag
+extern volatile uint8_t sim_twi_flags;
+
+/// @brief Check a hub transfer, rREG/LEN or wREG=BYTES in hex
+/// @returns 0 if the transfer is valid, otherwise 1
+uint8_t sim_twi_hub_check(const char *text);
+
+/// @brief Queue a hub transfer, it starts once the bus is free
+/// @param text is a transfer sim_twi_hub_check() accepts
+void sim_twi_hub_queue(const char *text);
+
+/// @brief Get the virtual time of the next step of the hub
+uint64_t sim_twi_hub_next(void);
+
+/// @brief Take the next step of the hub transfer, called at
+/// sim_twi_hub_next()
+void sim_twi_hub_step(void);
+
+/* Real time clock, sim_rtc.c */
+
+/// @brief Connect the RTC to the bus, its clock starts at sim_start_time
+void sim_rtc_open(void);
+
+/// @brief Get the virtual time of the next RTC second
+uint64_t sim_rtc_next(void);
+
+/// @brief Advance the RTC by a second, called at sim_rtc_next()
+void sim_rtc_tick(void);
+
+/// @brief Print the alarms the firmware armed and any encoding errors
+void sim_rtc_summary(void);
+
+/* Analog inputs, sim_adc.c */
+
+/// @brief Set the conversion result of an ADC channel
+/// @param channel is the ADMUX channel number [0, 16)
+/// @param value is the 10 bit result
+void sim_adc_set_input(uint8_t channel, uint16_t value);
+
+/// @brief Set the supply voltage the bandgap channel is converted against
+/// @param millivolts is the supply voltage
+/// @param sag is the drop while the motor driver is enabled
+void sim_adc_set_supply(uint16_t millivolts, uint16_t sag);
+
+/// @brief Carry out the conversion the firmware started in ADCSRA
+void sim_adc_wait(void);
+
+/// @brief Get the virtual time of the next free running conversion
+uint64_t sim_adc_next(void);
+
+/// @brief Complete a free running conversion, called at sim_adc_next()
+void sim_adc_convert(void);
+
+/* Stepper driver, sim_motor.c */
+
+/// @brief Sample the driver pins, called after every interrupt and wait
+void sim_motor_sample(void);
+
+/// @brief Print the dispensing totals
+void sim_motor_summary(void);
+
+/// @brief Check whether the driver is enabled
+/// @returns 1 while the driver is enabled, otherwise 0
+uint8_t sim_motor_enabled(void);
+
+/* Load cell, sim_scale.c */
+
+/// @brief Put the load cell under bowl 0, or change what is in the bowl
+/// @param grams is the weight in the bowl
+void sim_scale_set(double grams);
+
+/// @brief Set the kibble the auger moves per full step
+/// @param grams is the mean weight per full step
+void sim_scale_set_flow(double grams);
+
+/// @brief Dispense kibble for motor steps, called by the motor model
+/// @param sixteenths is the distance turned in sixteenth steps
+void sim_scale_dispense(int32_t sixteenths);
+
+/// @brief Sample the PD_SCK pin, called with sim_motor_sample()
+void sim_scale_sample(void);
+
+/// @brief Get the virtual time of the next conversion
+uint64_t sim_scale_next(void);
+
+/// @brief Complete a conversion, called at sim_scale_next()
+void sim_scale_convert(void);
+
+/// @brief Print the dispensing totals of the load cell
+void sim_scale_summary(void);
+
+/* Status LED, sim_led.c */
+
+/// @brief Sample the LED pin, called with sim_motor_sample()
+void sim_led_sample(void);
+
+/// @brief Print the LED totals
+void sim_led_summary(void);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * @file sim_adc.c
+ * @brief ADC model of the host simulation.
+ *
+ * Each ADMUX channel reads a fixed value set with sim_adc_set_input(). The
+ * bandgap channel reads 1.1V against the supply set with
+ * sim_adc_set_supply(), which sags while the motor driver is enabled. A
+ * single conversion takes its 13 ADC clocks. Free running conversions are
+ * completed once per millisecond of virtual time instead of back to back,
+ * plenty for a switch turned by hand.
+ */
+#include "sim.h"
+
+/* DEFINES */
+#define SIM_ADC_CHANNELS 16
+#define SIM_ADC_FREE_RUNNING_PERIOD SIM_SECONDS(0.001)
+#define SIM_ADC_BANDGAP_CHANNEL 0x0E
+#define SIM_ADC_BANDGAP_MV 1100
+
+/* PRIVATE GLOBALS */
+static uint16_t inputs[SIM_ADC_CHANNELS];
+static uint64_t next_conversion = UINT64_MAX;
+static uint16_t supply_mv = 3300;
+static uint16_t sag_mv;
+
+void sim_adc_set_input(uint8_t channel, uint16_t value)
+{
+  inputs[channel % SIM_ADC_CHANNELS] = value & 0x3FF;
+}
+
+void sim_adc_set_supply(uint16_t millivolts, uint16_t sag)
+{
+  supply_mv = millivolts;
+  sag_mv = sag;
+}
+
+static uint64_t conversion_cycles(void)
+{
+  uint8_t prescaler = 1 << (ADCSRA & 0x07);
+  return sim_io_cycles(13UL * (prescaler < 2 ? 2 : prescaler));
+}
+
+static uint8_t free_running(void)
+{
+  return !(PRR & (1 << PRADC))
+    && (ADCSRA & (1 << ADEN)) && (ADCSRA & (1 << ADATE))
+    && (ADCSRA & (1 << ADSC)) && (ADCSRB & 0x07) == 0;
+}
+
+// Store the result of the selected channel and flag it
+static void complete(void)
+{
+  uint8_t channel = ADMUX & 0x0F;
+  if (channel == SIM_ADC_BANDGAP_CHANNEL)
+  {
+    uint32_t mv = supply_mv;
+    if (sim_motor_enabled())
+      mv = mv > sag_mv ? mv - sag_mv : 1;
+    uint32_t value = SIM_ADC_BANDGAP_MV * 1024UL / mv;
+    ADCW = value > 0x3FF ? 0x3FF : value;
+    ADCSRA |= (1 << ADIF);
+    return;
+  }
+  ADCW = inputs[channel];
+  ADCSRA |= (1 << ADIF);
+}
+
+void sim_adc_wait(void)
+{
+  if (!(ADCSRA & (1 << ADEN)) || !(ADCSRA & (1 << ADSC)) || free_running())
+  {
+    // Waiting on a conversion that was never started
+    sim_advance(conversion_cycles());
+    return;
+  }
+  sim_advance(conversion_cycles());
+  complete();
+  ADCSRA &= ~(1 << ADSC);
+}
+
+uint64_t sim_adc_next(void)
+{
+  if (!free_running())
+  {
+    next_conversion = UINT64_MAX;
+  }
+  else if (next_conversion == UINT64_MAX)
+  {
+    next_conversion = sim_cycles + SIM_ADC_FREE_RUNNING_PERIOD;
+  }
+  return next_conversion;
+}
+
+void sim_adc_convert(void)
+{
+  complete();
+  next_conversion = sim_cycles + SIM_ADC_FREE_RUNNING_PERIOD;
+}
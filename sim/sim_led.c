@@ -0,0 +1,51 @@
+/*
+ * @file sim_led.c
+ * @brief Status LED model of the host simulation.
+ *
+ * The LED pin is sampled with the driver pins. Each time the LED lights
+ * up counts as a flash, the patterns it plays are logged when they start.
+ */
+#include "sim.h"
+#include <stdio.h>
+
+/* DEFINES */
+// Pin map of main.c
+#define SIM_LED_PIN PB5
+// A dark gap longer than this ends a pattern
+#define SIM_LED_PATTERN_GAP SIM_SECONDS(5)
+
+/* PRIVATE GLOBALS */
+static uint8_t lit;
+static uint64_t lit_at;
+static uint64_t dark_at;
+static uint64_t on_cycles;
+static uint32_t flashes;
+static uint32_t patterns;
+
+void sim_led_sample(void)
+{
+  uint8_t level = (DDRB & (1 << SIM_LED_PIN)) && (PORTB & (1 << SIM_LED_PIN));
+  if (level && !lit)
+  {
+    if (flashes == 0 || sim_cycles - dark_at > SIM_LED_PATTERN_GAP)
+    {
+      ++patterns;
+      sim_log("led: pattern starts");
+    }
+    ++flashes;
+    lit_at = sim_cycles;
+  }
+  else if (!level && lit)
+  {
+    on_cycles += sim_cycles - lit_at;
+    dark_at = sim_cycles;
+  }
+  lit = level;
+}
+
+void sim_led_summary(void)
+{
+  uint64_t on = on_cycles + (lit ? sim_cycles - lit_at : 0);
+  printf("led: %lu patterns, %lu flashes, lit %.1f s\n",
+      (unsigned long)patterns, (unsigned long)flashes, (double)on / F_CPU);
+}
@@ -0,0 +1,163 @@
+/*
+ * @file sim_motor.c
+ * @brief Big Easy Driver model of the host simulation for bowl 0.
+ *
+ * The step, direction, microstep and enable pins are sampled after every
+ * interrupt and wait. Each time the driver is enabled and disabled again
+ * counts as one move, logged with its step pulses and the distance they
+ * turn the motor in sixteenth steps.
+ */
+#include "sim.h"
+#include <stdio.h>
+
+/* DEFINES */
+// Pin map of main.c
+#define SIM_STEP_PIN PB1
+#define SIM_DIR_PIN PB2
+#define SIM_MS1_PIN PD4
+#define SIM_ENABLE_PIN PD7
+
+/// @brief A move between enabling and disabling the driver
+struct sim_move_t
+{
+  uint64_t start;
+  uint32_t pulses;
+  int32_t distance;
+  // Bit n set when a step was taken at 1/2^n steps
+  uint8_t resolutions;
+};
+
+/* PRIVATE GLOBALS */
+static uint8_t enabled;
+static uint8_t step_level;
+static struct sim_move_t move;
+static uint32_t moves;
+static uint32_t stray_pulses;
+static uint64_t total_pulses;
+static int64_t total_distance;
+static uint64_t last_start;
+static uint64_t min_interval = UINT64_MAX;
+static uint64_t max_interval;
+
+// Sixteenth steps per step pulse for each MS3:MS2:MS1 setting, 0 if the
+// setting is invalid
+static const uint8_t step_size[8] = {16, 8, 4, 2, 0, 0, 0, 1};
+
+static void format_interval(uint64_t cycles, char *buffer, size_t size)
+{
+  unsigned long seconds = cycles / F_CPU;
+  snprintf(buffer, size, "%lud %02lu:%02lu:%02lu", seconds / 86400,
+      seconds / 3600 % 24, seconds / 60 % 60, seconds % 60);
+}
+
+static void start_move(void)
+{
+  move.start = sim_cycles;
+  move.pulses = 0;
+  move.distance = 0;
+  move.resolutions = 0;
+  if (moves > 0)
+  {
+    uint64_t interval = sim_cycles - last_start;
+    if (interval < min_interval)
+      min_interval = interval;
+    if (interval > max_interval)
+      max_interval = interval;
+  }
+  last_start = sim_cycles;
+}
+
+static void end_move(void)
+{
+  ++moves;
+  total_pulses += move.pulses;
+  total_distance += move.distance;
+
+  char resolutions[32] = "";
+  size_t len = 0;
+  for (uint8_t i=0; i < 5; ++i)
+  {
+    if (move.resolutions & (1 << i))
+      len += snprintf(resolutions + len, sizeof(resolutions) - len, "%s1/%u",
+          len ? "," : "", 1 << i);
+  }
+  sim_log("motor: move %lu, %lu pulses, %+ld/16 steps (%+.2f steps) at %s "
+      "in %.3f s", (unsigned long)moves, (unsigned long)move.pulses,
+      (long)move.distance, move.distance / 16.0,
+      len ? resolutions : "-", (double)(sim_cycles - move.start) / F_CPU);
+}
+
+static void step(void)
+{
+  if (!enabled)
+  {
+    ++stray_pulses;
+    return;
+  }
+  uint8_t ms = (PORTD >> SIM_MS1_PIN) & 0x07;
+  uint8_t size = step_size[ms];
+  if (size == 0)
+  {
+    sim_log("motor: step with invalid microstep setting %u", ms);
+    return;
+  }
+  ++move.pulses;
+  int8_t distance = (PORTB & (1 << SIM_DIR_PIN)) ? -size : size;
+  move.distance += distance;
+  sim_scale_dispense(distance);
+  // Log2 of the resolution
+  uint8_t resolution = 0;
+  while ((16 >> resolution) != size)
+    ++resolution;
+  move.resolutions |= (1 << resolution);
+}
+
+void sim_motor_sample(void)
+{
+  // The enable input is active low, an unconfigured pin leaves it off
+  uint8_t enable = (DDRD & (1 << SIM_ENABLE_PIN))
+    && !(PORTD & (1 << SIM_ENABLE_PIN));
+  uint8_t level = (DDRB & (1 << SIM_STEP_PIN))
+    && (PORTB & (1 << SIM_STEP_PIN));
+
+  if (enable && !enabled)
+  {
+    enabled = 1;
+    start_move();
+  }
+  if (level && !step_level)
+  {
+    step();
+  }
+  step_level = level;
+  if (!enable && enabled)
+  {
+    enabled = 0;
+    end_move();
+  }
+}
+
+uint8_t sim_motor_enabled(void)
+{
+  return enabled;
+}
+
+void sim_motor_summary(void)
+{
+  printf("motor: %lu moves, %llu pulses, %+lld/16 steps\n",
+      (unsigned long)moves, (unsigned long long)total_pulses,
+      (long long)total_distance);
+  if (moves > 1)
+  {
+    char min_text[32];
+    char max_text[32];
+    format_interval(min_interval, min_text, sizeof(min_text));
+    format_interval(max_interval, max_text, sizeof(max_text));
+    printf("motor: moves start %s to %s apart\n", min_text, max_text);
+  }
+  if (stray_pulses)
+  {
+    printf("motor: %lu step pulses while the driver was disabled\n",
+        (unsigned long)stray_pulses);
+  }
+}
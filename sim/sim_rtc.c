@@ -0,0 +1,296 @@
+/*
+ * @file sim_rtc.c
+ * @brief DS1307/DS3231 real time clock model of the host simulation.
+ *
+ * The clock counts from sim_start_time in virtual time. Built with
+ * RTC_DS3231 it models the DS3231 alarms and INT/SQW output, otherwise the
+ * DS1307 1Hz square wave. Either way the output drives INT1.
+ *
+ * The DS3231 model checks every alarm the firmware arms: the seconds,
+ * minutes and hours have to be valid BCD of a 24 hour time and matched,
+ * A1M4/A2M4 set so the unmodelled day/date is left out, and the alarm's
+ * flag cleared before it is armed. Anything else is logged and counted.
+ */
+#include "sim.h"
+#include "ds3231rtc.h"
+#include <stdio.h>
+#include <string.h>
+
+/* DEFINES */
+#ifdef RTC_DS3231
+#define SIM_RTC_REGISTERS 0x13
+#else
+#define SIM_RTC_REGISTERS 0x40
+#define DS1307_CONTROL_ADDRESS 0x07
+#define DS1307_SQWE 4
+#define DS1307_OUT 7
+#endif
+
+/* PRIVATE GLOBALS */
+static uint8_t registers[SIM_RTC_REGISTERS];
+static uint8_t pointer;
+static uint8_t pointer_written;
+static uint8_t time_written;
+// Seconds the clock was set away from the virtual clock
+static int64_t offset;
+static uint64_t next_second = F_CPU;
+#ifdef RTC_DS3231
+// Bit per alarm whose registers were written in the current transfer
+static uint8_t alarms_written;
+static unsigned long alarms_armed;
+static unsigned long alarms_fired;
+static unsigned long alarm_errors;
+#endif
+
+static time_t rtc_now(void)
+{
+  return sim_start_time + offset + (time_t)(sim_cycles / F_CPU);
+}
+
+static uint8_t bcd(uint8_t value)
+{
+  return ((value / 10) << 4) | (value % 10);
+}
+
+static uint8_t from_bcd(uint8_t value)
+{
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// Latch the time registers, as the clock does at a START
+static void latch_time(void)
+{
+  time_t now = rtc_now();
+  struct tm time;
+  gmtime_r(&now, &time);
+  registers[RTC_SEC_INDEX] = bcd(time.tm_sec);
+  registers[RTC_MIN_INDEX] = bcd(time.tm_min);
+  registers[RTC_HOUR_INDEX] = bcd(time.tm_hour);
+  registers[RTC_DOW_INDEX] = time.tm_wday + 1;
+  registers[RTC_DAY_INDEX] = bcd(time.tm_mday);
+  registers[RTC_MON_INDEX] = bcd(time.tm_mon + 1);
+  registers[RTC_YEAR_INDEX] = bcd(time.tm_year % 100);
+}
+
+// Set the clock from time registers written by the firmware
+static void set_time(void)
+{
+  struct tm time = {0};
+  time.tm_sec = from_bcd(registers[RTC_SEC_INDEX] & 0x7F);
+  time.tm_min = from_bcd(registers[RTC_MIN_INDEX]);
+  time.tm_hour = from_bcd(registers[RTC_HOUR_INDEX] & 0x3F);
+  time.tm_mday = from_bcd(registers[RTC_DAY_INDEX]);
+  time.tm_mon = from_bcd(registers[RTC_MON_INDEX] & 0x1F) - 1;
+  time.tm_year = from_bcd(registers[RTC_YEAR_INDEX]) + 100;
+  offset += (int64_t)timegm(&time) - rtc_now();
+  sim_log("sim: RTC set");
+}
+
+// Drive INT1 from the INT/SQW output
+static void update_output(void)
+{
+#ifdef RTC_DS3231
+  uint8_t control = registers[DS3231_CONTROL_ADDRESS];
+  uint8_t status = registers[DS3231_STATUS_ADDRESS];
+  uint8_t asserted = (control & (1 << DS3231_INTCN))
+    && (status & control & ((1 << DS3231_A1F) | (1 << DS3231_A2F)));
+  sim_external_interrupt(1, !asserted);
+#else
+  uint8_t control = registers[DS1307_CONTROL_ADDRESS];
+  if (!(control & (1 << DS1307_SQWE)))
+  {
+    sim_external_interrupt(1, (control >> DS1307_OUT) & 1);
+  }
+#endif
+}
+
+#ifdef RTC_DS3231
+// Check a seconds, minutes or hours alarm register, returns its value
+static int alarm_field(uint8_t alarm, uint8_t limit)
+{
+  // Matched (mask bit clear), valid BCD, 24 hour mode for the hours
+  if ((alarm & 0xC0) || (alarm & 0x0F) > 9 || from_bcd(alarm) >= limit)
+    return -1;
+  return from_bcd(alarm);
+}
+
+// Check the encoding of the alarms written in the last transfer
+static void check_armed(void)
+{
+  for (uint8_t n=0; n < 2; ++n)
+  {
+    if (!(alarms_written & (1 << n)))
+      continue;
+    const uint8_t *alarm = &registers[n == 0 ? DS3231_ALARM1_ADDRESS
+      : DS3231_ALARM2_ADDRESS];
+    int sec = 0;
+    if (n == 0)
+      sec = alarm_field(*alarm++, 60);
+    int min = alarm_field(alarm[0], 60);
+    int hour = alarm_field(alarm[1], 24);
+    uint8_t day_masked = alarm[2] & 0x80;
+    ++alarms_armed;
+    if (sec < 0 || min < 0 || hour < 0 || !day_masked)
+    {
+      ++alarm_errors;
+      sim_log("sim: DS3231 alarm %u badly encoded: %02x %02x %02x%s", n + 1,
+          alarm[0], alarm[1], alarm[2], day_masked ? "" : ", A?M4 clear");
+    }
+    else
+    {
+      sim_log("sim: DS3231 alarm %u at %02d:%02d:%02d", n + 1, hour, min,
+          sec);
+    }
+    if (registers[DS3231_STATUS_ADDRESS] & (1 << (DS3231_A1F + n)))
+    {
+      ++alarm_errors;
+      sim_log("sim: DS3231 alarm %u armed with its flag still raised", n + 1);
+    }
+  }
+  alarms_written = 0;
+}
+
+static uint8_t alarm_field_matches(uint8_t alarm, uint8_t value)
+{
+  return (alarm & 0x80) || (alarm & 0x7F) == value;
+}
+
+// Raise the alarm flags that match the current time
+static void check_alarms(void)
+{
+  const uint8_t *alarm1 = &registers[DS3231_ALARM1_ADDRESS];
+  const uint8_t *alarm2 = &registers[DS3231_ALARM2_ADDRESS];
+  uint8_t *status = &registers[DS3231_STATUS_ADDRESS];
+  uint8_t raised = *status;
+  latch_time();
+  // The date/day registers aren't modelled, they must be masked
+  if (alarm_field_matches(alarm1[0], registers[RTC_SEC_INDEX])
+      && alarm_field_matches(alarm1[1], registers[RTC_MIN_INDEX])
+      && alarm_field_matches(alarm1[2] & 0xBF, registers[RTC_HOUR_INDEX])
+      && (alarm1[3] & 0x80))
+  {
+    *status |= (1 << DS3231_A1F);
+  }
+  if (registers[RTC_SEC_INDEX] == 0
+      && alarm_field_matches(alarm2[0], registers[RTC_MIN_INDEX])
+      && alarm_field_matches(alarm2[1] & 0xBF, registers[RTC_HOUR_INDEX])
+      && (alarm2[2] & 0x80))
+  {
+    *status |= (1 << DS3231_A2F);
+  }
+  if ((*status & ~raised) & ((1 << DS3231_A1F) | (1 << DS3231_A2F)))
+    ++alarms_fired;
+}
+#endif
+
+static uint8_t rtc_start(uint8_t read)
+{
+  if (read)
+  {
+    latch_time();
+  }
+  pointer_written = read;
+  return 1;
+}
+
+static uint8_t rtc_write(uint8_t data)
+{
+  if (!pointer_written)
+  {
+    pointer = data % SIM_RTC_REGISTERS;
+    pointer_written = 1;
+    return 1;
+  }
+#ifdef RTC_DS3231
+  // Status flags are only cleared by writing zeros
+  if (pointer == DS3231_STATUS_ADDRESS)
+  {
+    uint8_t flags = (1 << DS3231_OSF) | (1 << DS3231_A1F) | (1 << DS3231_A2F);
+    data = (data & ~flags) | (data & registers[pointer] & flags);
+  }
+  if (pointer >= DS3231_ALARM1_ADDRESS && pointer < DS3231_ALARM2_ADDRESS)
+    alarms_written |= 1;
+  else if (pointer >= DS3231_ALARM2_ADDRESS
+      && pointer < DS3231_CONTROL_ADDRESS)
+    alarms_written |= 2;
+#endif
+  if (pointer <= RTC_YEAR_INDEX && !time_written)
+  {
+    latch_time();
+    time_written = 1;
+  }
+  registers[pointer] = data;
+  pointer = (pointer + 1) % SIM_RTC_REGISTERS;
+  return 1;
+}
+
+static uint8_t rtc_read_byte(void)
+{
+  uint8_t data = registers[pointer];
+  pointer = (pointer + 1) % SIM_RTC_REGISTERS;
+  return data;
+}
+
+static void rtc_stop(void)
+{
+  if (time_written)
+  {
+    set_time();
+    time_written = 0;
+  }
+#ifdef RTC_DS3231
+  check_armed();
+#endif
+  update_output();
+}
+
+static const struct sim_twi_device_t rtc_device =
+{
+  RTC_ADDRESS, rtc_start, rtc_write, rtc_read_byte, rtc_stop
+};
+
+void sim_rtc_open(void)
+{
+  memset(registers, 0, sizeof(registers));
+#ifdef RTC_DS3231
+  // Power on state: interrupt output, oscillator stop flag and 32kHz output
+  registers[DS3231_CONTROL_ADDRESS] = 0x1C;
+  registers[DS3231_STATUS_ADDRESS] = 0x88;
+#else
+  registers[DS1307_CONTROL_ADDRESS] = 0x03;
+#endif
+  sim_twi_attach(&rtc_device);
+  // The output is open drain, high until the clock pulls it low
+  sim_external_interrupt(1, 1);
+}
+
+uint64_t sim_rtc_next(void)
+{
+  return next_second;
+}
+
+void sim_rtc_tick(void)
+{
+  next_second += F_CPU;
+#ifdef RTC_DS3231
+  check_alarms();
+  update_output();
+#else
+  uint8_t control = registers[DS1307_CONTROL_ADDRESS];
+  if (control & (1 << DS1307_SQWE))
+  {
+    // The 1Hz square wave falls as the seconds count, faster rates
+    // aren't modelled
+    sim_external_interrupt(1, 0);
+    sim_external_interrupt(1, 1);
+  }
+#endif
+}
+
+void sim_rtc_summary(void)
+{
+#ifdef RTC_DS3231
+  printf("rtc: %lu alarms armed, %lu fired, %lu errors\n", alarms_armed,
+      alarms_fired, alarm_errors);
+#endif
+}
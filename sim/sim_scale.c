@@ -0,0 +1,203 @@
+/*
+ * @file sim_scale.c
+ * @brief HX711 load cell model of the host simulation for bowl 0.
+ *
+ * The load cell only exists once sim_scale_set() has put something on it,
+ * until then DOUT floats on its pull up. Kibble dispensed by forward steps
+ * of the motor takes a while to land in the bowl, modelled as a first
+ * order lag, and each step carries a slightly different amount. While
+ * PD_SCK is low a conversion completes SIM_SCALE_RATE_HZ times a second
+ * and pulls DOUT low, the firmware's PD_SCK pulses are sampled after every
+ * interrupt and wait to shift it out. PD_SCK held high for 60us powers the
+ * converter down.
+ */
+#include "sim.h"
+#include <math.h>
+#include <stdio.h>
+
+/* DEFINES */
+// Pin map of hx711.h
+#define SIM_SCALE_DOUT_PIN PC1
+#define SIM_SCALE_SCK_PIN PC2
+#define SIM_SCALE_RATE_HZ 80
+#define SIM_SCALE_SETTLE SIM_SECONDS(0.05)
+#define SIM_SCALE_POWER_DOWN SIM_SECONDS(60e-6)
+// Reading of the empty bowl and counts per gram of the load cell
+#define SIM_SCALE_OFFSET 84000
+#define SIM_SCALE_COUNTS_PER_G 420.0
+// Peak to peak noise of a reading, in counts
+#define SIM_SCALE_NOISE 40
+// Time constant of the kibble landing in the bowl
+#define SIM_SCALE_FALL_S 0.08
+
+/* PRIVATE GLOBALS */
+static uint8_t attached;
+static double bowl_g;
+static double falling_g;
+static uint64_t fall_at;
+static double dispensed_g;
+// Kibble per full step of the auger
+static double flow_g = 1.2;
+static uint32_t random_state = 1;
+
+static uint8_t powered;
+static uint8_t sck_level;
+static uint64_t sck_high_at;
+static uint64_t next_conversion = UINT64_MAX;
+// Conversion waiting to be shifted out
+static uint32_t data;
+static uint8_t ready;
+static uint8_t bits_out;
+
+// Deterministic noise in [0, 1), runs repeat exactly
+static double random_unit(void)
+{
+  random_state = random_state * 1103515245u + 12345u;
+  return ((random_state >> 8) & 0xFFFF) / 65536.0;
+}
+
+// Move what has landed since the last call into the bowl
+static void land(void)
+{
+  double dt = (double)(sim_cycles - fall_at) / F_CPU;
+  double landed = falling_g * (1.0 - exp(-dt / SIM_SCALE_FALL_S));
+  falling_g -= landed;
+  bowl_g += landed;
+  fall_at = sim_cycles;
+}
+
+// Drive DOUT, flagging the pin change interrupt on a change
+static void drive_dout(uint8_t level)
+{
+  uint8_t mask = (1 << SIM_SCALE_DOUT_PIN);
+  uint8_t last = (PINC & mask) != 0;
+  if (level)
+    PINC |= mask;
+  else
+    PINC &= ~mask;
+  if (last != level && (PCMSK1 & mask))
+    sim_flag_set(&PCIFR, PCIF1);
+}
+
+static void power_up(void)
+{
+  powered = 1;
+  ready = 0;
+  bits_out = 0;
+  next_conversion = sim_cycles + SIM_SCALE_SETTLE;
+}
+
+static void power_down(void)
+{
+  powered = 0;
+  ready = 0;
+  next_conversion = UINT64_MAX;
+  drive_dout(1);
+}
+
+void sim_scale_set(double grams)
+{
+  if (!attached)
+  {
+    attached = 1;
+    // PD_SCK starts low, the converter powers up with the supply
+    power_up();
+  }
+  land();
+  bowl_g = grams;
+  falling_g = 0;
+}
+
+void sim_scale_set_flow(double grams)
+{
+  flow_g = grams;
+}
+
+void sim_scale_dispense(int32_t sixteenths)
+{
+  if (sixteenths <= 0)
+    return;
+  land();
+  double grams = sixteenths * flow_g / 16.0 * (0.8 + 0.4 * random_unit());
+  falling_g += grams;
+  dispensed_g += grams;
+}
+
+uint64_t sim_scale_next(void)
+{
+  if (powered && sck_level && sck_high_at + SIM_SCALE_POWER_DOWN < next_conversion)
+    return sck_high_at + SIM_SCALE_POWER_DOWN;
+  return next_conversion;
+}
+
+void sim_scale_convert(void)
+{
+  if (powered && sck_level && sim_cycles >= sck_high_at + SIM_SCALE_POWER_DOWN)
+  {
+    power_down();
+    return;
+  }
+  land();
+  double counts = SIM_SCALE_OFFSET + bowl_g * SIM_SCALE_COUNTS_PER_G
+    + (random_unit() - 0.5) * SIM_SCALE_NOISE;
+  data = (uint32_t)(int32_t)lround(counts) & 0xFFFFFF;
+  // A conversion that wasn't read is overwritten
+  ready = 1;
+  bits_out = 0;
+  drive_dout(0);
+  next_conversion = sim_cycles + F_CPU / SIM_SCALE_RATE_HZ;
+}
+
+void sim_scale_sample(void)
+{
+  if (!attached)
+  {
+    // Nothing drives DOUT, the pull up does if it is enabled
+    uint8_t mask = (1 << SIM_SCALE_DOUT_PIN);
+    if (PORTC & mask)
+      PINC |= mask;
+    else
+      PINC &= ~mask;
+    return;
+  }
+  uint8_t level = (DDRC & (1 << SIM_SCALE_SCK_PIN))
+    && (PORTC & (1 << SIM_SCALE_SCK_PIN));
+  if (level == sck_level)
+  {
+    if (level && powered && sim_cycles >= sck_high_at + SIM_SCALE_POWER_DOWN)
+      power_down();
+    return;
+  }
+  sck_level = level;
+  if (level)
+  {
+    sck_high_at = sim_cycles;
+    if (!powered || !ready)
+      return;
+    // Each rising edge shifts out the next bit, MSB first. The 25th
+    // selects channel A at gain 128 and ends the read.
+    if (bits_out < 24)
+    {
+      drive_dout((data >> (23 - bits_out)) & 1);
+      ++bits_out;
+    }
+    else
+    {
+      ready = 0;
+      bits_out = 0;
+      drive_dout(1);
+    }
+    return;
+  }
+  if (!powered)
+    power_up();
+}
+
+void sim_scale_summary(void)
+{
+  if (!attached)
+    return;
+  land();
+  printf("scale: %.1f g dispensed, %.1f g in the bowl\n",
+      dispensed_g, bowl_g + falling_g);
+}
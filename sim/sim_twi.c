@@ -0,0 +1,395 @@
+/*
+ * @file sim_twi.c
+ * @brief TWI model of the host simulation.
+ *
+ * The firmware starts a bus operation by writing TWCR and waits for TWINT,
+ * or for TWSTO to clear after a STOP. The operation is carried out with the
+ * attached slave devices when the firmware waits, and takes the bus time
+ * of its bits.
+ *
+ * A hub stands in for another master on the bus, addressing the firmware
+ * as a slave at SIM_HUB_ADDRESS. Each slave event raises TWINT for the TWI
+ * interrupt, and the hub holds the bus until the firmware answers it by
+ * writing TWCR. The hub only starts while the firmware's own master is
+ * idle, there is no arbitration.
+ */
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <util/twi.h>
+
+/* DEFINES */
+#define SIM_TWI_MAX_DEVICES 4
+// Reserved TWCR bit 1 marks an operation the simulation has completed
+#define SIM_TWCR_DONE 0x02
+#define SIM_HUB_ADDRESS 0x30
+#define SIM_HUB_SCL_HZ 50000
+#define SIM_HUB_QUEUE 16
+#define SIM_HUB_MAX_BYTES 64
+
+/// @brief SimTwiState is an enumeration of the master's bus states
+enum SimTwiState
+{
+  TwiIdle,
+  TwiStarted,
+  TwiTransmit,
+  TwiReceive,
+  TwiNotAcknowledged
+};
+
+/// @brief SimHubPhase is an enumeration of the steps of a hub transfer,
+/// each is taken once the firmware has answered the one before
+enum SimHubPhase
+{
+  HubIdle,
+  HubPointer,
+  HubWriteData,
+  HubRestart,
+  HubAddressRead,
+  HubReadData,
+  HubDone
+};
+
+/// @brief A read or write of the hub
+struct sim_hub_transfer_t
+{
+  uint8_t read;
+  uint8_t reg;
+  uint8_t len;
+  uint8_t data[SIM_HUB_MAX_BYTES];
+};
+
+/* PUBLIC GLOBALS */
+volatile uint8_t sim_twi_flags;
+
+/* PRIVATE GLOBALS */
+static const struct sim_twi_device_t *devices[SIM_TWI_MAX_DEVICES];
+static uint8_t device_count;
+static const struct sim_twi_device_t *selected;
+static enum SimTwiState state;
+
+// Hub transfers queued, the first is under way
+static struct sim_hub_transfer_t hub_queue[SIM_HUB_QUEUE];
+static uint8_t hub_first;
+static uint8_t hub_count;
+static enum SimHubPhase hub_phase;
+static uint64_t hub_next = UINT64_MAX;
+// Waiting for the firmware to answer a slave event
+static uint8_t hub_waiting;
+// The firmware acknowledged the last byte, or will the next one
+static uint8_t hub_ack;
+static uint8_t hub_pos;
+static uint8_t hub_refused;
+
+void sim_twi_attach(const struct sim_twi_device_t *device)
+{
+  if (device_count < SIM_TWI_MAX_DEVICES)
+  {
+    devices[device_count++] = device;
+  }
+}
+
+// Oscillator cycles of an SCL period
+static uint64_t bit_cycles(void)
+{
+  static const uint8_t prescalers[4] = {1, 4, 16, 64};
+  return sim_io_cycles(16 + 2UL * TWBR * prescalers[TWSR & 0x03]);
+}
+
+// Oscillator cycles of an SCL period of the hub
+static uint64_t hub_bit_cycles(void)
+{
+  return SIM_SECONDS(1.0 / SIM_HUB_SCL_HZ);
+}
+
+static void end_transfer(void)
+{
+  if (selected && selected->stop)
+    selected->stop();
+  selected = 0;
+}
+
+static uint8_t address_slave(uint8_t sla)
+{
+  uint8_t read = sla & TW_READ;
+  end_transfer();
+  for (uint8_t i=0; i < device_count; ++i)
+  {
+    if (devices[i]->address == (sla >> 1) && devices[i]->start(read))
+    {
+      selected = devices[i];
+      state = read ? TwiReceive : TwiTransmit;
+      return read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+    }
+  }
+  state = TwiNotAcknowledged;
+  return read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+}
+
+void sim_twi_reset(void)
+{
+  // The slave is left waiting for a STOP that never comes, the next START
+  // addresses it again
+  selected = 0;
+  state = TwiIdle;
+  sim_twi_flags = 0;
+  if (hub_phase != HubIdle)
+  {
+    sim_log("hub: transfer cut short by the reset");
+    hub_phase = HubIdle;
+    hub_waiting = 0;
+    hub_first = (hub_first + 1) % SIM_HUB_QUEUE;
+    --hub_count;
+    hub_next = hub_count ? sim_cycles + 10 * hub_bit_cycles() : UINT64_MAX;
+  }
+}
+
+void sim_twi_wait(void)
+{
+  uint8_t control = TWCR;
+  if (control & SIM_TWCR_DONE)
+  {
+    return;
+  }
+  if (!(control & (1 << TWEN)) ||
+      !(control & ((1 << TWINT) | (1 << TWSTO))))
+  {
+    // The hardware would hang here
+    sim_log("sim: TWI wait with nothing started, TWCR 0x%02x", control);
+    TWCR = control | (1 << TWINT) | SIM_TWCR_DONE;
+    return;
+  }
+
+  if (control & (1 << TWSTO))
+  {
+    sim_advance(bit_cycles());
+    end_transfer();
+    state = TwiIdle;
+    TWSR = (TWSR & 0x03) | TW_NO_INFO;
+    TWCR = (control & ~((1 << TWINT) | (1 << TWSTO))) | SIM_TWCR_DONE;
+    return;
+  }
+
+  uint8_t status;
+  if (control & (1 << TWSTA))
+  {
+    sim_advance(bit_cycles());
+    status = (state == TwiIdle) ? TW_START : TW_REP_START;
+    state = TwiStarted;
+  }
+  else
+  {
+    // Eight data bits and the acknowledge
+    sim_advance(9 * bit_cycles());
+    switch (state)
+    {
+      case TwiStarted:
+        status = address_slave(TWDR);
+        break;
+      case TwiTransmit:
+        status = (selected->write && selected->write(TWDR)) ?
+          TW_MT_DATA_ACK : TW_MT_DATA_NACK;
+        break;
+      case TwiReceive:
+        TWDR = selected->read ? selected->read() : 0xFF;
+        status = (control & (1 << TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+        break;
+      default:
+        status = TW_BUS_ERROR;
+        break;
+    }
+  }
+  TWSR = (TWSR & 0x03) | status;
+  TWCR = control | (1 << TWINT) | SIM_TWCR_DONE;
+}
+
+/* HUB */
+
+static uint8_t hub_parse(const char *text, struct sim_hub_transfer_t *transfer)
+{
+  char *end;
+  transfer->read = (text[0] == 'r');
+  if (text[0] != 'r' && text[0] != 'w')
+    return 1;
+  unsigned long reg = strtoul(text + 1, &end, 16);
+  if (end == text + 1 || reg > 0xFF)
+    return 1;
+  transfer->reg = reg;
+  if (transfer->read)
+  {
+    if (*end != '/')
+      return 1;
+    const char *len = end + 1;
+    unsigned long count = strtoul(len, &end, 10);
+    if (end == len || *end || count == 0 || count > SIM_HUB_MAX_BYTES)
+      return 1;
+    transfer->len = count;
+    return 0;
+  }
+  if (*end != '=')
+    return 1;
+  transfer->len = 0;
+  for (const char *hex = end + 1; *hex; hex += 2)
+  {
+    unsigned value;
+    if (transfer->len == SIM_HUB_MAX_BYTES || !hex[1]
+        || sscanf(hex, "%2x", &value) != 1)
+      return 1;
+    transfer->data[transfer->len++] = value;
+  }
+  return transfer->len == 0;
+}
+
+uint8_t sim_twi_hub_check(const char *text)
+{
+  struct sim_hub_transfer_t transfer;
+  return hub_parse(text, &transfer);
+}
+
+void sim_twi_hub_queue(const char *text)
+{
+  if (hub_count == SIM_HUB_QUEUE)
+  {
+    sim_log("hub: queue full, %s dropped", text);
+    return;
+  }
+  hub_parse(text, &hub_queue[(hub_first + hub_count) % SIM_HUB_QUEUE]);
+  // The START and the address
+  if (hub_count++ == 0)
+    hub_next = sim_cycles + 10 * hub_bit_cycles();
+}
+
+// Hand a slave event to the firmware's TWI interrupt
+static void hub_raise(uint8_t status)
+{
+  TWSR = (TWSR & 0x03) | status;
+  TWCR |= (1 << TWINT) | SIM_TWCR_DONE;
+  sim_twi_flags |= (1 << TWINT);
+  hub_waiting = 1;
+  hub_next = UINT64_MAX;
+}
+
+// The slave acknowledges its address if it is enabled to
+static uint8_t hub_addressed(void)
+{
+  uint8_t control = TWCR;
+  return (control & (1 << TWEN)) && (control & (1 << TWEA))
+    && (TWAR >> 1) == SIM_HUB_ADDRESS;
+}
+
+// Send a byte to the slave, a refused byte ends the transfer
+static void hub_send(uint8_t data)
+{
+  TWDR = data;
+  hub_raise(hub_ack ? TW_SR_DATA_ACK : TW_SR_DATA_NACK);
+  if (!hub_ack)
+  {
+    hub_refused = 1;
+    hub_phase = HubDone;
+  }
+}
+
+static void hub_finish(const char *result)
+{
+  const struct sim_hub_transfer_t *transfer = &hub_queue[hub_first];
+  char bytes[3 * SIM_HUB_MAX_BYTES + 1] = "";
+  if (!result)
+  {
+    for (uint8_t i=0; i < transfer->len; ++i)
+      snprintf(bytes + 3 * i, 4, " %02x", transfer->data[i]);
+    result = bytes;
+  }
+  sim_log("hub: %s 0x%02x:%s", transfer->read ? "read" : "wrote",
+      transfer->reg, result);
+  hub_phase = HubIdle;
+  hub_first = (hub_first + 1) % SIM_HUB_QUEUE;
+  --hub_count;
+  // A STOP, the bus free time, the next START and address
+  hub_next = hub_count ? sim_cycles + 12 * hub_bit_cycles() : UINT64_MAX;
+}
+
+uint64_t sim_twi_hub_next(void)
+{
+  if (hub_waiting && !(TWCR & SIM_TWCR_DONE))
+  {
+    // The firmware wrote TWCR to answer, TWEA is its acknowledge
+    uint8_t control = TWCR;
+    hub_ack = (control & (1 << TWEA)) != 0;
+    TWCR = control & ~(1 << TWINT);
+    hub_waiting = 0;
+    // The next byte and its acknowledge
+    hub_next = sim_cycles + 9 * hub_bit_cycles();
+  }
+  return hub_next;
+}
+
+void sim_twi_hub_step(void)
+{
+  struct sim_hub_transfer_t *transfer = &hub_queue[hub_first];
+  switch (hub_phase)
+  {
+    case HubIdle:
+      if (state != TwiIdle)
+      {
+        // The firmware has the bus, try again after its STOP
+        hub_next = sim_cycles + hub_bit_cycles();
+        return;
+      }
+      if (sim_io_cycles(16) > hub_bit_cycles())
+        sim_log("hub: CPU clock below 16 times SCL, bytes would be lost");
+      hub_pos = 0;
+      hub_refused = 0;
+      // The START and address take the bus at once, the firmware's master
+      // waits for the transfer to end
+      if (!hub_addressed())
+      {
+        hub_finish(" no answer");
+        return;
+      }
+      hub_raise(TW_SR_SLA_ACK);
+      hub_phase = HubPointer;
+      break;
+    case HubPointer:
+      hub_phase = transfer->read ? HubRestart : HubWriteData;
+      hub_send(transfer->reg);
+      break;
+    case HubWriteData:
+      if (hub_pos < transfer->len)
+      {
+        hub_send(transfer->data[hub_pos++]);
+        break;
+      }
+      hub_raise(TW_SR_STOP);
+      hub_phase = HubDone;
+      break;
+    case HubRestart:
+      // A repeated START, the slave sees it as a STOP
+      hub_raise(TW_SR_STOP);
+      hub_phase = HubAddressRead;
+      break;
+    case HubAddressRead:
+      if (!hub_addressed())
+      {
+        hub_finish(" no answer");
+        return;
+      }
+      hub_raise(TW_ST_SLA_ACK);
+      hub_phase = HubReadData;
+      break;
+    case HubReadData:
+      // The byte the firmware loaded has been shifted out, acknowledge
+      // all but the last
+      transfer->data[hub_pos++] = TWDR;
+      if (hub_pos < transfer->len)
+      {
+        hub_raise(TW_ST_DATA_ACK);
+        break;
+      }
+      hub_raise(TW_ST_DATA_NACK);
+      hub_phase = HubDone;
+      break;
+    case HubDone:
+      hub_finish(hub_refused ? " refused" : 0);
+      break;
+  }
+}
@@ -0,0 +1,147 @@
+
+#include "status_led.h"
+#include "clock.h"
+#include "power.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+/* DEFINES */
+// Timer2 divide by 1024 clock select
+#define STATUS_LED_CLOCK_SELECT ((1 << CS22) | (1 << CS21) | (1 << CS20))
+#define STATUS_LED_PRESCALE 1024
+
+/* PRIVATE GLOBALS */
+// Patterns are on and off times in ticks, starting on, and end with a 0.
+// They repeat from the start.
+static const uint8_t FeedingPattern[] PROGMEM = {4, 4, 0};
+static const uint8_t LowSupplyPattern[] PROGMEM = {2, 78, 0};
+static const uint8_t RtcFaultPattern[] PROGMEM = {8, 8, 8, 56, 0};
+static const uint8_t TwiErrorPattern[] PROGMEM = {8, 8, 8, 8, 8, 56, 0};
+static const uint8_t *const Patterns[] =
+{
+  FeedingPattern, LowSupplyPattern, RtcFaultPattern, TwiErrorPattern
+};
+
+static volatile uint8_t *led_port;
+static uint8_t led_mask;
+// Bit n set when status n is set
+static uint8_t statuses;
+static const uint8_t *pattern;
+static uint8_t step;
+static uint8_t remaining;
+
+// Drive the LED for the current step, even steps are on
+static void status_led_output(void)
+{
+  if (step & 1)
+    *led_port &= ~led_mask;
+  else
+    *led_port |= led_mask;
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  if (--remaining > 0)
+  {
+    return;
+  }
+  ++step;
+  remaining = pgm_read_byte(&pattern[step]);
+  if (remaining == 0)
+  {
+    step = 0;
+    remaining = pgm_read_byte(&pattern[0]);
+  }
+  status_led_output();
+}
+
+// Play the highest status set from its start, call with interrupts
+// disabled
+static void status_led_update(void)
+{
+  if (!led_port)
+  {
+    return;
+  }
+  if (statuses == 0)
+  {
+    if (pattern)
+    {
+      TIMSK2 &= ~(1 << OCIE2A);
+      TCCR2B = 0;
+      power_release(PowerTimer2);
+      pattern = 0;
+    }
+    *led_port &= ~led_mask;
+    return;
+  }
+
+  uint8_t status = StatusTwiError;
+  while (!(statuses & (1 << status)))
+  {
+    --status;
+  }
+  if (pattern == Patterns[status])
+  {
+    return;
+  }
+  if (!pattern)
+  {
+    power_acquire(PowerTimer2);
+    // Clear timer on compare match mode
+    TCCR2A = (1 << WGM21);
+  }
+  pattern = Patterns[status];
+  step = 0;
+  remaining = pgm_read_byte(&pattern[0]);
+  status_led_output();
+  TCNT2 = 0;
+  status_led_set_clock();
+  TIFR2 = (1 << OCF2A);
+  TIMSK2 |= (1 << OCIE2A);
+}
+
+void status_led_open(volatile uint8_t *port, uint8_t pin)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    led_port = port;
+    led_mask = (1 << pin);
+    statuses = 0;
+    // Drive the pin low, then make it an output. The DDRx register sits
+    // just below PORTx.
+    *port &= ~led_mask;
+    *(port - 1) |= led_mask;
+  }
+}
+
+void status_led_set(enum StatusLed status)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    statuses |= (1 << status);
+    status_led_update();
+  }
+}
+
+void status_led_clear(enum StatusLed status)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    statuses &= ~(1 << status);
+    status_led_update();
+  }
+}
+
+void status_led_set_clock(void)
+{
+  if (!pattern)
+  {
+    return;
+  }
+  uint16_t period = clock_hz() / STATUS_LED_PRESCALE / STATUS_LED_TICK_HZ;
+  OCR2A = (period > 256 ? 256 : (period ? period : 1)) - 1;
+  TCCR2B = STATUS_LED_CLOCK_SELECT;
+}
@@ -0,0 +1,49 @@
+/*
+ * @file status_led.h
+ * @brief Status LED blink code patterns played from Timer2.
+ *
+ * Each status has a flash stored pattern. Of the statuses set, the one
+ * with the highest priority is played, repeating, by the Timer2 compare
+ * interrupt, so the main loop has nothing to do and the pattern carries on
+ * through idle sleep. Timer2 is stopped and unpowered while no status is
+ * set.
+ */
+#ifndef _CAT_FEEDER_STATUS_LED_H_
+#define _CAT_FEEDER_STATUS_LED_H_
+
+#include <stdint.h>
+
+// Pattern time unit
+#ifndef STATUS_LED_TICK_HZ
+#define STATUS_LED_TICK_HZ 40
+#endif
+
+/// @brief StatusLed is an enumeration of the indicated statuses, in
+/// increasing priority
+enum StatusLed
+{
+  StatusFeeding = 0,   // fast blink while the bowls turn
+  StatusLowSupply = 1, // short flash every 2 s
+  StatusRtcFault = 2,  // 2 blinks and a pause
+  StatusTwiError = 3   // 3 blinks and a pause
+};
+
+/// @brief Set up the LED pin, off
+/// @param port is the output register of the LED pin. ex: &PORTB
+/// @param pin is the pin number in the port
+void status_led_open(volatile uint8_t *port, uint8_t pin);
+
+/// @brief Set a status, its pattern plays if no higher status is set
+/// @param status is the status to set
+void status_led_set(enum StatusLed status);
+
+/// @brief Clear a status, the next highest set status plays from its start
+/// @param status is the status to clear
+void status_led_clear(enum StatusLed status);
+
+/// @brief Set the Timer2 prescaler and period for the current system clock
+///
+/// Called by clock_set() with interrupts disabled.
+void status_led_set_clock(void);
+
+#endif
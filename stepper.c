@@ -0,0 +1,221 @@
+
+#include "stepper.h"
+#include "timebase.h"
+#include "counters.h"
+#include "trace.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/* DEFINES */
+// The step tick is scheduled on the free running time base by advancing
+// the OCR1A compare value
+#define STEPPER_TICK_PERIOD (TIMEBASE_HZ / STEPPER_TICK_HZ)
+
+/// @brief Per channel step generator state
+struct stepper_channel_t
+{
+  volatile uint8_t *step_port;
+  uint8_t step_mask;
+  volatile uint8_t *dir_port;
+  uint8_t dir_mask;
+  // Phase accumulator, a step is taken every time it wraps around
+  uint16_t phase;
+  // Added to the phase every tick: 65536 * rate / STEPPER_TICK_HZ
+  uint16_t phase_increment;
+  uint16_t remaining;
+};
+
+/* PRIVATE GLOBALS */
+static struct stepper_channel_t channels[STEPPER_MAX_CHANNELS];
+static volatile uint8_t active_channels;
+// Unattached channels pulse this byte instead of a port so the interrupt
+// does the same work for every channel
+static volatile uint8_t unused_port;
+
+ISR(TIMER1_COMPA_vect)
+{
+  COUNTER_BEGIN();
+  // Schedule the next tick
+  OCR1A += STEPPER_TICK_PERIOD;
+
+  uint8_t active = active_channels;
+  uint8_t pulsed = 0;
+  uint8_t channel_bit = 1;
+  // Every channel is visited on every tick, so the interrupt takes the same
+  // time however many channels are moving
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i, channel_bit <<= 1)
+  {
+    struct stepper_channel_t *ch = &channels[i];
+    // End the step pulse started on the previous tick
+    *ch->step_port &= ~ch->step_mask;
+    // Advance the phase, idle channels have a zero increment
+    uint16_t last_phase = ch->phase;
+    ch->phase += ch->phase_increment;
+    if (ch->phase < last_phase)
+    {
+      // Phase wrapped around, start a step pulse
+      *ch->step_port |= ch->step_mask;
+      pulsed = 1;
+      if (--ch->remaining == 0)
+      {
+        ch->phase_increment = 0;
+        active &= ~channel_bit;
+        TRACE(TraceStepperStop, i);
+      }
+    }
+  }
+  active_channels = active;
+
+  // Nothing left to step, stop interrupting once the last pulse has ended
+  if (active == 0 && !pulsed)
+  {
+    TIMSK1 &= ~(1 << OCIE1A);
+  }
+  COUNTER_END(CounterStepperIsr);
+}
+
+void stepper_open(void)
+{
+  TIMSK1 &= ~(1 << OCIE1A);
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    channels[i].step_port = &unused_port;
+    channels[i].step_mask = 0;
+    channels[i].dir_port = 0;
+    channels[i].phase_increment = 0;
+    channels[i].remaining = 0;
+  }
+  active_channels = 0;
+
+  timebase_open();
+}
+
+void stepper_close(void)
+{
+  // The time base is left running for its other users
+  stepper_stop_all();
+}
+
+uint8_t stepper_attach(uint8_t channel,
+    volatile uint8_t *step_port, uint8_t step_pin,
+    volatile uint8_t *dir_port, uint8_t dir_pin)
+{
+  if (channel >= STEPPER_MAX_CHANNELS || (active_channels & (1 << channel)))
+  {
+    return 1;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Drive the pins low, then make them outputs. The DDRx register sits
+    // just below PORTx in the I/O map. Through a pointer these are read-
+    // modify-writes that an interrupt driving another pin of the port
+    // mustn't fall into.
+    *step_port &= ~(1 << step_pin);
+    *(step_port - 1) |= (1 << step_pin);
+    if (dir_port)
+    {
+      *dir_port &= ~(1 << dir_pin);
+      *(dir_port - 1) |= (1 << dir_pin);
+    }
+    channels[channel].step_port = step_port;
+    channels[channel].step_mask = (1 << step_pin);
+    channels[channel].dir_port = dir_port;
+    channels[channel].dir_mask = (1 << dir_pin);
+  }
+  return 0;
+}
+
+uint8_t stepper_move(uint8_t channel, uint16_t steps, uint16_t rate,
+    enum StepperDirection direction)
+{
+  if (channel >= STEPPER_MAX_CHANNELS || (active_channels & (1 << channel)))
+  {
+    return 1;
+  }
+  if (steps == 0 || rate == 0)
+  {
+    return 0;
+  }
+  if (rate > STEPPER_MAX_RATE)
+  {
+    rate = STEPPER_MAX_RATE;
+  }
+
+  struct stepper_channel_t *ch = &channels[channel];
+  uint16_t increment = ((uint32_t)rate << 16) / STEPPER_TICK_HZ;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Set the direction before the first step pulse, the tick may be
+    // stepping another channel on the same port
+    if (ch->dir_port)
+    {
+      if (direction == StepperReverse)
+        *ch->dir_port |= ch->dir_mask;
+      else
+        *ch->dir_port &= ~ch->dir_mask;
+    }
+    ch->remaining = steps;
+    // Start half way so the first step comes half a step period after
+    // the start instead of a full period
+    ch->phase = 0x8000;
+    ch->phase_increment = increment;
+    // Restart the tick if the generator was idle
+    if (active_channels == 0)
+    {
+      OCR1A = TCNT1 + STEPPER_TICK_PERIOD;
+      TIFR1 = (1 << OCF1A);
+      TIMSK1 |= (1 << OCIE1A);
+    }
+    active_channels |= (1 << channel);
+  }
+  TRACE(TraceStepperStart, channel);
+  return 0;
+}
+
+void stepper_stop(uint8_t channel)
+{
+  if (channel >= STEPPER_MAX_CHANNELS)
+  {
+    return;
+  }
+  if (active_channels & (1 << channel))
+  {
+    TRACE(TraceStepperStop, channel);
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    channels[channel].phase_increment = 0;
+    channels[channel].remaining = 0;
+    // The interrupt ends any pulse in progress on its next tick and
+    // disables itself when no channel is left
+    active_channels &= ~(1 << channel);
+  }
+}
+
+void stepper_stop_all(void)
+{
+  for (uint8_t i=0; i < STEPPER_MAX_CHANNELS; ++i)
+  {
+    stepper_stop(i);
+  }
+}
+
+uint8_t stepper_active(void)
+{
+  return active_channels;
+}
+
+uint16_t stepper_remaining(uint8_t channel)
+{
+  if (channel >= STEPPER_MAX_CHANNELS)
+  {
+    return 0;
+  }
+  uint16_t remaining;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    remaining = channels[channel].remaining;
+  }
+  return remaining;
+}
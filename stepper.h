@@ -0,0 +1,80 @@
+/*
+ * @file stepper.h
+ * @brief Multi-channel step generator for step/direction stepper drivers.
+ *
+ * Up to STEPPER_MAX_CHANNELS drivers are stepped from a single Timer1
+ * compare match interrupt. Each channel keeps its own step count, rate and
+ * direction and is scheduled with a DDA (phase accumulator), so several
+ * bowls can dispense at the same time.
+ */
+#ifndef _CAT_FEEDER_STEPPER_H_
+#define _CAT_FEEDER_STEPPER_H_
+
+#include <stdint.h>
+
+#ifndef STEPPER_MAX_CHANNELS
+#define STEPPER_MAX_CHANNELS 4
+#endif
+
+// Frequency of the step generation interrupt. A step pulse is held high for
+// one tick, so the fastest usable step rate is half the tick rate.
+#ifndef STEPPER_TICK_HZ
+#define STEPPER_TICK_HZ 4000
+#endif
+#define STEPPER_MAX_RATE (STEPPER_TICK_HZ / 2)
+
+/// @brief StepperDirection is an enumeration of the motor directions
+enum StepperDirection
+{
+  StepperForward = 0,
+  StepperReverse = 1
+};
+
+/// @brief Start the step generator on the Timer1 time base
+///
+/// Channels have to be attached before they can be moved.
+void stepper_open(void);
+
+/// @brief Stop all channels, the time base is left running
+void stepper_close(void);
+
+/// @brief Assign the step and direction pins of a channel
+///
+/// The pins are configured as outputs and driven low.
+/// @param channel is the channel number [0, STEPPER_MAX_CHANNELS)
+/// @param step_port is the PORTx register of the step pin. ex: &PORTB
+/// @param step_pin is the bit number of the step pin. ex: PB1
+/// @param dir_port is the PORTx register of the direction pin, or 0 if the
+/// driver's direction is hard wired
+/// @param dir_pin is the bit number of the direction pin
+/// @returns 0 if the channel was attached, 1 if the channel is invalid or busy
+uint8_t stepper_attach(uint8_t channel,
+    volatile uint8_t *step_port, uint8_t step_pin,
+    volatile uint8_t *dir_port, uint8_t dir_pin);
+
+/// @brief Start a move on a channel in the background
+/// @param channel is the channel number to move
+/// @param steps is the number of step pulses to generate
+/// @param rate is the step rate in steps per second (max STEPPER_MAX_RATE)
+/// @param direction is the direction to drive the motor
+/// @returns 0 if the move was started, 1 if the channel is invalid or busy
+uint8_t stepper_move(uint8_t channel, uint16_t steps, uint16_t rate,
+    enum StepperDirection direction);
+
+/// @brief Abort the move on a channel
+/// @param channel is the channel number to stop
+void stepper_stop(uint8_t channel);
+
+/// @brief Abort the moves on every channel
+void stepper_stop_all(void);
+
+/// @brief Get the channels that are currently moving
+/// @returns a bit mask with bit n set while channel n is moving
+uint8_t stepper_active(void);
+
+/// @brief Get the number of steps left in the current move of a channel
+/// @param channel is the channel number to query
+/// @returns the remaining step count, 0 if the channel is idle
+uint16_t stepper_remaining(uint8_t channel);
+
+#endif
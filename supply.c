@@ -0,0 +1,135 @@
+
+#include "supply.h"
+#include "clock.h"
+#include "config.h"
+#include "feed_switch.h"
+#include "power.h"
+#include "timebase.h"
+#include <avr/io.h>
+#include <util/delay.h>
+
+/* DEFINES */
+// ADMUX channel of the bandgap
+#define SUPPLY_BANDGAP_CHANNEL 0x0E
+// Time for the bandgap to settle on the ADC input
+#define SUPPLY_SETTLE_US 100
+// Highest ADC clock for full resolution
+#define SUPPLY_ADC_MAX_HZ 200000UL
+
+/* PRIVATE GLOBALS */
+static enum SupplyLevel current_level;
+static uint16_t millivolts;
+static uint32_t next_measurement;
+
+// Convert the selected channel and return the result
+static uint16_t supply_convert(void)
+{
+  ADCSRA |= (1 << ADSC);
+  loop_until_bit_is_clear(ADCSRA, ADSC);
+  uint16_t value = ADCL;
+  value |= (ADCH << 8);
+  return value;
+}
+
+// Measure VCC in millivolts
+static uint16_t supply_measure(void)
+{
+  feed_switch_suspend();
+  power_acquire(PowerAdc);
+  // AVcc reference, bandgap input
+  ADMUX = (1 << REFS0) | SUPPLY_BANDGAP_CHANNEL;
+  // Slowest prescaler needed for an ADC clock in range, no interrupt
+  uint8_t prescaler = 1;
+  while (prescaler < 7 && (clock_hz() >> prescaler) > SUPPLY_ADC_MAX_HZ)
+  {
+    ++prescaler;
+  }
+  ADCSRA = (1 << ADEN) | (1 << ADIF) | prescaler;
+  // _delay_us() counts F_CPU cycles, each one lasts 1 << clock_speed() as
+  // long on a divided clock
+  for (uint8_t us=0; us < SUPPLY_SETTLE_US; us += 4 << clock_speed())
+  {
+    _delay_us(4);
+  }
+  // The first conversion after switching to the bandgap reads high
+  supply_convert();
+  uint16_t value = supply_convert();
+  feed_switch_resume();
+  power_release(PowerAdc);
+
+  if (value == 0)
+  {
+    value = 1;
+  }
+  millivolts = ((uint32_t)SUPPLY_BANDGAP_MV * 1024) / value;
+  return millivolts;
+}
+
+// Level of a measurement, with hysteresis against the current level
+static enum SupplyLevel supply_classify(uint16_t mv)
+{
+  uint16_t critical = config.supply_critical_mv;
+  uint16_t low = config.supply_low_mv;
+  if (current_level == SupplyCritical)
+    critical += SUPPLY_HYSTERESIS_MV;
+  if (current_level != SupplyOk)
+    low += SUPPLY_HYSTERESIS_MV;
+
+  if (mv < critical)
+    return SupplyCritical;
+  if (mv < low)
+    return SupplyLow;
+  return SupplyOk;
+}
+
+void supply_open(void)
+{
+  current_level = SupplyOk;
+  current_level = supply_classify(supply_measure());
+  next_measurement = timebase_ticks()
+    + timebase_us_to_ticks(SUPPLY_IDLE_S * 1000000UL);
+}
+
+uint8_t supply_update(enum SupplyLevel *level)
+{
+  enum SupplyLevel new_level = supply_classify(supply_measure());
+  next_measurement = timebase_ticks()
+    + timebase_us_to_ticks(SUPPLY_IDLE_S * 1000000UL);
+  if (new_level == current_level)
+  {
+    return 0;
+  }
+  current_level = new_level;
+  *level = new_level;
+  return 1;
+}
+
+uint8_t supply_service(uint8_t busy, enum SupplyLevel *level)
+{
+  uint8_t changed = 0;
+  uint32_t period = busy ? timebase_us_to_ticks(SUPPLY_BUSY_MS * 1000UL)
+    : timebase_us_to_ticks(SUPPLY_IDLE_S * 1000000UL);
+  // Measuring was idle paced when the motor started, catch up
+  if (busy && (int32_t)(next_measurement - timebase_ticks()) > (int32_t)period)
+  {
+    next_measurement = timebase_ticks();
+  }
+  if (timebase_reached(next_measurement))
+  {
+    changed = supply_update(level);
+    next_measurement = timebase_ticks() + period;
+  }
+  // The time base runs slow while idle, a minute out is a single wake up
+  timebase_wake_at(next_measurement);
+  return changed;
+}
+
+enum SupplyLevel supply_level(void)
+{
+  return current_level;
+}
+
+uint16_t supply_millivolts(void)
+{
+  return millivolts;
+}
@@ -0,0 +1,76 @@
+/*
+ * @file supply.h
+ * @brief Supply voltage monitor on the internal bandgap reference.
+ *
+ * VCC is worked out by converting the 1.1V bandgap against AVcc, no pin
+ * or divider is needed. The ADC is borrowed from the feed switch for each
+ * measurement and only clocked meanwhile. The supply is measured at most
+ * once every SUPPLY_IDLE_S while idle, whenever the main loop wakes up
+ * anyway, and every SUPPLY_BUSY_MS while the motor runs, when it sags the
+ * most.
+ */
+#ifndef _CAT_FEEDER_SUPPLY_H_
+#define _CAT_FEEDER_SUPPLY_H_
+
+#include <stdint.h>
+
+// Bandgap voltage, measure it on AREF to calibrate a part
+#ifndef SUPPLY_BANDGAP_MV
+#define SUPPLY_BANDGAP_MV 1100
+#endif
+// Default thresholds, the thresholds in use are in config. Below this the
+// supply is low
+#ifndef SUPPLY_LOW_MV
+#define SUPPLY_LOW_MV 3100
+#endif
+// Below this a brown out is close, keep it above the BODLEVEL fuse (2.7V)
+#ifndef SUPPLY_CRITICAL_MV
+#define SUPPLY_CRITICAL_MV 2900
+#endif
+// A level is only left once the supply is this far past its threshold
+#ifndef SUPPLY_HYSTERESIS_MV
+#define SUPPLY_HYSTERESIS_MV 100
+#endif
+#ifndef SUPPLY_IDLE_S
+#define SUPPLY_IDLE_S 60
+#endif
+#ifndef SUPPLY_BUSY_MS
+#define SUPPLY_BUSY_MS 20
+#endif
+
+/// @brief SupplyLevel is an enumeration of the supply states
+enum SupplyLevel
+{
+  SupplyOk = 0,
+  SupplyLow,
+  SupplyCritical
+};
+
+/// @brief Take a first measurement and start the schedule
+void supply_open(void);
+
+/// @brief Measure the supply if a measurement is due, call from the main
+/// loop
+///
+/// Arms a time base wake up for the next measurement.
+/// @param busy is non zero while the motor runs
+/// @param level is updated with the supply level when it changes
+/// @returns 1 if the level changed, otherwise 0
+uint8_t supply_service(uint8_t busy, enum SupplyLevel *level);
+
+/// @brief Measure the supply now, ex: before starting the motor
+///
+/// Blocks for about half a millisecond at either clock speed.
+/// @param level is updated with the supply level when it changes
+/// @returns 1 if the level changed, otherwise 0
+uint8_t supply_update(enum SupplyLevel *level);
+
+/// @brief Get the current supply level
+/// @returns level - the level of the last measurement
+enum SupplyLevel supply_level(void);
+
+/// @brief Get the last supply measurement
+/// @returns millivolts - the supply voltage
+uint16_t supply_millivolts(void);
+
+#endif
@@ -0,0 +1,224 @@
+
+#include "timebase.h"
+#include "clock.h"
+#include "power.h"
+#include "watchdog.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/* DEFINES */
+#define TIMEBASE_CS_MASK ((1 << CS12) | (1 << CS11) | (1 << CS10))
+// Time base ticks per Timer1 count while asleep on the slow clock, the
+// low clock divided by 1024
+#define TIMEBASE_SLOW_SHIFT 10
+// Shortest sleep worth slowing down for, in slow counts
+#define TIMEBASE_SLOW_MIN 2
+
+/* PRIVATE GLOBALS */
+static volatile uint16_t overflows;
+static uint32_t wake_deadline;
+// Set while the CPU sleeps with Timer1 on the slow clock
+static volatile uint8_t slow;
+// Time base count when Timer1 was last at 0 on the slow clock
+static volatile uint32_t slow_base;
+// Count of the last timebase_check_in()
+static uint32_t checked_ticks;
+
+ISR(TIMER1_OVF_vect)
+{
+  if (slow)
+  {
+    slow_base += 1UL << (16 + TIMEBASE_SLOW_SHIFT);
+  }
+  else
+  {
+    ++overflows;
+  }
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+  // OCR1B only holds the low word of the deadline, keep matching once per
+  // counter wrap until the whole deadline has passed. Waking the CPU is
+  // all this interrupt is for.
+  if (timebase_reached(wake_deadline))
+  {
+    TIMSK1 &= ~(1 << OCIE1B);
+  }
+}
+
+// Timer1 clock select that divides the system clock down to TIMEBASE_HZ
+static uint8_t timebase_clock_select(void)
+{
+  // The low clock is already divided by the time base prescaler
+  if (clock_speed() == ClockLow)
+  {
+    return (1 << CS10);
+  }
+  return (1 << CS11);
+}
+
+void timebase_open(void)
+{
+  // Already running
+  if (TCCR1B & TIMEBASE_CS_MASK)
+  {
+    return;
+  }
+  // Never released, the time base runs for good
+  power_acquire(PowerTimer1);
+  overflows = 0;
+  TCNT1 = 0;
+  // Normal (free running) mode, clock at F_CPU/8
+  TCCR1A = 0;
+  TCCR1B = timebase_clock_select();
+  TIFR1 = (1 << TOV1);
+  TIMSK1 |= (1 << TOIE1);
+}
+
+void timebase_set_clock(void)
+{
+  if (TCCR1B & TIMEBASE_CS_MASK)
+  {
+    TCCR1B = (TCCR1B & ~TIMEBASE_CS_MASK) | timebase_clock_select();
+  }
+}
+
+uint32_t timebase_ticks(void)
+{
+  uint32_t ticks;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uint16_t high = overflows;
+    uint16_t low = TCNT1;
+    // An overflow that hasn't been serviced yet belongs to this count if
+    // the counter was read after it wrapped
+    uint8_t wrapped = (TIFR1 & (1 << TOV1)) && low < 0x8000;
+    if (slow)
+    {
+      // Only interrupts see the slow clock
+      ticks = slow_base + ((((uint32_t)wrapped << 16) | low)
+          << TIMEBASE_SLOW_SHIFT);
+    }
+    else
+    {
+      ticks = ((uint32_t)(high + wrapped) << 16) | low;
+    }
+  }
+  return ticks;
+}
+
+uint32_t timebase_ticks_to_us(uint32_t ticks)
+{
+#if (TIMEBASE_HZ % 1000000UL) == 0
+  return ticks / (TIMEBASE_HZ / 1000000UL);
+#else
+  return (uint64_t)ticks * 1000000UL / TIMEBASE_HZ;
+#endif
+}
+
+uint32_t timebase_us_to_ticks(uint32_t us)
+{
+#if (TIMEBASE_HZ % 1000000UL) == 0
+  return us * (TIMEBASE_HZ / 1000000UL);
+#else
+  return (uint64_t)us * TIMEBASE_HZ / 1000000UL;
+#endif
+}
+
+uint8_t timebase_reached(uint32_t deadline)
+{
+  return (int32_t)(timebase_ticks() - deadline) >= 0;
+}
+
+void timebase_wake_at(uint32_t deadline)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Keep an earlier deadline that is still pending
+    if (!(TIMSK1 & (1 << OCIE1B)) ||
+        (int32_t)(deadline - wake_deadline) < 0)
+    {
+      wake_deadline = deadline;
+      OCR1B = (uint16_t)deadline;
+      TIFR1 = (1 << OCF1B);
+      TIMSK1 |= (1 << OCIE1B);
+    }
+  }
+}
+
+void timebase_sleep(void)
+{
+  // Stepping runs on compare A at the full count rate
+  if (clock_speed() != ClockLow || (TIMSK1 & (1 << OCIE1A)))
+  {
+    return;
+  }
+  uint32_t now = timebase_ticks();
+  uint16_t counts = 0;
+  if (TIMSK1 & (1 << OCIE1B))
+  {
+    // Wake at the last slow count before the deadline, timebase_resume()
+    // waits out the rest on the full rate
+    uint32_t remaining = (wake_deadline - now) >> TIMEBASE_SLOW_SHIFT;
+    if ((int32_t)(wake_deadline - now) < 0 || remaining < TIMEBASE_SLOW_MIN)
+    {
+      return;
+    }
+    counts = remaining > 0xFFFF ? 0xFFFF : remaining;
+  }
+  slow = 1;
+  slow_base = now;
+  TCCR1B = (TCCR1B & ~TIMEBASE_CS_MASK) | (1 << CS12) | (1 << CS10);
+  // Start the first slow count now rather than part way through one
+  GTCCR = (1 << PSRSYNC);
+  TCNT1 = 0;
+  OCR1B = counts;
+  TIFR1 = (1 << TOV1) | (1 << OCF1B);
+}
+
+void timebase_resume(void)
+{
+  if (!slow)
+  {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uint32_t now = timebase_ticks();
+    // The part of a slow count that had passed is lost. A compare match
+    // woke us at the start of one, anything else half way on average.
+    if (!(TIMSK1 & (1 << OCIE1B)) || TCNT1 != OCR1B)
+    {
+      now += 1UL << (TIMEBASE_SLOW_SHIFT - 1);
+    }
+    slow = 0;
+    TCCR1B = (TCCR1B & ~TIMEBASE_CS_MASK) | timebase_clock_select();
+    overflows = now >> 16;
+    TCNT1 = now;
+    TIFR1 = (1 << TOV1) | (1 << OCF1B);
+    // Match the rest of a pending deadline on the full rate again
+    if (TIMSK1 & (1 << OCIE1B))
+    {
+      if (timebase_reached(wake_deadline))
+      {
+        TIMSK1 &= ~(1 << OCIE1B);
+      }
+      else
+      {
+        OCR1B = (uint16_t)wake_deadline;
+      }
+    }
+  }
+}
+
+void timebase_check_in(void)
+{
+  uint32_t now = timebase_ticks();
+  if (now != checked_ticks)
+  {
+    checked_ticks = now;
+    watchdog_check_in(WatchdogTimebase);
+  }
+}
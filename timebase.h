@@ -0,0 +1,74 @@
+/*
+ * @file timebase.h
+ * @brief Free running Timer1 time base.
+ *
+ * Timer1 counts at F_CPU/8 and is never reset, its overflows are counted
+ * to extend it to 32 bits. Other modules may use the Timer1 compare units
+ * as long as they leave the counter running. The Timer1 prescaler follows
+ * the system clock prescaler so the tick rate doesn't change with it.
+ *
+ * While the CPU sleeps at the low clock with nothing stepping, Timer1
+ * counts 1024 times slower, so the counter wraps once every 67s rather
+ * than 15 times a second and a wake up far out costs one interrupt. Each
+ * such sleep loses up to half a millisecond of the time base.
+ */
+#ifndef _CAT_FEEDER_TIMEBASE_H_
+#define _CAT_FEEDER_TIMEBASE_H_
+
+#include <stdint.h>
+
+#define TIMEBASE_PRESCALE 8
+#define TIMEBASE_HZ (F_CPU / TIMEBASE_PRESCALE)
+
+/// @brief Start the time base, does nothing if it is already running
+void timebase_open(void);
+
+/// @brief Select the Timer1 prescaler for the current system clock
+///
+/// Called by clock_set() with interrupts disabled.
+void timebase_set_clock(void);
+
+/// @brief Get the time base count
+///
+/// Wraps around after 2^32 ticks (over an hour at 1 MHz)
+/// @returns ticks - the number of ticks since timebase_open()
+uint32_t timebase_ticks(void);
+
+/// @brief Convert microseconds to a number of ticks
+/// @param us is the duration in microseconds
+/// @returns ticks - the duration in time base ticks
+uint32_t timebase_us_to_ticks(uint32_t us);
+
+/// @brief Check whether a deadline has passed
+/// @param deadline is a time base count from timebase_ticks()
+/// @returns 1 if the time base is at or past the deadline, otherwise 0
+uint8_t timebase_reached(uint32_t deadline);
+
+/// @brief Interrupt the CPU at a deadline
+///
+/// Uses the Timer1 compare B interrupt to wake the CPU from sleep so the
+/// main loop can service whatever was waiting on the deadline. Only the
+/// earliest pending deadline is kept.
+/// @param deadline is a time base count from timebase_ticks()
+void timebase_wake_at(uint32_t deadline);
+
+/// @brief Slow the time base down for a sleep, call with interrupts off
+///
+/// Does nothing at the full clock, while compare A is in use or when the
+/// pending wake up is too close. timebase_wake_at() can't be called from
+/// interrupts until timebase_resume().
+void timebase_sleep(void);
+
+/// @brief Bring the time base back to full rate after a sleep
+void timebase_resume(void);
+
+/// @brief Check the time base in with the watchdog if it moved since the
+/// last call, call from the main loop
+void timebase_check_in(void);
+
+/// @brief Convert a number of ticks to microseconds
+/// @param ticks is the tick count to convert
+/// @returns microseconds - the duration of ticks in microseconds
+uint32_t timebase_ticks_to_us(uint32_t ticks);
+
+#endif
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Decode the tokenized log frames in the cat feeder serial output.
+
+The dictionary is extracted from the elf by the build (make logfmt). Decode
+a raw capture of the serial output:
+
+    log_decode.py --dictionary main.logfmt capture.bin
+
+or follow the serial port (needs pyserial):
+
+    log_decode.py --dictionary main.logfmt --port /dev/ttyACM0
+
+Text the firmware prints between frames is passed through. A capture of
+the host simulation is decoded with the dictionary of its binary, see
+--sim.
+"""
+
+import argparse
+import re
+import sys
+
+FRAME_MARK = 0x1E
+HEADER_SIZE = 4
+LEVELS = {"E": "ERROR", "W": "WARN", "I": "INFO", "D": "DEBUG"}
+CONVERSION = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(l?)([diuxXoc%])")
+
+
+def read_dictionary(path):
+    with open(path, "rb") as dictionary:
+        return dictionary.read()
+
+
+def lookup(dictionary, id):
+    """Get the level and format stored at an id."""
+    end = dictionary.find(b"\0", id)
+    if id >= len(dictionary) or end < 0:
+        return None, None
+    text = dictionary[id:end].decode("ascii", "replace")
+    return LEVELS.get(text[:1], "?"), text[1:]
+
+
+def format_message(format, args, int_size):
+    """Apply the arguments to a printf format, args holds their raw bytes."""
+    offset = 0
+    parts = []
+    position = 0
+    for match in CONVERSION.finditer(format):
+        parts.append(format[position:match.start()])
+        position = match.end()
+        flags, long, conversion = match.groups()
+        if conversion == "%":
+            parts.append("%")
+            continue
+        size = 2 * int_size if long else int_size
+        raw = args[offset:offset + size]
+        offset += size
+        if len(raw) < size:
+            parts.append("<missing>")
+            continue
+        signed = conversion in "di"
+        value = int.from_bytes(raw, "little", signed=signed)
+        if conversion == "u":
+            conversion = "d"
+        parts.append(("%" + flags + conversion) % value)
+    parts.append(format[position:])
+    if offset != len(args):
+        parts.append(" <%d argument bytes, expected %d>" % (len(args), offset))
+    return "".join(parts)
+
+
+class Decoder:
+    """Split a serial stream into text lines and decoded frames."""
+
+    def __init__(self, dictionary, int_size):
+        self.dictionary = dictionary
+        self.int_size = int_size
+        self.pending = bytearray()
+        self.text = bytearray()
+
+    def feed(self, data):
+        self.pending += data
+        lines = []
+        while self.pending:
+            byte = self.pending[0]
+            if byte != FRAME_MARK:
+                del self.pending[0]
+                if byte == ord("\n"):
+                    lines.append(self.text.decode("ascii", "replace"))
+                    self.text.clear()
+                elif byte != ord("\r"):
+                    self.text.append(byte)
+                continue
+            if len(self.pending) < HEADER_SIZE:
+                break
+            size = self.pending[3]
+            if len(self.pending) < HEADER_SIZE + size:
+                break
+            id = self.pending[1] | (self.pending[2] << 8)
+            args = bytes(self.pending[HEADER_SIZE:HEADER_SIZE + size])
+            del self.pending[:HEADER_SIZE + size]
+            level, format = lookup(self.dictionary, id)
+            if format is None:
+                lines.append("[?] unknown id 0x%04x %s" % (id, args.hex()))
+            else:
+                lines.append("[%s] %s" % (level,
+                                          format_message(format, args, self.int_size)))
+        return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture file")
+    parser.add_argument("--dictionary", required=True,
+                        help="log format dictionary, ex: main.logfmt")
+    parser.add_argument("--port", help="serial port to follow")
+    parser.add_argument("--baud", type=int, default=9600)
+    parser.add_argument("--sim", action="store_true",
+                        help="the capture is from the 64 bit host simulation "
+                        "(4 byte int, 8 byte long)")
+    args = parser.parse_args()
+
+    decoder = Decoder(read_dictionary(args.dictionary), 4 if args.sim else 2)
+    if args.port:
+        import serial
+
+        with serial.Serial(args.port, args.baud) as link:
+            while True:
+                for line in decoder.feed(link.read(link.in_waiting or 1)):
+                    print(line, flush=True)
+    if args.capture:
+        with open(args.capture, "rb") as capture:
+            data = capture.read()
+    else:
+        data = sys.stdin.buffer.read()
+    for line in decoder.feed(data):
+        print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Turn a profiler histogram dump from the cat feeder into a hot spot report.
+
+Build the firmware with -DPROFILE_ENABLE=1 and make the symbol table with
+`make sym`. The dump is requested with the 'p' serial command. Either
+report from a raw capture of the serial output (hardware or simavr):
+
+    profile_report.py --sym main.sym capture.bin
+
+or request and read a dump directly (needs pyserial):
+
+    profile_report.py --sym main.sym --port /dev/ttyACM0
+
+A bucket that spans several functions shares its samples between them by
+the bytes of it each one covers, narrow the buckets with PROFILE_SHIFT and
+PROFILE_BASE for an exact picture of a region.
+"""
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+MARKER = b"PROF"
+HEADER = struct.Struct("<HBHBH")
+
+
+def read_symbols(path):
+    """Get the sorted (address, name) list of the code symbols in nm -n output."""
+    symbols = []
+    with open(path) as sym:
+        for line in sym:
+            fields = line.split()
+            if len(fields) != 3 or fields[1] not in "TtWw":
+                continue
+            symbols.append((int(fields[0], 16), fields[2]))
+    symbols.sort()
+    return symbols
+
+
+def decode(data):
+    """Yield (hz, shift, base, outside, counts) for every dump."""
+    start = data.find(MARKER)
+    while start >= 0:
+        offset = start + len(MARKER)
+        hz, shift, base, count, outside = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        counts = struct.unpack_from("<%dH" % count, data, offset)
+        offset += 2 * count
+        yield hz, shift, base, outside, counts
+        start = data.find(MARKER, offset)
+
+
+def spread(symbols, start, end, samples, totals):
+    """Share the samples of [start, end) between the symbols covering it."""
+    addresses = [address for address, _ in symbols]
+    index = max(bisect.bisect_right(addresses, start) - 1, 0)
+    pieces = []
+    while index < len(symbols) and symbols[index][0] < end:
+        low = max(symbols[index][0], start)
+        high = symbols[index + 1][0] if index + 1 < len(symbols) else end
+        high = min(high, end)
+        if high > low:
+            pieces.append((symbols[index][1], high - low))
+        index += 1
+    if not pieces:
+        totals["<no symbol>"] += samples
+        return []
+    size = sum(length for _, length in pieces)
+    for name, length in pieces:
+        totals[name] += samples * length / size
+    return [name for name, _ in pieces]
+
+
+def read_port(port, baud, timeout):
+    import serial
+
+    with serial.Serial(port, baud, timeout=timeout) as link:
+        link.reset_input_buffer()
+        link.write(b"p")
+        data = bytearray()
+        while True:
+            chunk = link.read(256)
+            if not chunk:
+                break
+            data += chunk
+    return bytes(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture file")
+    parser.add_argument("--sym", required=True, help="nm -n symbol table, ex: main.sym")
+    parser.add_argument("--port", help="serial port to request a dump from")
+    parser.add_argument("--baud", type=int, default=9600)
+    parser.add_argument("--timeout", type=float, default=2.0)
+    parser.add_argument("--buckets", action="store_true",
+                        help="also list the buckets with samples")
+    args = parser.parse_args()
+
+    if args.port:
+        data = read_port(args.port, args.baud, args.timeout)
+    elif args.capture:
+        with open(args.capture, "rb") as capture:
+            data = capture.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    symbols = read_symbols(args.sym)
+    totals = collections.Counter()
+    samples = 0
+    outside_total = 0
+    hz = None
+    bucket_lines = []
+    for hz, shift, base, outside, counts in decode(data):
+        outside_total += outside
+        samples += outside
+        for i, count in enumerate(counts):
+            if count == 0:
+                continue
+            samples += count
+            start = base + (i << shift)
+            end = start + (1 << shift)
+            names = spread(symbols, start, end, count, totals)
+            bucket_lines.append("0x%04x-0x%04x %8u  %s" %
+                                (start, end - 1, count, " ".join(names)))
+    if hz is None:
+        print("no profile dump found", file=sys.stderr)
+        return 1
+
+    print("%u samples at %u Hz (%.1f s)" % (samples, hz, samples / hz))
+    if outside_total:
+        totals["<outside the buckets>"] += outside_total
+    for name, count in totals.most_common():
+        print("%6.2f%% %10.1f  %s" % (100.0 * count / samples, count, name))
+    if args.buckets:
+        print()
+        print("\n".join(bucket_lines))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Decode an event trace dump from the cat feeder into a timeline.
+
+The dump is requested with the 't' serial command. Either decode a raw
+capture of the serial output:
+
+    trace_decode.py capture.bin
+
+or request and read a dump directly (needs pyserial):
+
+    trace_decode.py --port /dev/ttyACM0
+
+Event names are read from the TraceEvent enumeration in trace.h.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MARKER = b"TRACE"
+RECORD = struct.Struct("<IHH")
+HEADER = struct.Struct("<IB")
+
+TWI_STATUS = {
+    0x00: "BUS_ERROR",
+    0x08: "START",
+    0x10: "REP_START",
+    0x18: "MT_SLA_ACK",
+    0x20: "MT_SLA_NACK",
+    0x28: "MT_DATA_ACK",
+    0x30: "MT_DATA_NACK",
+    0x38: "ARB_LOST",
+    0x40: "MR_SLA_ACK",
+    0x48: "MR_SLA_NACK",
+    0x50: "MR_DATA_ACK",
+    0x58: "MR_DATA_NACK",
+    0x60: "SR_SLA_ACK",
+    0x68: "SR_ARB_LOST_SLA_ACK",
+    0x70: "SR_GCALL_ACK",
+    0x78: "SR_ARB_LOST_GCALL_ACK",
+    0x80: "SR_DATA_ACK",
+    0x88: "SR_DATA_NACK",
+    0x90: "SR_GCALL_DATA_ACK",
+    0x98: "SR_GCALL_DATA_NACK",
+    0xA0: "SR_STOP",
+    0xA8: "ST_SLA_ACK",
+    0xB0: "ST_ARB_LOST_SLA_ACK",
+    0xB8: "ST_DATA_ACK",
+    0xC0: "ST_DATA_NACK",
+    0xC8: "ST_LAST_DATA",
+    0xF8: "NO_INFO",
+}
+
+ADC_MODE = {0: "Polling", 1: "FreeRunning", 0xFF: "closed"}
+
+
+def read_event_names(header_path):
+    """Map event ids to names from the TraceEvent enumeration."""
+    with open(header_path) as header:
+        text = header.read()
+    body = re.search(r"enum TraceEvent\s*{(.*?)}", text, re.S).group(1)
+    names = {}
+    for name, value in re.findall(r"Trace(\w+)\s*=\s*(\d+)", body):
+        names[int(value)] = name
+    return names
+
+
+def format_arg(name, arg):
+    if name == "TwiStatus":
+        return "0x%02x %s" % (arg, TWI_STATUS.get(arg, "?"))
+    if name == "AdcMode":
+        return ADC_MODE.get(arg, str(arg))
+    if name == "Command" and 32 <= arg < 127:
+        return "'%c'" % arg
+    return str(arg)
+
+
+def decode(data, names):
+    """Yield (seconds, name, argument) for every record in every dump."""
+    start = data.find(MARKER)
+    while start >= 0:
+        offset = start + len(MARKER)
+        tick_hz, count = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        previous = None
+        elapsed = 0
+        for _ in range(count):
+            tick, event, arg = RECORD.unpack_from(data, offset)
+            offset += RECORD.size
+            # Ticks wrap at 32 bits, accumulate the differences
+            if previous is not None:
+                elapsed += (tick - previous) & 0xFFFFFFFF
+            previous = tick
+            name = names.get(event, "Event%d" % event)
+            yield elapsed / tick_hz, tick, name, format_arg(name, arg)
+        start = data.find(MARKER, offset)
+
+
+def read_port(port, baud, timeout):
+    import serial
+
+    with serial.Serial(port, baud, timeout=timeout) as link:
+        link.reset_input_buffer()
+        link.write(b"t")
+        data = bytearray()
+        while True:
+            chunk = link.read(256)
+            if not chunk:
+                break
+            data += chunk
+    return bytes(data)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw serial capture file")
+    parser.add_argument("--port", help="serial port to request a dump from")
+    parser.add_argument("--baud", type=int, default=9600)
+    parser.add_argument("--timeout", type=float, default=2.0)
+    parser.add_argument("--header", default=os.path.join(here, "..", "trace.h"))
+    args = parser.parse_args()
+
+    if args.port:
+        data = read_port(args.port, args.baud, args.timeout)
+    elif args.capture:
+        with open(args.capture, "rb") as capture:
+            data = capture.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    names = read_event_names(args.header)
+    found = False
+    for seconds, tick, name, arg in decode(data, names):
+        found = True
+        print("%12.6f  %10u  %-14s %s" % (seconds, tick, name, arg))
+    if not found:
+        print("no trace dump found", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
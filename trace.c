@@ -0,0 +1,83 @@
+
+#include "trace.h"
+#include "timebase.h"
+#include "usart.h"
+#include <util/atomic.h>
+
+/* PRIVATE GLOBALS */
+static struct trace_record_t records[TRACE_RECORDS];
+static uint8_t head;
+static uint8_t count;
+static volatile uint8_t paused;
+
+void trace_event(enum TraceEvent event, uint16_t arg)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!paused)
+    {
+      struct trace_record_t *record = &records[head];
+      record->tick = timebase_ticks();
+      record->event = event;
+      record->arg = arg;
+      head = (head + 1) & (TRACE_RECORDS - 1);
+      if (count < TRACE_RECORDS)
+      {
+        ++count;
+      }
+    }
+  }
+}
+
+uint8_t trace_last(struct trace_record_t *record)
+{
+  uint8_t found = 1;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (count > 0)
+    {
+      *record = records[(head - 1) & (TRACE_RECORDS - 1)];
+      found = 0;
+    }
+  }
+  return found;
+}
+
+/// @brief Send bytes over the serial port without any translation
+static void trace_send(const void *data, uint8_t size)
+{
+  const uint8_t *bytes = data;
+  for (uint8_t i=0; i < size; ++i)
+  {
+    usart_put_char(bytes[i]);
+  }
+}
+
+void trace_dump(void)
+{
+  // Freeze the ring, events that happen while it is sent are dropped
+  uint8_t dump_count;
+  uint8_t tail;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    paused = 1;
+    dump_count = count;
+    tail = (head - count) & (TRACE_RECORDS - 1);
+  }
+
+  uint32_t tick_hz = TIMEBASE_HZ;
+  trace_send("TRACE", 5);
+  trace_send(&tick_hz, sizeof(tick_hz));
+  trace_send(&dump_count, sizeof(dump_count));
+  for (uint8_t i=0; i < dump_count; ++i)
+  {
+    trace_send(&records[(tail + i) & (TRACE_RECORDS - 1)],
+        sizeof(struct trace_record_t));
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    count = 0;
+    paused = 0;
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ * @file trace.h
+ * @brief Timestamped event trace ring buffer.
+ *
+ * Interrupts and drivers record 8 byte events (time base tick, event id,
+ * argument) into a RAM ring that keeps the newest TRACE_RECORDS events.
+ * The ring is dumped in binary over the serial port on request and
+ * decoded on the host with tools/trace_decode.py. Build with
+ * -DTRACE_ENABLE=0 to compile the tracepoints out.
+ */
+#ifndef _CAT_FEEDER_TRACE_H_
+#define _CAT_FEEDER_TRACE_H_
+
+#include <stdint.h>
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1
+#endif
+
+// Number of records in the ring - MUST BE POWER OF 2, at most 128
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 32
+#endif
+
+/// @brief TraceEvent is an enumeration of the trace event ids
+///
+/// tools/trace_decode.py reads the names from this enumeration, keep one
+/// event per line.
+enum TraceEvent
+{
+  TraceBoot = 0,        // arg: number of missed feeds
+  TraceTwiStatus = 1,   // arg: final TWI status code of a transaction
+  TraceStepperStart = 2,// arg: channel
+  TraceStepperStop = 3, // arg: channel
+  TraceAdcMode = 4,     // arg: ADCMode, 0xFF when closed
+  TraceButton = 5,      // arg: 0
+  TraceRtcWake = 6,     // arg: 0
+  TraceFeed = 7,        // arg: portions
+  TraceCommand = 8,     // arg: serial command character
+  TraceHub = 9          // arg: HUB_SET_* flags of a hub write
+};
+
+/// @brief A single trace record
+struct trace_record_t
+{
+  uint32_t tick;
+  uint16_t event;
+  uint16_t arg;
+};
+
+#if TRACE_ENABLE
+#define TRACE(event, arg) trace_event((event), (arg))
+#else
+#define TRACE(event, arg)
+#endif
+
+/// @brief Record an event, overwriting the oldest record if the ring is full
+///
+/// Safe to call from interrupts
+/// @param event is the event id
+/// @param arg is the event argument
+void trace_event(enum TraceEvent event, uint16_t arg);
+
+/// @brief Get the most recent event
+/// @param record is updated with the most recent record
+/// @returns 0 if a record was returned, 1 if the ring is empty
+uint8_t trace_last(struct trace_record_t *record);
+
+/// @brief Send the ring over the serial port and empty it
+///
+/// Format: the marker "TRACE", the time base frequency (uint32), the record
+/// count (uint8), then the records oldest first. All values little endian.
+/// Tracing is paused while the ring is sent.
+void trace_dump(void);
+
+#endif
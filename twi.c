@@ -1,12 +1,177 @@
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include <util/atomic.h>
+#include <util/delay.h>
 #include "twi.h"
+#include "clock.h"
+#include "config.h"
+#include "counters.h"
+#include "power.h"
+#include "trace.h"
 
 // (private) global state that determines if the bus is currently in a transmission
 static uint8_t twi_in_transmission;
 // (private) global state that determines if the bus is currently enabled (Just use TWEN bit?)
 //static uint8_t twi_initialized;
 
+// Non zero once twi_slave_open() has been called
+static uint8_t slave_open;
+// Slave register file, and the copy a read is sent from
+static uint8_t slave_registers[TWI_SLAVE_SIZE];
+static uint8_t slave_snapshot[TWI_SLAVE_SIZE];
+// Register the next byte is read from or written to
+static uint8_t slave_pointer;
+static uint8_t slave_pointer_set;
+// Non zero from the slave address to the end of a slave transfer
+static volatile uint8_t slave_active;
+// The last write, held until the main loop takes it
+static uint8_t slave_write[TWI_SLAVE_SIZE];
+static uint8_t slave_write_reg;
+static uint8_t slave_write_len;
+static volatile uint8_t slave_write_ready;
+
+ISR(TWI_vect)
+{
+  uint8_t ack = 1;
+  switch (TW_STATUS)
+  {
+    case TW_SR_SLA_ACK:
+    case TW_SR_ARB_LOST_SLA_ACK:
+    {
+      slave_active = 1;
+      slave_pointer_set = 0;
+      break;
+    }
+    case TW_SR_DATA_ACK:
+    {
+      uint8_t data = TWDR;
+      if (!slave_pointer_set)
+      {
+        slave_pointer = data % TWI_SLAVE_SIZE;
+        slave_pointer_set = 1;
+        if (!slave_write_ready)
+        {
+          slave_write_reg = slave_pointer;
+          slave_write_len = 0;
+        }
+      }
+      else
+      {
+        slave_write[slave_write_len++] = data;
+        slave_pointer = (slave_pointer + 1) % TWI_SLAVE_SIZE;
+      }
+      // Refuse the next byte if it has nowhere to go
+      ack = !slave_write_ready && slave_write_len < TWI_SLAVE_SIZE;
+      break;
+    }
+    case TW_SR_STOP:
+    {
+      // A STOP or a repeated START, the write is complete
+      if (slave_write_len > 0)
+        slave_write_ready = 1;
+      slave_active = 0;
+      break;
+    }
+    case TW_ST_SLA_ACK:
+    case TW_ST_ARB_LOST_SLA_ACK:
+    {
+      slave_active = 1;
+      // Every byte of the read comes from the same moment
+      memcpy(slave_snapshot, slave_registers, TWI_SLAVE_SIZE);
+    }
+      /* fall through */
+    case TW_ST_DATA_ACK:
+    {
+      TWDR = slave_snapshot[slave_pointer];
+      slave_pointer = (slave_pointer + 1) % TWI_SLAVE_SIZE;
+      break;
+    }
+    case TW_SR_DATA_NACK:
+    {
+      // A refused write is dropped
+      if (!slave_write_ready)
+        slave_write_len = 0;
+      slave_active = 0;
+      break;
+    }
+    case TW_BUS_ERROR:
+    {
+      // Release the bus, no STOP is sent on the wire
+      slave_active = 0;
+      TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+      return;
+    }
+    default:
+    {
+      // The master has read enough, or another master won the bus
+      slave_active = 0;
+      break;
+    }
+  }
+  TWCR = _BV(TWINT) | (ack ? _BV(TWEA) : 0) | _BV(TWEN) | _BV(TWIE);
+}
+
+// Start a master transfer with a START. A slave transfer under way is let
+// finish first. The master writes to TWCR leave TWIE clear, which keeps
+// the slave interrupt off until twi_slave_resume().
+static uint8_t twi_master_begin(void)
+{
+  // In 100 us steps, _delay_us() counts F_CPU cycles and lasts
+  // 1 << clock_speed() as long on a divided clock
+  for (uint16_t wait=0; wait < TWI_SLAVE_WAIT_MS * 10;
+      wait += 1 << clock_speed())
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      // TWINT with TWIE set is a slave event the interrupt hasn't taken
+      if (!slave_active &&
+          (TWCR & (_BV(TWINT) | _BV(TWIE))) != (_BV(TWINT) | _BV(TWIE)))
+      {
+        TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWSTA) | _BV(TWEN);
+        return 0;
+      }
+    }
+    _delay_us(100);
+  }
+  return 1;
+}
+
+// Hand the TWI back to the slave interrupt after a master transfer
+static void twi_slave_resume(void)
+{
+  if (slave_open)
+  {
+    TWCR = _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  }
+}
+
+// Wait for the current bus operation to complete
+static void twi_wait(void)
+{
+  COUNTER_BEGIN();
+  loop_until_bit_is_set(TWCR, TWINT);
+  COUNTER_END(CounterTwi);
+}
+
+// End a master transfer that failed on status. A STOP is only sent while
+// the bus is still ours: after losing arbitration, maybe to a master
+// addressing us, it would cut the other master's transfer off.
+static int twi_master_fail(uint8_t status)
+{
+  if (status == TW_MT_ARB_LOST || status == TW_SR_ARB_LOST_SLA_ACK ||
+      status == TW_SR_ARB_LOST_GCALL_ACK || status == TW_ST_ARB_LOST_SLA_ACK)
+  {
+    TRACE(TraceTwiStatus, status);
+    twi_in_transmission = 0;
+    twi_slave_resume();
+    return status;
+  }
+  twi_stop();
+  return status;
+}
+
 // Initialize the SCL and SDA pins and setup i2c bus
 int twi_init(void)
 {
@@ -15,6 +180,7 @@ int twi_init(void)
   {
     return TW_BUS_ERROR;
   }
+  power_acquire(PowerTwi);
 
   // Initialize SCL and SDA as input pins
   DDRC &= ~(_BV(PC5) | _BV(PC4)); 
@@ -22,10 +188,7 @@ int twi_init(void)
   PORTC |= (_BV(PC5) | _BV(PC4));
 
   // Setup bit rate it bit rate register
-  // first clear the prescaler bits (prescaler = 1)
-  TWSR &= ~(_BV(TWPS0) | _BV(TWPS1));
-  // Calculate bit rate register with clock frequency and bus rate
-  TWBR = ((F_CPU/TWI_SCL_FREQ)-16)/2;
+  twi_set_clock();
   
   // enable the bus
   TWCR = _BV(TWEN) | _BV(TWEA); 
@@ -35,24 +198,49 @@ int twi_init(void)
   return TWI_OK;
 }
 
+// Set the bit rate register from the current clock
+void twi_set_clock(void)
+{
+  // first clear the prescaler bits (prescaler = 1)
+  TWSR &= ~(_BV(TWPS0) | _BV(TWPS1));
+  // Calculate bit rate register with clock frequency and bus rate. A slow
+  // clock can't reach the bus rate, run the bus as fast as it allows.
+  uint32_t divider = clock_hz() / config.twi_scl_freq;
+  if (divider <= 16)
+    TWBR = 0;
+  else if (divider >= 16 + 2 * 255)
+    TWBR = 255;
+  else
+    TWBR = (divider - 16) / 2;
+}
+
 // Initiate master receiver mode (read)
 int twi_read(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
 {
   /* START */
   // Check to see if already in transmission or if a start condition
   // needs to be signaled
-  if (!twi_in_transmission)
+  if (!twi_in_transmission && twi_master_begin())
   {
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWSTA) | _BV(TWEN);
+    return TWI_BUSY;
   }
   // wait for start condition to be initiated
-  loop_until_bit_is_set(TWCR, TWINT);
+  twi_wait();
   if (TW_STATUS != TW_START) // TODO might also need to check for repeat start code
   {
     // Handle error and/or return it
-    if (TW_STATUS == TW_BUS_ERROR)
+    uint8_t status = TW_STATUS;
+    if (status == TW_BUS_ERROR)
+    {
       twi_stop();
-    return TW_STATUS;
+    }
+    else
+    {
+      TRACE(TraceTwiStatus, status);
+      // Lost the bus, maybe to a master addressing us
+      twi_slave_resume();
+    }
+    return status;
   }
   twi_in_transmission = 1;
 
@@ -62,11 +250,10 @@ int twi_read(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
   // Send address (clear interrupt flag, enable ack, enable bus)
   TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN);
   // Wait for address to be acknowledged and enter master receiver mode
-  loop_until_bit_is_set(TWCR, TWINT);
+  twi_wait();
   if (TW_STATUS != TW_MR_SLA_ACK)
   {
-    twi_stop();
-    return TW_STATUS;
+    return twi_master_fail(TW_STATUS);
   }
 
   /* DATA */
@@ -85,7 +272,7 @@ int twi_read(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
       TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN);
     }
     // wait for data to become available
-    loop_until_bit_is_set(TWCR, TWINT);
+    twi_wait();
     // Check status
     if (TW_STATUS == TW_MR_DATA_ACK || TW_STATUS == TW_MR_DATA_NACK) // TODO make these two seperate cases? what happens when device doesn't keep returning data?
     {
@@ -95,8 +282,7 @@ int twi_read(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
     else
     {
       // handle error
-      twi_stop();
-      return TW_STATUS;
+      return twi_master_fail(TW_STATUS);
     }
   }
   
@@ -111,20 +297,28 @@ int twi_write(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
   /* START */
   // Check to see if already in transmission or if a start condition
   // needs to be signaled
-  if (!twi_in_transmission)
+  if (!twi_in_transmission && twi_master_begin())
   {
-    // Signal start condition
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWSTA) | _BV(TWEN);    
+    return TWI_BUSY;
   }
   // Wait for start condition to be initiated
-  loop_until_bit_is_set(TWCR, TWINT);
+  twi_wait();
   // check that the start condition status was successful
   if (TW_STATUS != TW_START)
   {
     // Handle error and/or return it
-    if (TW_STATUS == TW_BUS_ERROR)
+    uint8_t status = TW_STATUS;
+    if (status == TW_BUS_ERROR)
+    {
       twi_stop();
-    return TW_STATUS;
+    }
+    else
+    {
+      TRACE(TraceTwiStatus, status);
+      // Lost the bus, maybe to a master addressing us
+      twi_slave_resume();
+    }
+    return status;
   }
   twi_in_transmission = 1;
 
@@ -134,11 +328,10 @@ int twi_write(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
   // Transmit address (clear interrupt flag, enable ack, and enable bus)
   TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN);
   // Check that address was acknowledged by slave device
-  loop_until_bit_is_set(TWCR, TWINT);
+  twi_wait();
   if (TW_STATUS != TW_MT_SLA_ACK)
   {
-    twi_stop();
-    return TW_STATUS;
+    return twi_master_fail(TW_STATUS);
   }
 
   /* DATA */
@@ -148,15 +341,14 @@ int twi_write(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
     TWDR = data_buffer[i];
     TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN);
     // wait for bus to send data
-    loop_until_bit_is_set(TWCR, TWINT);
+    twi_wait();
     if (TW_STATUS != TW_MT_DATA_ACK)
     {
       // handle error
       // TODO if errors out here, maybe take lenght in by pointer so
       // it can be modified to notify the user where the transmission
       // failed...
-      twi_stop();
-      return TW_STATUS;
+      return twi_master_fail(TW_STATUS);
     }
   }
 
@@ -169,14 +361,16 @@ int twi_write(uint8_t address, uint8_t *data_buffer, uint8_t data_len)
 // TODO make this function static and add to read/write API to indicate stop
 int twi_stop(void)
 {
+  // Record how the transaction ended
+  TRACE(TraceTwiStatus, TW_STATUS);
   // Set stop condition 
   TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWSTO) | _BV(TWEN); 
-  while (TWCR & _BV(TWSTO))
-  {
-    // stopping...
-    continue;
-  }
+  COUNTER_BEGIN();
+  // stopping...
+  loop_until_bit_is_clear(TWCR, TWSTO);
+  COUNTER_END(CounterTwi);
   twi_in_transmission = 0;
+  twi_slave_resume();
   return TWI_OK;
 }
 
@@ -185,6 +379,51 @@ void twi_close(void)
 {
   // do I need to check if there is an ongoing transmission?
   // Should I write just TWINT to clear any operation on the bus?
-  TWCR = 0;
+  if (TWCR & _BV(TWEN))
+  {
+    TWCR = 0;
+    slave_open = 0;
+    slave_active = 0;
+    power_release(PowerTwi);
+  }
+}
+
+int twi_slave_open(uint8_t address)
+{
+  if (!(TWCR & _BV(TWEN)))
+  {
+    return TW_BUS_ERROR;
+  }
+  // No general call
+  TWAR = address << 1;
+  slave_open = 1;
+  TWCR = _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  return TWI_OK;
+}
+
+void twi_slave_publish(uint8_t reg, const void *data, uint8_t size)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memcpy(&slave_registers[reg], data, size);
+  }
 }
 
+uint8_t twi_slave_receive(uint8_t *reg, uint8_t *data)
+{
+  if (!slave_write_ready)
+  {
+    return 0;
+  }
+  // The interrupt leaves the write alone until it is taken
+  uint8_t len = slave_write_len;
+  *reg = slave_write_reg;
+  memcpy(data, slave_write, len);
+  slave_write_ready = 0;
+  return len;
+}
+
+uint8_t twi_slave_pending(void)
+{
+  return slave_write_ready;
+}
@@ -6,13 +6,18 @@
 #include <util/twi.h>
 
 // Defines for AtMega328P Specific layout
+// Default SCL frequency, the frequency in use is in config
 #ifndef TWI_SCL_FREQ
 #define TWI_SCL_FREQ 100000L
 #endif
 
-// default clock speed for atmega328p (changed at top of main)
-#ifndef F_CPU
-#define F_CPU 16000000UL
+// Register file the slave interface exposes to a bus master, at most 255
+#ifndef TWI_SLAVE_SIZE
+#define TWI_SLAVE_SIZE 64
+#endif
+// Longest a master transfer waits for a slave transfer to end
+#ifndef TWI_SLAVE_WAIT_MS
+#define TWI_SLAVE_WAIT_MS 10
 #endif
 
 // Defines for all the TWI Status codes
@@ -30,10 +35,17 @@
 // #define TWI_NO_STATE_INFO 0xF8
 // #define TWI_ERROR 0x00
 #define TWI_OK 0x01
+// The bus was left to a slave transfer that didn't end in time
+#define TWI_BUSY 0x02
 
 /// @brief Initialize the two wire interface bus
 int twi_init(void);
 
+/// @brief Set the bit rate for the current system clock
+///
+/// The SCL frequency is the one in config, or as close as the clock allows.
+void twi_set_clock(void);
+
 /// @brief Start a read transmission
 /// @param address is the address of the device on the bus to read from
 /// @param data_buffer is a buffer the read data will be copied out to
@@ -58,4 +70,40 @@ int twi_stop(void);
 /// @brief Close or disable the TWI (I2C bus)
 void twi_close(void);
 
+/// @brief Answer as a slave at an address, after twi_init()
+///
+/// Another master on the bus reads and writes a register file of
+/// TWI_SLAVE_SIZE bytes from the TWI interrupt. A write sets the register
+/// pointer with its first byte and stores the bytes after it from there.
+/// A read continues from the pointer and takes all its bytes from a copy
+/// made when it was addressed. Both advance the pointer, wrapping at the
+/// end. The interrupt is held off during master transfers, which wait up
+/// to TWI_SLAVE_WAIT_MS for a slave transfer to end first.
+///
+/// The CPU clock has to be at least 16 times the bus clock, even at the
+/// low clock.
+/// @param address is the 7 bit slave address
+/// @returns TWI_OK, or an error code if the bus isn't initialized
+int twi_slave_open(uint8_t address);
+
+/// @brief Update registers the master reads
+///
+/// A read already under way keeps the values it started with.
+/// @param reg is the first register
+/// @param data is the new register values
+/// @param size is the number of registers
+void twi_slave_publish(uint8_t reg, const void *data, uint8_t size);
+
+/// @brief Take the registers the master wrote in its last write
+///
+/// Further writes are not acknowledged until the last one is taken.
+/// @param reg is updated with the first register written
+/// @param data is a buffer of TWI_SLAVE_SIZE bytes updated with the values
+/// @returns the number of registers written, 0 if there is no write
+uint8_t twi_slave_receive(uint8_t *reg, uint8_t *data);
+
+/// @brief Check for a write waiting to be taken, safe with interrupts off
+/// @returns 1 if twi_slave_receive() has a write to return, otherwise 0
+uint8_t twi_slave_pending(void);
+
 #endif
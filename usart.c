@@ -1,12 +1,60 @@
 
 
 #include "usart.h"
+#include "clock.h"
+#include "config.h"
+#include "counters.h"
+#include "power.h"
+
+// Set when a character may still be shifting out
+static uint8_t transmitting;
+
+// Get the baud rate a divider gives for a clock
+static uint32_t usart_baud(uint32_t hz, uint8_t samples, uint16_t prescale)
+{
+  return hz / ((uint32_t)samples * (prescale + 1));
+}
+
+void usart_set_clock(void)
+{
+  uint32_t hz = clock_hz();
+  uint32_t baud = config.usart_baud;
+  uint16_t prescale = ((hz / 16) + (baud / 2)) / baud - 1;
+  uint16_t double_prescale = ((hz / 8) + (baud / 2)) / baud - 1;
+  // Double speed samples each bit 8 instead of 16 times, it is only worth
+  // it when the normal divider is too coarse for the clock
+  uint32_t error = usart_baud(hz, 16, prescale);
+  error = error > baud ? error - baud : baud - error;
+  uint32_t double_error = usart_baud(hz, 8, double_prescale);
+  double_error = double_error > baud ?
+    double_error - baud : baud - double_error;
+  if (double_error < error)
+  {
+    UCSR0A |= (1 << U2X0);
+    prescale = double_prescale;
+  }
+  else
+  {
+    UCSR0A &= ~(1 << U2X0);
+  }
+  UBRR0H = (prescale >> 8);
+  UBRR0L = prescale;
+}
+
+void usart_flush(void)
+{
+  if (transmitting)
+  {
+    loop_until_bit_is_set(UCSR0A, TXC0);
+    transmitting = 0;
+  }
+}
 
 void usart_open(void)
 {
+  power_acquire(PowerUsart0);
   // Set baudrate prescaler
-  UBRR0H = (BAUD_PRESCALE >> 8);
-  UBRR0L = BAUD_PRESCALE;
+  usart_set_clock();
   // Enable RX and TX pins
   UCSR0B = (1 << RXEN0) | (1 << TXEN0);
   // Setings: 8 data bits, a single stop bit, no parity
@@ -19,13 +67,23 @@ void usart_close(void)
 {
   // Disable interrupts
   UCSR0B &= ~(1 << RXCIE0);
+  // Let the last character go out before the clock stops
+  usart_flush();
   // Disable RX and TX pins
   UCSR0B &= ~((1 << RXEN0) | (1 << TXEN0));
+  power_release(PowerUsart0);
 }
 
 void usart_put_char(char c)
 {
+  COUNTER_BEGIN();
   loop_until_bit_is_set(UCSR0A, UDRE0);
+  COUNTER_END(CounterSerialTx);
+  // Clear the transmit complete flag, it is set again once this character
+  // has been sent. Writing back the other flags as read would clear a
+  // pending one, only U2X0 and MPCM0 are kept.
+  UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+  transmitting = 1;
   UDR0=c;
 }
 
@@ -8,13 +8,21 @@
 
 #include "avr/io.h"
 
+// Default baud rate, the rate in use is in config
+#ifndef USART_BAUD
 #define USART_BAUD 9600
-#define BAUD_PRESCALE ((((F_CPU / 16) + (USART_BAUD  / 2)) / (USART_BAUD))- 1)
+#endif
 
 void usart_open(void);
 
 void usart_close(void);
 
+/// @brief Set the baud rate divider for the current system clock
+void usart_set_clock(void);
+
+/// @brief Wait until the last character written has been sent
+void usart_flush(void);
+
 void usart_put_char(char c);
 
 void usart_print_strn(const char *str, uint8_t size);
@@ -0,0 +1,109 @@
+
+#include "watchdog.h"
+#include "pc_capture.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+// Marks a crash record written by the watchdog interrupt
+#define WATCHDOG_CRASH_MAGIC 0xC4A5
+
+/* PRIVATE GLOBALS */
+// Kept through a reset, see watchdog_expired()
+static struct watchdog_crash_t crash_record __attribute__((section(".noinit")));
+static uint16_t crash_magic __attribute__((section(".noinit")));
+static uint8_t reset_cause __attribute__((section(".noinit")));
+// The record of the last reset, if it was a watchdog reset
+static struct watchdog_crash_t last_crash;
+static uint8_t crashed;
+
+#ifdef __AVR__
+// The watchdog stays enabled on its shortest period after a watchdog
+// reset, turn it off before the C runtime start up can outlast it. MCUSR
+// has to be cleared for that, keep it for watchdog_open().
+static void __attribute__((naked, used, section(".init3")))
+watchdog_init(void)
+{
+  reset_cause = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+#endif
+
+// Called from the watchdog interrupt with the program counter (word
+// address) it interrupted
+static void __attribute__((used)) watchdog_expired(uint16_t pc)
+{
+  uint8_t checked_in = GPIOR0;
+  GPIOR0 = 0;
+  if ((checked_in & WATCHDOG_CHECK_INS) == WATCHDOG_CHECK_INS)
+  {
+    // The hardware cleared WDIE to reset at the next timeout, interrupt
+    // again instead
+    WDTCSR |= (1 << WDIE);
+    return;
+  }
+  crash_record.missing = WATCHDOG_CHECK_INS & ~checked_in;
+  crash_record.pc = pc << 1;
+  if (trace_last(&crash_record.last_event))
+  {
+    crash_record.last_event.tick = 0;
+    crash_record.last_event.event = 0xFFFF;
+    crash_record.last_event.arg = 0;
+  }
+  ++crash_record.resets;
+  crash_magic = WATCHDOG_CRASH_MAGIC;
+  // Reset on the shortest period rather than wait out another one
+  WDTCSR = (1 << WDCE) | (1 << WDE);
+  WDTCSR = (1 << WDE);
+}
+
+PC_CAPTURE_ISR(WDT_vect, watchdog_expired)
+
+void watchdog_open(void)
+{
+#ifndef __AVR__
+  // The host simulation has no start up sections
+  reset_cause = MCUSR;
+  MCUSR = 0;
+#endif
+  crashed = (reset_cause & (1 << WDRF))
+    && crash_magic == WATCHDOG_CRASH_MAGIC;
+  crash_magic = 0;
+  if (crashed)
+  {
+    crash_record.reset_cause = reset_cause;
+    last_crash = crash_record;
+  }
+  else
+  {
+    crash_record.resets = 0;
+  }
+
+  GPIOR0 = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    wdt_reset();
+    // Timed sequence, the second write has to follow within 4 cycles
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = (1 << WDIE) | (1 << WDE)
+      | ((WATCHDOG_TIMEOUT & 0x08) ? (1 << WDP3) : 0)
+      | (WATCHDOG_TIMEOUT & 0x07);
+  }
+}
+
+uint8_t watchdog_reset_cause(void)
+{
+  return reset_cause;
+}
+
+uint8_t watchdog_crash(struct watchdog_crash_t *crash)
+{
+  if (!crashed)
+  {
+    return 1;
+  }
+  *crash = last_crash;
+  return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * @file watchdog.h
+ * @brief Watchdog supervision with check-ins and a crash record.
+ *
+ * The watchdog runs in interrupt and system reset mode. Each supervised
+ * subsystem checks in at least once per WATCHDOG_TIMEOUT. The watchdog
+ * interrupt arms itself for another period if every check-in came;
+ * otherwise it writes a crash record to .noinit RAM, which a reset leaves
+ * alone, and resets the part. The interrupt wakes the CPU from sleep, so
+ * the main loop gets a pass in before the next one.
+ */
+#ifndef _CAT_FEEDER_WATCHDOG_H_
+#define _CAT_FEEDER_WATCHDOG_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "trace.h"
+
+// Watchdog period, a WDTO_* value of <avr/wdt.h>
+#ifndef WATCHDOG_TIMEOUT
+#define WATCHDOG_TIMEOUT WDTO_2S
+#endif
+
+/// @brief WatchdogCheckIn is an enumeration of the supervised subsystems,
+/// bit numbers in GPIOR0
+enum WatchdogCheckIn
+{
+  WatchdogMainLoop = 0, // every pass of the main loop
+  WatchdogTimebase = 1  // every pass of the main loop the time base moved
+};
+
+/// @brief Check-ins the watchdog waits for each period
+#define WATCHDOG_CHECK_INS \
+  ((1 << WatchdogMainLoop) | (1 << WatchdogTimebase))
+
+/// @brief The state of the firmware when the watchdog reset it
+struct watchdog_crash_t
+{
+  // MCUSR after the reset
+  uint8_t reset_cause;
+  // Check-ins that didn't come, bit per WatchdogCheckIn
+  uint8_t missing;
+  // Byte address of the code the watchdog interrupted
+  uint16_t pc;
+  // Last trace event before it, event 0xFFFF if there was none
+  struct trace_record_t last_event;
+  // Watchdog resets since the last other reset
+  uint8_t resets;
+};
+
+/// @brief Check in a subsystem for this period
+///
+/// A single instruction, safe to call from interrupts.
+/// @param check_in is the subsystem
+static inline void watchdog_check_in(enum WatchdogCheckIn check_in)
+{
+  GPIOR0 |= (1 << check_in);
+}
+
+/// @brief Pick up the crash record of the last reset and start supervising
+///
+/// Call once, early in main(). The watchdog interrupt needs interrupts
+/// enabled within WATCHDOG_TIMEOUT.
+void watchdog_open(void);
+
+/// @brief Get the cause of the last reset
+/// @returns MCUSR as it was after the reset. ex: (1 << WDRF)
+uint8_t watchdog_reset_cause(void);
+
+/// @brief Get the crash record of a watchdog reset
+/// @param crash is updated with the record
+/// @returns 0 if the last reset was a watchdog reset with a crash record,
+/// otherwise 1
+uint8_t watchdog_crash(struct watchdog_crash_t *crash);
+
+#endif